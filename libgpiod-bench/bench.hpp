@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gpio.hpp"
+
+// Small helpers shared by the benchmarks. Every result is printed as "name value unit" on one line so
+// the output can be diffed or grepped between releases.
+namespace bench {
+
+inline void report(const std::string& name, double value, const std::string& unit) {
+    std::cout << std::left << std::setw(44) << name << std::right << std::setw(16) << std::fixed << std::setprecision(1)
+              << value << ' ' << unit << '\n';
+}
+
+inline double seconds_since(std::uint64_t start_ns) {
+    return static_cast<double>(backend::monotonic_ns() - start_ns) / 1e9;
+}
+
+// p is 0..100, sorts the samples in place.
+inline std::uint64_t percentile(std::vector<std::uint64_t>& samples, double p) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    std::size_t index = static_cast<std::size_t>(p / 100.0 * static_cast<double>(samples.size() - 1));
+    return samples[index];
+}
+
+// The benchmarks need to play the outside world, so only simulated chips will do.
+inline backend::sim_controls& controls(backend::chip& chip) {
+    auto* sim = dynamic_cast<backend::sim_controls*>(&chip);
+    if (!sim) {
+        throw std::system_error(ENOTSUP, std::generic_category(), chip.path() + " can't be driven from software, use \"sim\" or \"gpio-sim\"");
+    }
+    return *sim;
+}
+
+}
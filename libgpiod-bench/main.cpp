@@ -0,0 +1,1534 @@
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "debounce.hpp"
+#include "deadline_timer.hpp"
+#include "edge_reader.hpp"
+#include "filters.hpp"
+#include "frame_table.hpp"
+#include "gpio_bus.hpp"
+#include "logger.hpp"
+#include "pulse_meter.hpp"
+#include "quadrature.hpp"
+#include "ranging.hpp"
+#include "reactor.hpp"
+#include "rules.hpp"
+#include "shards.hpp"
+#include "shift_register.hpp"
+#include "sim_shift_register.hpp"
+#include "sim_ultrasonic.hpp"
+#include "soft_pwm.hpp"
+#include "spsc_ring.hpp"
+#include "tasks.hpp"
+#include "trace.hpp"
+
+/*
+Benchmarks for the GPIO paths the examples depend on. Run with "make bench", see README.md.
+
+Line layout used on the benchmark chip:
+- offsets 0..7 are outputs for the write benchmarks
+- offsets 8 and 9 are the trigger and echo of a pretend HC-SR04
+- offset 10 is an input we toggle from the outside
+- offset 11 is the output we drive in response to it
+- offsets 12..15 are bouncy inputs for the debounce benchmark (and bursty ones for the edge_reader benchmark)
+- offsets 16..63 are the 48 outputs the frame table benchmark plays on, 16..21 also the shift registers' lines
+*/
+
+constexpr unsigned int NUM_OUTPUTS{8};
+constexpr unsigned int TRIGGER_LINE{8};
+constexpr unsigned int ECHO_LINE{9};
+constexpr unsigned int INPUT_LINE{10};
+constexpr unsigned int REACTION_LINE{11};
+constexpr unsigned int FIRST_DEBOUNCE_LINE{12};
+constexpr unsigned int NUM_DEBOUNCE_LINES{4};
+constexpr unsigned int FIRST_FRAME_LINE{16};
+constexpr unsigned int NUM_FRAME_LINES{48};
+
+// One "frame" means all NUM_OUTPUTS lines get a new value. set_value() needs one call per line, set_values() one per frame.
+void bench_writes(backend::chip& chip) {
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-writes");
+    for (unsigned int offset = 0; offset < NUM_OUTPUTS; offset++) {
+        builder.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    }
+    std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+    const std::uint64_t all_lines = (1ull << NUM_OUTPUTS) - 1;
+    const std::uint64_t run_ns = 500000000;
+
+    std::uint64_t frames = 0;
+    std::uint64_t start = backend::monotonic_ns();
+    while (backend::monotonic_ns() - start < run_ns) {
+        backend::value level = frames & 1 ? backend::value::ACTIVE : backend::value::INACTIVE;
+        for (unsigned int offset = 0; offset < NUM_OUTPUTS; offset++) {
+            outputs->set_value(offset, level);
+        }
+        frames++;
+    }
+    double elapsed = bench::seconds_since(start);
+    bench::report("set_value ops", static_cast<double>(frames * NUM_OUTPUTS) / elapsed, "ops/s");
+    bench::report("set_value frames (8 lines)", static_cast<double>(frames) / elapsed, "frames/s");
+
+    frames = 0;
+    start = backend::monotonic_ns();
+    while (backend::monotonic_ns() - start < run_ns) {
+        outputs->set_values(all_lines, frames & 1 ? all_lines : 0);
+        frames++;
+    }
+    elapsed = bench::seconds_since(start);
+    bench::report("set_values ops", static_cast<double>(frames) / elapsed, "ops/s");
+    bench::report("set_values frames (8 lines)", static_cast<double>(frames) / elapsed, "frames/s");
+
+    outputs->release();
+}
+
+// A wave across 48 outputs with no hold time, played once with batched frames and once line by line.
+void bench_frames(backend::chip& chip) {
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-frames");
+    std::vector<unsigned int> channels;
+    for (unsigned int offset = FIRST_FRAME_LINE; offset < FIRST_FRAME_LINE + NUM_FRAME_LINES; offset++) {
+        builder.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        channels.push_back(offset);
+    }
+    std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+    frames::frame_table wave{NUM_FRAME_LINES, {}};
+    std::uint64_t lit = 0;
+    for (unsigned int channel = 0; channel < NUM_FRAME_LINES; channel++) {
+        wave.frames.push_back(frames::frame{lit |= 1ull << channel, std::chrono::microseconds(0)});
+    }
+    for (unsigned int channel = 0; channel < NUM_FRAME_LINES; channel++) {
+        wave.frames.push_back(frames::frame{lit &= ~(1ull << channel), std::chrono::microseconds(0)});
+    }
+
+    for (bool batched : {true, false}) {
+        frames::frame_player player(*outputs, channels);
+        player.set_batched(batched);
+
+        std::uint64_t start = backend::monotonic_ns();
+        player.play(wave, 1000);
+        double elapsed = bench::seconds_since(start);
+
+        const frames::frame_stats& stats = player.stats();
+        std::string name = batched ? "frames batched (48 lines)" : "frames line by line (48 lines)";
+        bench::report(name, static_cast<double>(stats.frames_played) / elapsed, "frames/s");
+        bench::report(name + " writes/frame", static_cast<double>(stats.writes) / static_cast<double>(stats.frames_played), "writes");
+        bench::report(name + " avg skew", static_cast<double>(stats.total_skew_ns) / static_cast<double>(stats.frames_played), "ns");
+        bench::report(name + " max skew", static_cast<double>(stats.max_skew_ns), "ns");
+    }
+
+    outputs->release();
+}
+
+// 256 outputs behind 74HC595s, as one chain on one data line and as 4 chains on 4 data lines sharing the clock and
+// latch (16..19 data, 20 clock, 21 latch). 200 random frames played 5 times as fast as the lines go.
+// On the sim chip pretend registers then check that every frame of another 200 lands on the outputs.
+void bench_shift_registers(backend::chip& chip) {
+    const std::size_t num_outputs = 256;
+    std::mt19937 random(19);
+
+    shiftreg::animation noise;
+    for (int i = 0; i < 200; i++) {
+        shiftreg::framebuffer image(num_outputs);
+        for (std::size_t output = 0; output < num_outputs; output++) {
+            image.set(output, random() & 1);
+        }
+        noise.push_back(shiftreg::panel_frame{image, std::chrono::microseconds(0)});
+    }
+
+    for (unsigned int num_chains : {1u, 4u}) {
+        shiftreg::wiring pins;
+        for (unsigned int chain = 0; chain < num_chains; chain++) {
+            pins.data.push_back(FIRST_FRAME_LINE + chain);
+        }
+        pins.clock = FIRST_FRAME_LINE + 4;
+        pins.latch = FIRST_FRAME_LINE + 5;
+
+        backend::request_builder builder = chip.prepare_request();
+        builder.set_consumer("bench-shift");
+        for (unsigned int offset : pins.data) {
+            builder.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        }
+        builder.add_line_settings(pins.clock, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        builder.add_line_settings(pins.latch, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+        shiftreg::shift_register_output registers(*outputs, pins, num_outputs);
+        registers.play(noise, 5);
+
+        const shiftreg::shift_stats& stats = registers.stats();
+        std::string name = "shift 256 outputs x" + std::to_string(num_chains) + (num_chains == 1 ? " chain" : " chains");
+        bench::report(name, registers.bit_rate(), "bits/s");
+        bench::report(name + " frames", registers.frames_per_second(), "frames/s");
+        bench::report(name + " writes/frame", static_cast<double>(stats.writes) / static_cast<double>(stats.frames), "writes");
+
+        if (auto* sim = dynamic_cast<backend::sim_chip*>(&chip)) {
+            backend::sim_shift_register pretend(*sim, pins, num_outputs);
+            int matched = 0;
+            for (int i = 0; i < 200; i++) {
+                shiftreg::framebuffer image(num_outputs);
+                for (std::size_t output = 0; output < num_outputs; output++) {
+                    image.set(output, random() & 1);
+                }
+                registers.show(image);
+                matched += pretend.outputs() == image;
+            }
+            bench::report(name + " frames latched right", matched, "of 200");
+        }
+
+        outputs->release();
+    }
+}
+
+// 500 steps of 1ms: relative usleep() vs absolute deadlines vs absolute deadlines with a 100us spin window.
+// "drift" is how far past 500ms the whole run ended (the timer's last deadline is exactly start + 500ms), lateness is per step.
+void bench_timing() {
+    const int steps = 500;
+    const std::uint64_t expected_ns = steps * 1000000ull;
+
+    std::uint64_t start = backend::monotonic_ns();
+    for (int i = 0; i < steps; i++) {
+        usleep(1000);
+    }
+    bench::report("usleep(1ms) x500 drift", static_cast<double>(backend::monotonic_ns() - start - expected_ns) / 1000.0, "us");
+
+    for (int spin_us : {0, 100}) {
+        timing::deadline_timer timer{std::chrono::microseconds(spin_us)};
+        for (int i = 0; i < steps; i++) {
+            timer.wait(std::chrono::milliseconds(1));
+        }
+        std::string name = spin_us ? "deadline 1ms x500 (100us spin)" : "deadline 1ms x500";
+        bench::report(name + " drift", static_cast<double>(backend::monotonic_ns() - timer.deadline()) / 1000.0, "us");
+        bench::report(name + " lateness p99", static_cast<double>(timer.lateness().percentile(99)) / 1000.0, "us");
+        bench::report(name + " lateness max", static_cast<double>(timer.lateness().max()) / 1000.0, "us");
+    }
+}
+
+// 1kHz software PWM on more and more channels (duty cycles spread from 10% to 90%) for half a second each.
+// When the thread can't keep up the achieved frequency drops and the duty error grows.
+void bench_pwm(backend::chip& chip) {
+    for (unsigned int num_channels : {1u, 8u, 32u, 60u}) {
+        backend::request_builder builder = chip.prepare_request();
+        builder.set_consumer("bench-pwm");
+        for (unsigned int offset = 0; offset < num_channels; offset++) {
+            builder.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        }
+        std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+        pwm::soft_pwm engine(*outputs);
+        for (unsigned int offset = 0; offset < num_channels; offset++) {
+            engine.add_channel(offset, 1000.0, 0.1 + 0.8 * offset / num_channels);
+        }
+        engine.start();
+        timing::deadline_timer().wait(std::chrono::milliseconds(500));
+        engine.stop();
+
+        double worst_hz = 1e9;
+        double total_duty_error = 0;
+        for (const auto& channel : engine.report()) {
+            worst_hz = std::min(worst_hz, channel.achieved_hz);
+            total_duty_error += std::fabs(channel.duty_error);
+        }
+
+        std::string name = "pwm 1kHz x" + std::to_string(num_channels);
+        bench::report(name + " slowest channel", worst_hz, "Hz");
+        bench::report(name + " mean |duty error|", 100.0 * total_duty_error / num_channels, "%");
+        bench::report(name + " writes", static_cast<double>(engine.batches()) * 2.0, "writes/s");
+        bench::report(name + " lateness p99", static_cast<double>(engine.lateness().percentile(99)) / 1000.0, "us");
+
+        outputs->release();
+    }
+
+    // pulses and gaps shorter than the merge window (2us): the line has to stay off and on, not the other way round.
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-pwm");
+    builder.add_line_settings(0, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    builder.add_line_settings(1, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+    pwm::soft_pwm engine(*outputs);
+    engine.add_channel(0, 200.0, 0.000001);
+    engine.add_channel(1, 200.0, 0.999999);
+    engine.start();
+    timing::deadline_timer().wait(std::chrono::milliseconds(200));
+    engine.stop();
+
+    std::vector<pwm::channel_report> reports = engine.report();
+    bench::report("pwm 200Hz 5ns pulse achieved duty", 100.0 * reports[0].achieved_duty, "%");
+    bench::report("pwm 200Hz 5ns gap achieved duty", 100.0 * reports[1].achieved_duty, "%");
+    outputs->release();
+}
+
+// Fill the kernel queue with edges, then time how fast read_edge_events() drains it 64 events at a time.
+// Only the reads are timed, making the edges (sysfs writes on gpio-sim) isn't what we're measuring.
+void bench_edge_throughput(backend::chip& chip) {
+    backend::sim_controls& sim = bench::controls(chip);
+
+    const std::size_t queue_size = 1024;
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-events");
+    builder.set_event_buffer_size(queue_size);
+    builder.add_line_settings(INPUT_LINE, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+    std::unique_ptr<backend::line_request> input = builder.do_request();
+
+    backend::edge_event_buffer buffer(64);
+    std::uint64_t received = 0;
+    std::uint64_t read_ns = 0;
+    bool level = false;
+
+    for (int round = 0; round < 200; round++) {
+        for (std::size_t i = 0; i < queue_size; i++) {
+            level = !level;
+            sim.set_input(INPUT_LINE, level);
+        }
+
+        // gpio-sim raises its edges from irq work, so give them a moment to land before the clock starts.
+        input->wait_edge_events(std::chrono::seconds(1));
+
+        std::uint64_t start = backend::monotonic_ns();
+        do {
+            received += input->read_edge_events(buffer);
+        } while (input->wait_edge_events(std::chrono::nanoseconds(0)));
+        read_ns += backend::monotonic_ns() - start;
+    }
+
+    bench::report("read_edge_events throughput", static_cast<double>(received) / (static_cast<double>(read_ns) / 1e9), "events/s");
+    bench::report("read_edge_events received", static_cast<double>(received), "events");
+
+    input->release();
+}
+
+// Edge timestamp (taken by the kernel/simulator) to the moment set_value() returns for the output it triggers.
+void bench_reaction_latency(backend::chip& chip) {
+    backend::sim_controls& sim = bench::controls(chip);
+
+    backend::request_builder inputs_builder = chip.prepare_request();
+    inputs_builder.set_consumer("bench-reaction-in");
+    inputs_builder.add_line_settings(INPUT_LINE, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+    std::unique_ptr<backend::line_request> input = inputs_builder.do_request();
+
+    backend::request_builder outputs_builder = chip.prepare_request();
+    outputs_builder.set_consumer("bench-reaction-out");
+    outputs_builder.add_line_settings(REACTION_LINE, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    std::unique_ptr<backend::line_request> output = outputs_builder.do_request();
+
+    // an edge every 200us, slow enough that each one is handled on its own.
+    const std::size_t total_edges = 2000;
+    sim.set_input(INPUT_LINE, false);
+    std::thread producer([&]() {
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        for (std::size_t i = 0; i < total_edges; i++) {
+            deadline.tv_nsec += 200000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+            sim.set_input(INPUT_LINE, !(i & 1));
+        }
+    });
+
+    backend::edge_event_buffer buffer(16);
+    std::vector<std::uint64_t> latencies;
+    latencies.reserve(total_edges);
+    while (latencies.size() < total_edges && input->wait_edge_events(std::chrono::seconds(1))) {
+        input->read_edge_events(buffer);
+        for (const auto& event : buffer) {
+            bool pressed = event.type() == backend::edge_event::event_type::RISING_EDGE;
+            output->set_value(REACTION_LINE, pressed ? backend::value::ACTIVE : backend::value::INACTIVE);
+            latencies.push_back(backend::monotonic_ns() - event.timestamp_ns());
+        }
+    }
+    producer.join();
+
+    bench::report("edge-to-output latency p50", static_cast<double>(bench::percentile(latencies, 50)) / 1000.0, "us");
+    bench::report("edge-to-output latency p99", static_cast<double>(bench::percentile(latencies, 99)) / 1000.0, "us");
+    bench::report("edge-to-output latency max", static_cast<double>(bench::percentile(latencies, 100)) / 1000.0, "us");
+
+    output->release();
+    input->release();
+}
+
+// The same reaction measured through the monitor's old loop (wait 100ms for events, then always usleep 100ms)
+// and through the epoll reactor it uses now. Edges come every 37ms, which doesn't line up with the old loop's period.
+void bench_monitor_loops(backend::chip& chip) {
+    backend::sim_controls& sim = bench::controls(chip);
+
+    backend::request_builder inputs_builder = chip.prepare_request();
+    inputs_builder.set_consumer("bench-loop-in");
+    inputs_builder.add_line_settings(INPUT_LINE, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+    std::unique_ptr<backend::line_request> input = inputs_builder.do_request();
+
+    backend::request_builder outputs_builder = chip.prepare_request();
+    outputs_builder.set_consumer("bench-loop-out");
+    outputs_builder.add_line_settings(REACTION_LINE, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    std::unique_ptr<backend::line_request> output = outputs_builder.do_request();
+
+    const std::size_t total_edges = 30;
+    backend::edge_event_buffer buffer(64);
+    std::vector<std::uint64_t> latencies;
+
+    auto react = [&]() {
+        input->read_edge_events(buffer);
+        for (const auto& event : buffer) {
+            bool pressed = event.type() == backend::edge_event::event_type::RISING_EDGE;
+            output->set_value(REACTION_LINE, pressed ? backend::value::ACTIVE : backend::value::INACTIVE);
+            latencies.push_back(backend::monotonic_ns() - event.timestamp_ns());
+        }
+    };
+    auto play_edges = [&]() {
+        sim.set_input(INPUT_LINE, false);
+        return std::thread([&]() {
+            timing::deadline_timer edges;
+            for (std::size_t i = 0; i < total_edges; i++) {
+                edges.wait(std::chrono::milliseconds(37));
+                sim.set_input(INPUT_LINE, !(i & 1));
+            }
+        });
+    };
+
+    std::thread producer = play_edges();
+    while (latencies.size() < total_edges) {
+        if (input->wait_edge_events(std::chrono::milliseconds(100))) {
+            react();
+        }
+        usleep(100000);
+    }
+    producer.join();
+    bench::report("old monitor loop latency p50", static_cast<double>(bench::percentile(latencies, 50)) / 1000.0, "us");
+    bench::report("old monitor loop latency max", static_cast<double>(bench::percentile(latencies, 100)) / 1000.0, "us");
+
+    latencies.clear();
+    events::reactor loop;
+    loop.add(input->fd(), [&](std::uint32_t) {
+        react();
+        if (latencies.size() >= total_edges) {
+            loop.stop();
+        }
+    });
+    producer = play_edges();
+    loop.run();
+    producer.join();
+    bench::report("reactor loop latency p50", static_cast<double>(bench::percentile(latencies, 50)) / 1000.0, "us");
+    bench::report("reactor loop latency max", static_cast<double>(bench::percentile(latencies, 100)) / 1000.0, "us");
+
+    output->release();
+    input->release();
+}
+
+// Handing edge events from a capture thread to a handler thread through the spsc ring: how many events per second
+// get across with a busy consumer, and how long one event takes to reach a consumer that sleeps on the eventfd.
+void bench_event_ring() {
+    using ring_type = rings::spsc_ring<backend::edge_event, 1024>;
+
+    const std::uint64_t transfers = 2000000;
+    ring_type busy_ring(rings::backpressure::BLOCK);
+    std::uint64_t start = backend::monotonic_ns();
+    std::thread consumer([&]() {
+        backend::edge_event event;
+        for (std::uint64_t received = 0; received < transfers;) {
+            if (busy_ring.pop(event)) {
+                received++;
+            } else {
+                std::this_thread::yield(); // matters when both threads share one core
+            }
+        }
+    });
+    for (std::uint64_t i = 0; i < transfers; i++) {
+        busy_ring.push(backend::edge_event(backend::edge_event::event_type::RISING_EDGE, INPUT_LINE, i, i + 1, i + 1));
+    }
+    consumer.join();
+    bench::report("spsc ring transfers", static_cast<double>(transfers) / bench::seconds_since(start) / 1e6, "M events/s");
+    bench::report("spsc ring peak fill", static_cast<double>(busy_ring.peak_fill()), "events");
+
+    const std::size_t handoffs = 2000;
+    ring_type sleepy_ring(rings::backpressure::BLOCK);
+    std::vector<std::uint64_t> latencies;
+    latencies.reserve(handoffs);
+    consumer = std::thread([&]() {
+        backend::edge_event event;
+        while (latencies.size() < handoffs) {
+            while (sleepy_ring.pop(event)) {
+                latencies.push_back(backend::monotonic_ns() - event.timestamp_ns());
+            }
+            if (latencies.size() < handoffs) {
+                sleepy_ring.wait();
+            }
+        }
+    });
+    timing::deadline_timer pace;
+    for (std::size_t i = 0; i < handoffs; i++) {
+        pace.wait(std::chrono::microseconds(200));
+        sleepy_ring.push_notify(backend::edge_event(backend::edge_event::event_type::RISING_EDGE, INPUT_LINE, backend::monotonic_ns(), i + 1, i + 1));
+    }
+    consumer.join();
+    bench::report("spsc ring wake-up handoff p50", static_cast<double>(bench::percentile(latencies, 50)) / 1000.0, "us");
+    bench::report("spsc ring wake-up handoff p99", static_cast<double>(bench::percentile(latencies, 99)) / 1000.0, "us");
+}
+
+// Four buttons pressed 500 times each, every press and release bounces a few times within 2ms. Every 10th press is a
+// quick tap that's released inside the debounce period, so the release has to come out as a correction.
+// Every press should come out as exactly one falling and one rising edge.
+void bench_debounce(backend::chip& chip) {
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-debounce");
+    for (unsigned int i = 0; i < NUM_DEBOUNCE_LINES; i++) {
+        builder.add_line_settings(FIRST_DEBOUNCE_LINE + i, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_UP));
+    }
+    std::unique_ptr<backend::line_request> buttons = builder.do_request();
+    debounce::debouncer filter(*buttons, std::chrono::milliseconds(10));
+
+    const std::size_t presses = 500;
+    const std::uint64_t ms = 1000000;
+    std::vector<backend::edge_event> raw;
+    for (unsigned int line = FIRST_DEBOUNCE_LINE; line < FIRST_DEBOUNCE_LINE + NUM_DEBOUNCE_LINES; line++) {
+        std::uint64_t ts = 1000 * ms;
+        std::uint64_t seqno = 0;
+        auto bounce = [&](bool ends_high, int bounces) {
+            for (int b = bounces; b >= 0; b--) {
+                bool high = (b % 2 == 0) == ends_high;
+                raw.emplace_back(high ? backend::edge_event::event_type::RISING_EDGE : backend::edge_event::event_type::FALLING_EDGE, line, ts, 0, ++seqno);
+                ts += 400000; // 0.4ms between bounces
+            }
+        };
+        for (std::size_t press = 0; press < presses; press++) {
+            bounce(false, 4);
+            ts += press % 10 == 9 ? 1 * ms : 50 * ms; // quick tap or a normal press
+            bounce(true, 2);
+            ts += 100 * ms;
+        }
+    }
+
+    std::size_t clean = 0;
+    auto count_clean = [&clean](const backend::edge_event&) { clean++; };
+    std::uint64_t start = backend::monotonic_ns();
+    for (const auto& event : raw) {
+        filter.feed(event, count_clean);
+    }
+    filter.expire_until(UINT64_MAX, count_clean);
+    double elapsed_ns = static_cast<double>(backend::monotonic_ns() - start);
+
+    std::uint64_t corrected = 0;
+    for (const auto& line : filter.counts()) {
+        corrected += line.corrected;
+    }
+    bench::report("debounce raw edges", static_cast<double>(raw.size()), "events");
+    bench::report("debounce clean edges (expect " + std::to_string(2 * presses * NUM_DEBOUNCE_LINES) + ")", static_cast<double>(clean), "events");
+    bench::report("debounce suppressed", static_cast<double>(filter.suppressed()), "events");
+    bench::report("debounce corrected", static_cast<double>(corrected), "events");
+    bench::report("debounce cost", elapsed_ns / static_cast<double>(raw.size()), "ns/event");
+
+    buttons->release();
+}
+
+// The HC-SR04 ranging state machine against a pretend sensor with an object 100cm away, for 2 seconds.
+// Needs the in-process sim chip, the pretend sensor listens to its output writes.
+// Bursts of edges spread over 4 lines into a small kernel queue: the ones that don't fit are dropped, and edge_reader
+// should count exactly those from the seqno gaps while growing its buffer to the bursts.
+void bench_edge_reader(backend::chip& chip) {
+    backend::sim_controls& sim = bench::controls(chip);
+
+    const std::size_t queue_size = 64;
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-reader");
+    builder.set_event_buffer_size(queue_size);
+    for (unsigned int i = 0; i < NUM_DEBOUNCE_LINES; i++) {
+        builder.add_line_settings(FIRST_DEBOUNCE_LINE + i, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+    }
+    std::unique_ptr<backend::line_request> inputs = builder.do_request();
+    events::edge_reader reader(*inputs);
+
+    const std::size_t bursts[] = {8, 40, 100, 300};
+    std::vector<bool> levels(NUM_DEBOUNCE_LINES, false);
+    std::uint64_t expected_drops = 0;
+    std::uint64_t received = 0;
+    std::uint64_t read_ns = 0;
+    for (int round = 0; round < 100; round++) {
+        std::size_t burst = bursts[round % 4];
+        for (std::size_t i = 0; i < burst; i++) {
+            unsigned int line = static_cast<unsigned int>(i % NUM_DEBOUNCE_LINES);
+            levels[line] = !levels[line];
+            sim.set_input(FIRST_DEBOUNCE_LINE + line, levels[line]);
+        }
+        expected_drops += burst > queue_size ? burst - queue_size : 0;
+
+        inputs->wait_edge_events(std::chrono::seconds(1));
+        std::uint64_t start = backend::monotonic_ns();
+        received += reader.read();
+        read_ns += backend::monotonic_ns() - start;
+    }
+
+    bench::report("edge_reader throughput", static_cast<double>(received) / (static_cast<double>(read_ns) / 1e9), "events/s");
+    bench::report("edge_reader drops expected", static_cast<double>(expected_drops), "events");
+    bench::report("edge_reader drops detected", static_cast<double>(reader.dropped()), "events");
+    bench::report("edge_reader largest burst", static_cast<double>(reader.largest_burst()), "events");
+    bench::report("edge_reader buffer grew to", static_cast<double>(reader.capacity()), "events");
+    bench::report("edge_reader recommended kernel buffer", static_cast<double>(reader.recommended_kernel_buffer()), "events");
+
+    inputs->release();
+}
+
+/*
+Sustained edge rate through the pulse meter: square waves on the 4 lines 12..15 for a second, at 10, 25 and 50kHz
+each (two edges a period). On the sim chip the waves are queued with exact timestamps (play_square_wave), so the
+measured frequency and duty cycle have to come out exactly right. On gpio-sim there's no such thing, a thread
+toggles the 4 lines through sysfs as fast as it can and we see how many of those edges come through.
+*/
+void bench_pulses(backend::chip& chip) {
+    backend::sim_controls& controls = bench::controls(chip);
+    auto* sim = dynamic_cast<backend::sim_chip*>(&chip);
+
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-pulses");
+    builder.set_event_buffer_size(1024);
+    for (unsigned int offset = FIRST_DEBOUNCE_LINE; offset < FIRST_DEBOUNCE_LINE + NUM_DEBOUNCE_LINES; offset++) {
+        builder.add_line_settings(offset, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+    }
+    std::unique_ptr<backend::line_request> inputs = builder.do_request();
+
+    for (double frequency_hz : {10000.0, 25000.0, 50000.0}) {
+        pulses::pulse_meter meter(*inputs);
+        std::atomic<bool> toggling{true};
+        std::thread toggler;
+
+        if (sim) {
+            for (unsigned int line = 0; line < NUM_DEBOUNCE_LINES; line++) {
+                sim->play_square_wave(FIRST_DEBOUNCE_LINE + line, frequency_hz, 0.2 * (line + 1), std::chrono::seconds(1));
+            }
+        } else {
+            toggler = std::thread([&]() {
+                for (bool level = true; toggling; level = !level) {
+                    for (unsigned int line = 0; line < NUM_DEBOUNCE_LINES; line++) {
+                        controls.set_input(FIRST_DEBOUNCE_LINE + line, level);
+                    }
+                }
+            });
+        }
+
+        std::uint64_t start = backend::monotonic_ns();
+        while (backend::monotonic_ns() - start < 1000000000ull) {
+            if (inputs->wait_edge_events(std::chrono::milliseconds(10))) {
+                meter.drain();
+            }
+        }
+        if (sim) {
+            sim->wait_patterns();
+        } else {
+            toggling = false;
+            toggler.join();
+        }
+        while (inputs->wait_edge_events(std::chrono::milliseconds(20))) {
+            meter.drain();
+        }
+        double elapsed = bench::seconds_since(start);
+
+        std::uint64_t missed = 0;
+        double worst_frequency_error = 0;
+        double worst_duty_error = 0;
+        std::vector<pulses::line_report> reports = meter.take_reports();
+        for (std::size_t line = 0; line < reports.size(); line++) {
+            missed += reports[line].missed;
+            worst_frequency_error = std::max(worst_frequency_error, std::fabs(reports[line].frequency_hz() / frequency_hz - 1.0));
+            worst_duty_error = std::max(worst_duty_error, std::fabs(reports[line].duty_cycle() - 0.2 * static_cast<double>(line + 1)));
+        }
+
+        std::string name = sim ? "pulses 4 lines x " + std::to_string(static_cast<int>(frequency_hz / 1000)) + "kHz" : "pulses 4 lines, sysfs toggling";
+        bench::report(name + " events", static_cast<double>(meter.events()) / elapsed, "events/s");
+        bench::report(name + " missed", static_cast<double>(missed), "events");
+        bench::report(name + " largest burst", static_cast<double>(meter.largest_burst()), "events");
+        if (sim) {
+            bench::report(name + " worst frequency error", worst_frequency_error * 1e6, "ppm");
+            bench::report(name + " worst duty error", worst_duty_error * 100.0, "%");
+        } else {
+            // there's no telling what rate sysfs manages, so gpio-sim only runs once.
+            break;
+        }
+    }
+
+    inputs->release();
+}
+
+/*
+8 quadrature encoders on lines 16..31 (A, B, A, B, ...). First the decoding on its own: 2 million made up edges fed
+straight to the decoder, to see how many edges a second one thread can decode at most. Then through the sim chip:
+the 8 encoders turning for a second at 5000, 25000 and 50000 counts a second each (odd ones backwards) while another
+thread keeps reading their snapshots. Edges per second, invalid transitions, missed edges, how far the final
+positions are off and the worst velocity error. Only on the "sim" chip.
+*/
+void bench_quadrature(backend::chip& chip) {
+    auto* sim = dynamic_cast<backend::sim_chip*>(&chip);
+    if (!sim) {
+        std::cout << "quadrature: skipped, needs the \"sim\" chip" << '\n';
+        return;
+    }
+    const unsigned int num_encoders = 8;
+    std::vector<quadrature::pins> pairs;
+    for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+        pairs.push_back(quadrature::pins{FIRST_FRAME_LINE + 2 * encoder, FIRST_FRAME_LINE + 2 * encoder + 1});
+    }
+    std::unique_ptr<backend::line_request> lines = quadrature::request_encoders(chip, pairs, "bench-quadrature");
+
+    {
+        quadrature::decoder decoder(*lines);
+        for (const auto& pair : pairs) {
+            decoder.add_encoder(pair.a, pair.b);
+        }
+        // the lines are pulled up (11), forwards from there is A falling, B falling, A rising, B rising.
+        const std::size_t num_edges = 2000000;
+        std::vector<backend::edge_event> edges;
+        edges.reserve(num_edges);
+        for (std::size_t i = 0; i < num_edges; i++) {
+            std::size_t encoder = i % num_encoders;
+            std::size_t step = i / num_encoders;
+            unsigned int offset = step % 2 ? pairs[encoder].b : pairs[encoder].a;
+            auto type = step % 4 < 2 ? backend::edge_event::event_type::FALLING_EDGE : backend::edge_event::event_type::RISING_EDGE;
+            edges.emplace_back(type, offset, 1000 * i, i + 1, step / 2 + 1);
+        }
+
+        std::uint64_t start = backend::monotonic_ns();
+        for (std::size_t i = 0; i < num_edges; i++) {
+            decoder.add(edges[i]);
+            if (i % 1024 == 1023) {
+                decoder.publish();
+            }
+        }
+        decoder.publish();
+        double elapsed = bench::seconds_since(start);
+
+        std::uint64_t invalid = 0;
+        for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+            invalid += decoder.read(encoder).invalid;
+        }
+        bench::report("quadrature decode only", static_cast<double>(num_edges) / elapsed / 1e6, "M edges/s");
+        bench::report("quadrature decode only per edge", elapsed * 1e9 / static_cast<double>(num_edges), "ns");
+        bench::report("quadrature decode only invalid", static_cast<double>(invalid), "transitions");
+    }
+
+    for (double counts_per_second : {5000.0, 25000.0, 50000.0}) {
+        quadrature::decoder decoder(*lines);
+        for (const auto& pair : pairs) {
+            decoder.add_encoder(pair.a, pair.b);
+        }
+        // the lines keep their levels from the last round, the decoder starts at 0 wherever they are.
+        const std::chrono::seconds length(1);
+        for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+            sim->play_quadrature(pairs[encoder].a, pairs[encoder].b, encoder % 2 ? -counts_per_second : counts_per_second, length);
+        }
+
+        std::atomic<bool> reading{true};
+        std::uint64_t snapshot_reads = 0;
+        std::thread reader([&]() {
+            while (reading) {
+                for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+                    decoder.read(encoder);
+                    snapshot_reads++;
+                }
+                std::this_thread::yield(); // matters when both threads share one core
+            }
+        });
+
+        std::uint64_t start = backend::monotonic_ns();
+        double worst_velocity_error = 0;
+        bool velocity_checked = false;
+        while (backend::monotonic_ns() - start < 1000000000ull) {
+            if (lines->wait_edge_events(std::chrono::milliseconds(10))) {
+                decoder.drain();
+            }
+            if (!velocity_checked && backend::monotonic_ns() - start > 900000000ull) {
+                for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+                    double velocity = std::fabs(decoder.read(encoder).velocity);
+                    worst_velocity_error = std::max(worst_velocity_error, std::fabs(velocity / counts_per_second - 1.0));
+                }
+                velocity_checked = true;
+            }
+        }
+        sim->wait_patterns();
+        while (lines->wait_edge_events(std::chrono::milliseconds(20))) {
+            decoder.drain();
+        }
+        double elapsed = bench::seconds_since(start);
+        reading = false;
+        reader.join();
+
+        // play_quadrature plays every count whose time is within the length.
+        const double period_ns = 1e9 / counts_per_second;
+        std::int64_t expected = 0;
+        while (static_cast<std::uint64_t>(static_cast<double>(expected + 1) * period_ns) <= static_cast<std::uint64_t>(std::chrono::nanoseconds(length).count())) {
+            expected++;
+        }
+
+        std::uint64_t invalid = 0;
+        std::uint64_t missed = 0;
+        std::int64_t worst_position_error = 0;
+        for (unsigned int encoder = 0; encoder < num_encoders; encoder++) {
+            quadrature::snapshot last = decoder.read(encoder);
+            invalid += last.invalid;
+            missed += last.missed;
+            std::int64_t error = last.position - (encoder % 2 ? -expected : expected);
+            worst_position_error = std::max(worst_position_error, error < 0 ? -error : error);
+        }
+
+        std::string name = "quadrature 8 x " + std::to_string(static_cast<int>(counts_per_second / 1000)) + "k counts/s";
+        bench::report(name + " edges", static_cast<double>(decoder.events()) / elapsed, "edges/s");
+        bench::report(name + " invalid", static_cast<double>(invalid), "transitions");
+        bench::report(name + " missed", static_cast<double>(missed), "edges");
+        bench::report(name + " worst position error", static_cast<double>(worst_position_error), "counts");
+        bench::report(name + " worst velocity error", worst_velocity_error * 100.0, "%");
+        bench::report(name + " snapshot reads", static_cast<double>(snapshot_reads) / elapsed, "reads/s");
+    }
+
+    lines->release();
+}
+
+void bench_ranging(backend::chip& chip) {
+    auto* sim = dynamic_cast<backend::sim_chip*>(&chip);
+    if (!sim) {
+        std::cout << "ranging: skipped, needs the \"sim\" chip" << '\n';
+        return;
+    }
+    backend::sim_ultrasonic pretend(*sim);
+    pretend.add_sensor(TRIGGER_LINE, ECHO_LINE, 100.0);
+
+    backend::request_builder trigger_builder = chip.prepare_request();
+    trigger_builder.set_consumer("bench-trigger");
+    trigger_builder.add_line_settings(TRIGGER_LINE, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    std::unique_ptr<backend::line_request> trigger = trigger_builder.do_request();
+
+    backend::request_builder echo_builder = chip.prepare_request();
+    echo_builder.set_consumer("bench-echo");
+    echo_builder.add_line_settings(ECHO_LINE, backend::line_settings().set_edge_detection(backend::edge::BOTH));
+    std::unique_ptr<backend::line_request> echo = echo_builder.do_request();
+
+    ranging::hcsr04 sensor(*trigger, TRIGGER_LINE, *echo, ECHO_LINE);
+    double worst_error = 0;
+    auto check = [&worst_error](const ranging::measurement& result) {
+        if (!result.timed_out) {
+            worst_error = std::max(worst_error, std::fabs(result.distance_cm - 100.0));
+        }
+    };
+
+    events::reactor loop;
+    loop.add(sensor.echo_fd(), [&](std::uint32_t) { sensor.on_echo(check); });
+    loop.add(sensor.timer_fd(), [&](std::uint32_t) { sensor.on_timer(check); });
+    std::uint64_t start = backend::monotonic_ns();
+    sensor.start();
+    while (bench::seconds_since(start) < 2.0) {
+        loop.run_once(100);
+    }
+    double elapsed = bench::seconds_since(start);
+
+    bench::report("ranging rate (target 40)", static_cast<double>(sensor.completed()) / elapsed, "measurements/s");
+    bench::report("ranging timed out", static_cast<double>(sensor.timed_out()), "measurements");
+    bench::report("ranging worst distance error", worst_error * 10.0, "mm");
+
+    echo->release();
+    trigger->release();
+}
+
+// Six pretend sensors (20cm to 270cm away) on one trigger request and one echo request, scheduled as one group that
+// takes turns, three groups of two and six independent groups. Then one group where a sensor sees nothing (its echo
+// lasts 38ms) and the group only waits 26ms for it before moving on, so the next sensor fires into a live echo.
+void bench_sensor_array(backend::chip& chip) {
+    auto* sim = dynamic_cast<backend::sim_chip*>(&chip);
+    if (!sim) {
+        std::cout << "sensor array: skipped, needs the \"sim\" chip" << '\n';
+        return;
+    }
+    const unsigned int num_sensors{6};
+    auto trigger_of = [](unsigned int i) { return FIRST_FRAME_LINE + 2 * i; };
+    auto echo_of = [](unsigned int i) { return FIRST_FRAME_LINE + 2 * i + 1; };
+
+    auto run = [&](const std::string& name, unsigned int num_groups, ranging::options settings, bool one_blind) {
+        backend::sim_ultrasonic pretend(*sim);
+        backend::request_builder trigger_builder = chip.prepare_request();
+        backend::request_builder echo_builder = chip.prepare_request();
+        trigger_builder.set_consumer("bench-array-triggers");
+        echo_builder.set_consumer("bench-array-echoes");
+        for (unsigned int i = 0; i < num_sensors; i++) {
+            pretend.add_sensor(trigger_of(i), echo_of(i), one_blind && i == 0 ? -1.0 : 20.0 + 50.0 * i);
+            trigger_builder.add_line_settings(trigger_of(i), backend::line_settings().set_direction(backend::direction::OUTPUT));
+            echo_builder.add_line_settings(echo_of(i), backend::line_settings().set_edge_detection(backend::edge::BOTH));
+        }
+        std::unique_ptr<backend::line_request> triggers = trigger_builder.do_request();
+        std::unique_ptr<backend::line_request> echoes = echo_builder.do_request();
+
+        ranging::sensor_array array(*triggers, *echoes, settings);
+        for (unsigned int i = 0; i < num_sensors; i++) {
+            array.add_sensor(trigger_of(i), echo_of(i), i % num_groups);
+        }
+
+        events::reactor loop;
+        auto ignore = [](const ranging::measurement&) {};
+        loop.add(array.echo_fd(), [&](std::uint32_t) { array.on_echo(ignore); });
+        loop.add(array.timer_fd(), [&](std::uint32_t) { array.on_timer(ignore); });
+        std::uint64_t start = backend::monotonic_ns();
+        array.start();
+        while (bench::seconds_since(start) < 1.5) {
+            loop.run_once(100);
+        }
+        double elapsed = bench::seconds_since(start);
+
+        double slowest = 1e9;
+        for (const auto& sensor : array.report()) {
+            slowest = std::min(slowest, static_cast<double>(sensor.completed) / elapsed);
+        }
+        bench::report("array " + name + " total", static_cast<double>(array.completed()) / elapsed, "measurements/s");
+        bench::report("array " + name + " slowest sensor", slowest, "measurements/s");
+        bench::report("array " + name + " collision drops", static_cast<double>(array.collisions()), "measurements");
+
+        echoes->release();
+        triggers->release();
+    };
+
+    run("1 group", 1, ranging::options(), false);
+    run("3 groups", 3, ranging::options(), false);
+    run("6 groups", 6, ranging::options(), false);
+    ranging::options impatient;
+    impatient.drain_limit = std::chrono::microseconds(26000);
+    run("1 group, blind sensor", 1, impatient, true);
+}
+
+// Cost per sample of the distance filters, and how far from the truth (100cm) they end up on readings with 1cm of
+// jitter and 5% wild outliers.
+void bench_filters() {
+    const std::size_t num_samples = 1000000;
+    std::minstd_rand random(7);
+    std::normal_distribution<double> jitter(0, 1.0);
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_real_distribution<double> wild(2, 400);
+    std::vector<double> samples(num_samples);
+    for (double& sample : samples) {
+        sample = chance(random) < 0.05 ? wild(random) : 100.0 + jitter(random);
+    }
+
+    auto measure = [&samples](const std::string& name, auto filter) {
+        volatile double sink = 0;
+        double squared_error = 0;
+        std::uint64_t start = backend::monotonic_ns();
+        for (double sample : samples) {
+            sink = filter.update(sample);
+        }
+        double elapsed_ns = static_cast<double>(backend::monotonic_ns() - start);
+        for (double sample : samples) {
+            double error = filter.update(sample) - 100.0;
+            squared_error += error * error;
+        }
+        bench::report(name + " cost", elapsed_ns / static_cast<double>(samples.size()), "ns/sample");
+        bench::report(name + " rms error", std::sqrt(squared_error / static_cast<double>(samples.size())), "cm");
+        (void)sink;
+    };
+
+    struct raw_filter {
+        double update(double sample) { return sample; }
+    };
+    measure("filter none (raw)", raw_filter());
+    measure("filter median of 5", filters::median_filter<5>());
+    measure("filter median of 9", filters::median_filter<9>());
+    measure("filter ema", filters::ema_filter(0.3));
+    measure("filter kalman", filters::kalman_filter());
+    measure("filter median 5 + ema", filters::distance_filter<5>(filters::smoothing::EMA));
+    measure("filter median 5 + kalman", filters::distance_filter<5>(filters::smoothing::KALMAN));
+}
+
+void bench_trace() {
+    const std::size_t num_events = 1000000;
+    std::vector<backend::edge_event> events;
+    events.reserve(num_events);
+    for (std::size_t i = 0; i < num_events; i++) {
+        auto type = i % 2 ? backend::edge_event::event_type::FALLING_EDGE : backend::edge_event::event_type::RISING_EDGE;
+        events.emplace_back(type, static_cast<unsigned int>(i % 4), 1000000 + i * 1000, i + 1, i / 4 + 1);
+    }
+
+    // what the examples used to do with every event: turn it into a line of text.
+    std::ostringstream text;
+    std::uint64_t start = backend::monotonic_ns();
+    for (const auto& event : events) {
+        text << event.timestamp_ns() << " line " << event.line_offset() << (event.type() == backend::edge_event::event_type::RISING_EDGE ? " rising" : " falling")
+             << " seqno " << event.global_seqno() << "/" << event.line_seqno() << '\n';
+    }
+    bench::report("trace formatted as text", static_cast<double>(backend::monotonic_ns() - start) / num_events, "ns/event");
+
+    // 64K events per file and 4 files, so the million events rotate through them a few times.
+    const std::string path = "/tmp/bench-trace-" + std::to_string(getpid());
+    const std::size_t per_file = 1 << 16;
+    {
+        trace::recorder recorder(path, per_file, 4);
+        start = backend::monotonic_ns();
+        for (const auto& event : events) {
+            recorder.record(event);
+        }
+        bench::report("trace recorded (mmap, rotating)", static_cast<double>(backend::monotonic_ns() - start) / num_events, "ns/event");
+        bench::report("trace rotations", static_cast<double>(recorder.rotations()), "files");
+    }
+
+    std::vector<backend::edge_event> kept = trace::load(path);
+    bool intact = kept.size() == 3 * per_file + num_events % per_file && kept.back().global_seqno() == num_events;
+    for (std::size_t i = 1; i < kept.size() && intact; i++) {
+        intact = kept[i].global_seqno() == kept[i - 1].global_seqno() + 1;
+    }
+    bench::report("trace events kept after rotating", static_cast<double>(kept.size()), intact ? "events, in order" : "events, BROKEN");
+    for (unsigned int i = 0; i < 4; i++) {
+        unlink((path + "." + std::to_string(i)).c_str());
+    }
+}
+
+// 4096 rules from 256 (made up) inputs onto the 48 frame lines, fed 20000 edges a second for 2 seconds. Thousands of
+// timers are running at any moment and nothing may be left switched on at the end.
+void bench_rules(backend::chip& chip) {
+    backend::sim_controls& sim = bench::controls(chip);
+
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-rules");
+    for (unsigned int i = 0; i < NUM_FRAME_LINES; i++) {
+        builder.add_line_settings(FIRST_FRAME_LINE + i, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    }
+    std::unique_ptr<backend::line_request> outputs = builder.do_request();
+    rules::engine responses(*outputs);
+
+    const unsigned int num_inputs = 256;
+    const std::size_t num_rules = 4096;
+    std::minstd_rand random(11);
+    const rules::retrigger policies[] = {rules::retrigger::RESTART, rules::retrigger::IGNORE, rules::retrigger::CANCEL};
+    for (std::size_t i = 0; i < num_rules; i++) {
+        responses.add_rule({static_cast<unsigned int>(i % num_inputs), i % 2 ? backend::edge::FALLING : backend::edge::BOTH,
+                            FIRST_FRAME_LINE + static_cast<unsigned int>(i % NUM_FRAME_LINES), std::chrono::milliseconds(1 + random() % 200), policies[i % 3]});
+    }
+
+    events::reactor loop;
+    loop.add(responses.fd(), [&](std::uint32_t) { responses.on_timer(); });
+
+    const std::uint64_t ms = 1000000;
+    std::uint64_t start = backend::monotonic_ns();
+    std::uint64_t next_batch = start;
+    std::uint64_t edges = 0;
+    std::uint64_t edge_ns = 0;
+    std::size_t most_running = 0;
+    std::vector<std::uint64_t> seqnos(num_inputs, 0);
+    std::uint64_t now = start;
+    while (now < start + 2000 * ms) {
+        loop.run_once(1);
+        now = backend::monotonic_ns();
+        for (; next_batch <= now; next_batch += ms) {
+            std::uint64_t before = backend::monotonic_ns();
+            for (int i = 0; i < 20; i++) {
+                unsigned int input = static_cast<unsigned int>(random() % num_inputs);
+                seqnos[input]++;
+                auto type = seqnos[input] % 2 ? backend::edge_event::event_type::FALLING_EDGE : backend::edge_event::event_type::RISING_EDGE;
+                responses.on_edge(backend::edge_event(type, input, now, ++edges, seqnos[input]));
+            }
+            responses.flush();
+            edge_ns += backend::monotonic_ns() - before;
+        }
+        most_running = std::max(most_running, responses.running());
+    }
+    while (responses.running() > 0) {
+        loop.run_once(10);
+    }
+
+    bool all_off = true;
+    for (unsigned int i = 0; i < NUM_FRAME_LINES; i++) {
+        all_off = all_off && !sim.output_value(FIRST_FRAME_LINE + i);
+    }
+
+    bench::report("rules: edges handled", static_cast<double>(edges), "edges");
+    bench::report("rules: cost per edge (16 rules each)", static_cast<double>(edge_ns) / static_cast<double>(edges), "ns/edge");
+    bench::report("rules: most timers running at once", static_cast<double>(most_running), "timers");
+    bench::report("rules: timers run out", static_cast<double>(responses.expiries()), "timers");
+    bench::report("rules: set_values calls", static_cast<double>(responses.write_count()), all_off ? "writes (all off at the end)" : "writes (OUTPUTS LEFT ON)");
+    bench::report("rules: switch-off lateness p50", static_cast<double>(responses.lateness().percentile(50)) / 1000.0, "us");
+    bench::report("rules: switch-off lateness p99", static_cast<double>(responses.lateness().percentile(99)) / 1000.0, "us");
+    bench::report("rules: switch-off lateness max", static_cast<double>(responses.lateness().max()) / 1000.0, "us");
+
+    // With that many rules per line the lines hardly ever go off. So: one edge switching all 48 lines on for 50ms,
+    // 20 times. Every batch of changes should be one write, 40 in all for 960 timers.
+    rules::engine fan_out(*outputs);
+    const unsigned int fan_input = num_inputs;
+    for (unsigned int i = 0; i < NUM_FRAME_LINES; i++) {
+        fan_out.add_rule({fan_input, backend::edge::FALLING, FIRST_FRAME_LINE + i, std::chrono::milliseconds(50), rules::retrigger::RESTART});
+    }
+    events::reactor fan_loop;
+    fan_loop.add(fan_out.fd(), [&](std::uint32_t) { fan_out.on_timer(); });
+    for (std::uint64_t round = 1; round <= 20; round++) {
+        fan_out.on_edge(backend::edge_event(backend::edge_event::event_type::FALLING_EDGE, fan_input, backend::monotonic_ns(), round, round));
+        fan_out.flush();
+        while (fan_out.running() > 0) {
+            fan_loop.run_once(100);
+        }
+        timing::deadline_timer().wait(std::chrono::milliseconds(10));
+    }
+    bench::report("rules: fan-out timers run out", static_cast<double>(fan_out.expiries()), "timers");
+    bench::report("rules: fan-out set_values calls", static_cast<double>(fan_out.write_count()), "writes");
+
+    outputs->release();
+}
+
+// One of the 500 blinking tasks: its own line (of the 48, so about 10 tasks share each one) and its own period.
+tasks::task<> blink_task(tasks::scheduler& sched, backend::line_request& outputs, unsigned int offset, std::chrono::microseconds half_period,
+                         std::uint64_t until_ns, std::uint64_t& toggles) {
+    timing::deadline_timer steps;
+    bool on = false;
+    while (backend::monotonic_ns() < until_ns) {
+        on = !on;
+        co_await sched.set_value(outputs, offset, on ? backend::value::ACTIVE : backend::value::INACTIVE);
+        toggles++;
+        co_await sched.wait(steps, half_period);
+    }
+}
+
+tasks::task<> ranging_task(tasks::scheduler& sched, backend::line_request& trigger, backend::line_request& echo, std::uint64_t until_ns,
+                           std::uint64_t& completed, std::uint64_t& timed_out, double& worst_error) {
+    timing::deadline_timer cycle;
+    while (backend::monotonic_ns() < until_ns) {
+        ranging::measurement result = co_await ranging::measure(sched, trigger, TRIGGER_LINE, echo, ECHO_LINE);
+        if (result.timed_out) {
+            timed_out++;
+        } else {
+            completed++;
+            worst_error = std::max(worst_error, std::fabs(result.distance_cm - 100.0));
+        }
+        co_await sched.wait(cycle, std::chrono::milliseconds(25));
+    }
+}
+
+// 500 coroutines blinking the 48 frame lines at periods from 2 to 40ms, plus an HC-SR04 measured by a coroutine (on the
+// sim chip), all on one thread for 2 seconds. How late the tasks wake up, how many writes they asked for vs how
+// many set_values calls that took, and how much of the core it needed.
+void bench_tasks(backend::chip& chip) {
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer("bench-tasks");
+    for (unsigned int offset = FIRST_FRAME_LINE; offset < FIRST_FRAME_LINE + NUM_FRAME_LINES; offset++) {
+        builder.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    }
+    std::unique_ptr<backend::line_request> outputs = builder.do_request();
+
+    auto* sim = dynamic_cast<backend::sim_chip*>(&chip);
+    std::unique_ptr<backend::sim_ultrasonic> pretend;
+    std::unique_ptr<backend::line_request> trigger;
+    std::unique_ptr<backend::line_request> echo;
+    if (sim) {
+        pretend = std::make_unique<backend::sim_ultrasonic>(*sim);
+        pretend->add_sensor(TRIGGER_LINE, ECHO_LINE, 100.0);
+        backend::request_builder trigger_builder = chip.prepare_request();
+        trigger_builder.set_consumer("bench-tasks-trigger");
+        trigger_builder.add_line_settings(TRIGGER_LINE, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        trigger = trigger_builder.do_request();
+        backend::request_builder echo_builder = chip.prepare_request();
+        echo_builder.set_consumer("bench-tasks-echo");
+        echo_builder.add_line_settings(ECHO_LINE, backend::line_settings().set_edge_detection(backend::edge::BOTH));
+        echo = echo_builder.do_request();
+    }
+
+    const unsigned int num_tasks = 500;
+    std::uint64_t toggles = 0;
+    std::uint64_t completed = 0;
+    std::uint64_t timed_out = 0;
+    double worst_error = 0;
+    {
+        events::reactor loop;
+        tasks::scheduler sched(loop);
+        std::uint64_t until = backend::monotonic_ns() + 2000000000ull;
+        std::mt19937 random(7);
+        std::uniform_int_distribution<int> half_period_us(1000, 20000);
+        for (unsigned int i = 0; i < num_tasks; i++) {
+            sched.spawn(blink_task(sched, *outputs, FIRST_FRAME_LINE + i % NUM_FRAME_LINES, std::chrono::microseconds(half_period_us(random)), until, toggles));
+        }
+        if (sim) {
+            sched.spawn(ranging_task(sched, *trigger, *echo, until, completed, timed_out, worst_error));
+        }
+
+        timespec cpu_start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+        std::uint64_t start = backend::monotonic_ns();
+        while (sched.running() > 0) {
+            loop.run_once(100);
+        }
+        double elapsed = bench::seconds_since(start);
+        timespec cpu_end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        double cpu = static_cast<double>(cpu_end.tv_sec - cpu_start.tv_sec) + static_cast<double>(cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+
+        bench::report("tasks: blinking tasks on one thread", static_cast<double>(num_tasks), "tasks");
+        bench::report("tasks: toggles", static_cast<double>(toggles) / elapsed, "toggles/s");
+        bench::report("tasks: writes asked for", static_cast<double>(sched.write_requests()), "writes");
+        bench::report("tasks: set_values calls", static_cast<double>(sched.write_count()), "writes");
+        bench::report("tasks: wake-up lateness p50", static_cast<double>(sched.wake_lateness().percentile(50)) / 1000.0, "us");
+        bench::report("tasks: wake-up lateness p99", static_cast<double>(sched.wake_lateness().percentile(99)) / 1000.0, "us");
+        bench::report("tasks: cpu used", cpu / elapsed * 100.0, "% of one core");
+        if (sim) {
+            bench::report("tasks: coroutine ranging rate (target 40)", static_cast<double>(completed) / elapsed, "measurements/s");
+            bench::report("tasks: coroutine ranging timed out", static_cast<double>(timed_out), "measurements");
+            bench::report("tasks: coroutine ranging worst error", worst_error * 10.0, "mm");
+        }
+    }
+
+    if (echo) {
+        echo->release();
+        trigger->release();
+    }
+    outputs->release();
+}
+
+// A console that takes 1ms for every flush, like a serial line to the pi. Everything else it takes for free.
+class slow_console : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    int sync() override {
+        timing::deadline_timer().wait(std::chrono::milliseconds(1));
+        return 0;
+    }
+};
+
+// What printing costs the thread that prints: writing every line to the console straight away vs handing it to the logger.
+// Then a flood of 100000 messages, which the logger has to drop (and count) instead of falling behind.
+void bench_logger() {
+    slow_console console_buffer;
+    std::ostream console(&console_buffer);
+
+    const int messages = 200;
+    std::uint64_t start = backend::monotonic_ns();
+    for (int i = 0; i < messages; i++) {
+        console << "Sensor " << 0 << " distance: " << 12.0 + i * 0.01 << "cm" << std::endl;
+    }
+    bench::report("print to a slow console (std::ostream)", static_cast<double>(backend::monotonic_ns() - start) / messages, "ns/message");
+
+    {
+        logging::options all_of_them; // room in the rate limit for every line
+        all_of_them.burst = messages;
+        logging::logger log(console, all_of_them);
+        logging::channel& out = log.open_channel("bench");
+        start = backend::monotonic_ns();
+        for (int i = 0; i < messages; i++) {
+            out.log("Sensor {} distance: {}cm", 0, 12.0 + i * 0.01);
+        }
+        bench::report("print to a slow console (logger)", static_cast<double>(backend::monotonic_ns() - start) / messages, "ns/message");
+        log.stop();
+        bench::report("logger lines written", static_cast<double>(log.written()), "lines");
+    }
+
+    const int flood = 100000;
+    logging::logger log(console);
+    logging::channel& out = log.open_channel("bench");
+    start = backend::monotonic_ns();
+    for (int i = 0; i < flood; i++) {
+        out.log("Edge {} on line {}", i, 21);
+    }
+    bench::report("logger flood", static_cast<double>(backend::monotonic_ns() - start) / flood, "ns/message");
+    log.stop();
+    bool counted = log.written() + log.dropped() + log.rate_limited() == flood;
+    bench::report("logger flood written", static_cast<double>(log.written()), "lines");
+    bench::report("logger flood dropped (buffer full)", static_cast<double>(log.dropped()), "lines");
+    bench::report("logger flood dropped (rate limit)", static_cast<double>(log.rate_limited()), counted ? "lines (all accounted for)" : "lines (SOME LOST)");
+}
+
+/*
+The gpio daemon (gpio_bus.hpp) on its own simulated chip, with 4 clients on their own threads all reading the same 4
+input lines out of its shared-memory ring: 20000 edges a second for a second. Then one client sends 2000 output
+commands over the socket, compared with calling set_values on a request directly.
+*/
+void bench_daemon() {
+    backend::sim_chip chip(16, "daemon");
+    backend::request_builder inputs_builder = chip.prepare_request();
+    inputs_builder.set_consumer("bench-daemon-in");
+    inputs_builder.set_event_buffer_size(1024);
+    backend::request_builder outputs_builder = chip.prepare_request();
+    outputs_builder.set_consumer("bench-daemon-out");
+    for (unsigned int offset = 0; offset < 4; offset++) {
+        inputs_builder.add_line_settings(offset, backend::line_settings().set_edge_detection(backend::edge::BOTH));
+        outputs_builder.add_line_settings(8 + offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+    }
+    std::unique_ptr<backend::line_request> inputs = inputs_builder.do_request();
+    std::unique_ptr<backend::line_request> outputs = outputs_builder.do_request();
+
+    events::reactor loop;
+    bus::server_options options;
+    options.socket_path = "/tmp/gpiod-bench-" + std::to_string(getpid()) + ".sock";
+    bus::server daemon(loop, chip, inputs.get(), outputs.get(), options);
+    std::thread daemon_thread([&loop]() { loop.run(); });
+
+    const std::size_t num_clients = 4;
+    std::vector<std::unique_ptr<bus::client>> clients;
+    std::uint64_t connect_start = backend::monotonic_ns();
+    for (std::size_t i = 0; i < num_clients; i++) {
+        clients.push_back(std::make_unique<bus::client>(options.socket_path, "bench " + std::to_string(i)));
+    }
+    double connect_us = static_cast<double>(backend::monotonic_ns() - connect_start) / 1000.0 / num_clients;
+
+    std::atomic<bool> reading(true);
+    std::vector<std::thread> readers;
+    for (auto& c : clients) {
+        readers.emplace_back([&reading, connection = c.get()]() {
+            std::vector<backend::edge_event> events(256);
+            while (reading || connection->pending()) {
+                if (connection->wait(std::chrono::milliseconds(20))) {
+                    connection->read(events.data(), events.size());
+                }
+            }
+        });
+    }
+
+    const std::size_t total_edges = 20000;
+    bool levels[4] = {false, false, false, false};
+    timing::deadline_timer pace;
+    std::uint64_t start = backend::monotonic_ns();
+    for (std::size_t i = 0; i < total_edges; i++) {
+        pace.wait(std::chrono::microseconds(50));
+        unsigned int line = static_cast<unsigned int>(i % 4);
+        levels[line] = !levels[line];
+        chip.set_input(line, levels[line]);
+    }
+    double elapsed = bench::seconds_since(start);
+
+    // until every client has read (or lost) everything.
+    std::uint64_t give_up = backend::monotonic_ns() + 2000000000ull;
+    auto caught_up = [&]() {
+        for (const auto& c : clients) {
+            if (c->received() + c->lost() < daemon.published()) {
+                return false;
+            }
+        }
+        return daemon.published() >= total_edges;
+    };
+    while (!caught_up() && backend::monotonic_ns() < give_up) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    reading = false;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    std::uint64_t worst_p50 = 0;
+    std::uint64_t worst_p99 = 0;
+    std::uint64_t received = 0;
+    std::uint64_t lost = 0;
+    for (const auto& c : clients) {
+        worst_p50 = std::max(worst_p50, c->stats_slot().delivery.percentile(50));
+        worst_p99 = std::max(worst_p99, c->stats_slot().delivery.percentile(99));
+        received += c->received();
+        lost += c->lost();
+    }
+    bench::report("daemon: client connect", connect_us, "us");
+    bench::report("daemon: events published", static_cast<double>(daemon.published()) / elapsed, "events/s");
+    bench::report("daemon: events read by 4 clients", static_cast<double>(received), "events");
+    bench::report("daemon: events lost by clients", static_cast<double>(lost), "events");
+    bench::report("daemon: delivery p50 (worst client)", static_cast<double>(worst_p50) / 1000.0, "us");
+    bench::report("daemon: delivery p99 (worst client)", static_cast<double>(worst_p99) / 1000.0, "us");
+
+    const int commands = 2000;
+    for (int i = 0; i < commands; i++) {
+        clients[0]->set_values(0xf00, (i & 1) ? 0xf00 : 0);
+    }
+    std::uint64_t direct_start = backend::monotonic_ns();
+    for (int i = 0; i < commands; i++) {
+        outputs->set_values(0xf, (i & 1) ? 0xf : 0);
+    }
+    double direct_ns = static_cast<double>(backend::monotonic_ns() - direct_start) / commands;
+    bench::report("daemon: set_values round trip p50", static_cast<double>(clients[0]->stats_slot().round_trip.percentile(50)) / 1000.0, "us");
+    bench::report("daemon: set_values round trip p99", static_cast<double>(clients[0]->stats_slot().round_trip.percentile(99)) / 1000.0, "us");
+    bench::report("daemon: set_values on the request itself", direct_ns / 1000.0, "us");
+
+    clients.clear();
+    loop.stop();
+    daemon_thread.join();
+    outputs->release();
+    inputs->release();
+}
+
+/*
+Four chips with 8 inputs and 8 outputs each. Every edge on an input of chip i drives the matching output of chip
+i + 1, so every event crosses from one chip to another. Once with all four chips on one loop (the handler writes
+directly), once with a shard per chip (the handler posts the write to the next chip's shard).
+The edges come in bursts of 128 per chip, one chip after the other, and the next round starts when all are handled.
+*/
+constexpr std::size_t NUM_SHARD_CHIPS{4};
+constexpr unsigned int SHARD_LINES{8}; // inputs 0..7, outputs 8..15 on every chip
+
+struct shard_chip {
+    std::unique_ptr<backend::chip> chip;
+    std::unique_ptr<backend::line_request> inputs;
+    std::unique_ptr<backend::line_request> outputs;
+};
+
+void run_shards(std::vector<shard_chip>& chips, bool sharded) {
+    const std::string what = sharded ? "shards: per chip" : "shards: one loop";
+    const int rounds = 200;
+    const unsigned int toggles_per_line = 16;
+
+    std::uint64_t writes_before = 0;
+    for (auto& c : chips) {
+        writes_before += c.outputs->write_count();
+    }
+
+    shards::runtime boards;
+    for (std::size_t i = 0; i < (sharded ? chips.size() : 1); i++) {
+        boards.add_shard(*chips[i].chip, static_cast<int>(i) % shards::runtime::cores(), sharded ? "chip" + std::to_string(i) : "one loop");
+    }
+    for (std::size_t i = 0; i < chips.size(); i++) {
+        std::size_t next = (i + 1) % chips.size();
+        backend::line_request* outputs = chips[next].outputs.get();
+        boards.at(sharded ? i : 0).watch(*chips[i].inputs, [sharded, next, outputs](shards::shard& self, const backend::edge_event& event) {
+            std::uint64_t bit = outputs->line_bit(SHARD_LINES + event.line_offset());
+            std::uint64_t level = event.type() == backend::edge_event::event_type::RISING_EDGE ? bit : 0;
+            if (sharded) {
+                self.post_set_values(next, *outputs, bit, level);
+            } else {
+                outputs->set_values(bit, level);
+            }
+        });
+    }
+
+    auto handled = [&boards]() {
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < boards.size(); i++) {
+            total += boards.at(i).events();
+        }
+        return total;
+    };
+
+    boards.start();
+    std::uint64_t sent = 0;
+    bool level = false;
+    std::uint64_t start = backend::monotonic_ns();
+    for (int round = 0; round < rounds; round++) {
+        for (auto& c : chips) {
+            backend::sim_controls& sim = bench::controls(*c.chip);
+            for (unsigned int toggle = 0; toggle < toggles_per_line; toggle++) {
+                level = !level;
+                for (unsigned int offset = 0; offset < SHARD_LINES; offset++) {
+                    sim.set_input(offset, level);
+                    sent++;
+                }
+            }
+        }
+        std::uint64_t give_up = backend::monotonic_ns() + 1000000000ull;
+        while (handled() < sent && backend::monotonic_ns() < give_up) {
+            std::this_thread::yield();
+        }
+    }
+    double elapsed = bench::seconds_since(start);
+    // let the last posted writes land before the shards stop.
+    std::uint64_t give_up = backend::monotonic_ns() + 1000000000ull;
+    while (sharded && backend::monotonic_ns() < give_up) {
+        std::uint64_t messages = 0;
+        std::uint64_t dropped = 0;
+        for (std::size_t i = 0; i < boards.size(); i++) {
+            messages += boards.at(i).messages();
+            dropped += boards.at(i).dropped();
+        }
+        if (messages + dropped >= handled()) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    boards.stop();
+    boards.rethrow_failure();
+
+    std::uint64_t writes = 0;
+    for (auto& c : chips) {
+        writes += c.outputs->write_count();
+    }
+
+    std::uint64_t worst_edge_p99 = 0;
+    std::uint64_t worst_post_p50 = 0;
+    std::uint64_t worst_post_p99 = 0;
+    std::uint64_t dropped = 0;
+    for (std::size_t i = 0; i < boards.size(); i++) {
+        const shards::shard& s = boards.at(i);
+        worst_edge_p99 = std::max(worst_edge_p99, s.event_latency().percentile(99));
+        worst_post_p50 = std::max(worst_post_p50, s.message_latency().percentile(50));
+        worst_post_p99 = std::max(worst_post_p99, s.message_latency().percentile(99));
+        dropped += s.dropped();
+        if (sharded) {
+            bench::report(what + ": " + s.name(), static_cast<double>(s.events()) / s.seconds(), "events/s");
+        }
+    }
+    bench::report(what + ": events", static_cast<double>(handled()) / elapsed, "events/s");
+    bench::report(what + ": events not handled", static_cast<double>(sent) - static_cast<double>(handled()), "missing");
+    bench::report(what + ": writes", static_cast<double>(writes - writes_before), "writes");
+    bench::report(what + ": edge to handler p99", static_cast<double>(worst_edge_p99) / 1000.0, "us");
+    if (sharded) {
+        bench::report(what + ": cross-shard post p50", static_cast<double>(worst_post_p50) / 1000.0, "us");
+        bench::report(what + ": cross-shard post p99", static_cast<double>(worst_post_p99) / 1000.0, "us");
+        bench::report(what + ": posts dropped", static_cast<double>(dropped), "messages");
+    }
+}
+
+void bench_shards(const std::string& chip_name) {
+    std::vector<shard_chip> chips(NUM_SHARD_CHIPS);
+    for (auto& c : chips) {
+        c.chip = backend::open_chip(chip_name);
+        bench::controls(*c.chip);
+
+        backend::request_builder inputs_builder = c.chip->prepare_request();
+        inputs_builder.set_consumer("bench-shards-in");
+        inputs_builder.set_event_buffer_size(1024);
+        backend::request_builder outputs_builder = c.chip->prepare_request();
+        outputs_builder.set_consumer("bench-shards-out");
+        for (unsigned int offset = 0; offset < SHARD_LINES; offset++) {
+            inputs_builder.add_line_settings(offset, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_DOWN));
+            outputs_builder.add_line_settings(SHARD_LINES + offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+        }
+        c.inputs = inputs_builder.do_request();
+        c.outputs = outputs_builder.do_request();
+    }
+    bench::report("shards: cores", static_cast<double>(shards::runtime::cores()), "cores");
+
+    run_shards(chips, false);
+    run_shards(chips, true);
+
+    for (auto& c : chips) {
+        c.outputs->release();
+        c.inputs->release();
+        c.chip->close();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        std::string chip_name = argc > 1 ? argv[1] : "sim";
+        std::unique_ptr<backend::chip> chip = backend::open_chip(chip_name);
+        std::cout << "Benchmarking on " << chip->info() << '\n' << '\n';
+
+        bench_timing();
+        bench_writes(*chip);
+        bench_frames(*chip);
+        bench_shift_registers(*chip);
+        bench_pwm(*chip);
+        bench_edge_throughput(*chip);
+        bench_reaction_latency(*chip);
+        bench_monitor_loops(*chip);
+        bench_event_ring();
+        bench_debounce(*chip);
+        bench_edge_reader(*chip);
+        bench_pulses(*chip);
+        bench_quadrature(*chip);
+        bench_ranging(*chip);
+        bench_sensor_array(*chip);
+        bench_filters();
+        bench_trace();
+        bench_rules(*chip);
+        bench_logger();
+        bench_tasks(*chip);
+        bench_shards(chip_name);
+        bench_daemon();
+
+        chip->close();
+
+    } catch (const std::system_error& e) {
+        std::cout << "Benchmark failed!" << '\n';
+        std::cout << "Error: " << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/*
+Command line arguments to numbers.
+
+std::stoul and std::stod throw std::invalid_argument or std::out_of_range on rubbish, which the examples' catch for
+std::system_error never sees, so the program ends in std::terminate. They also happily read "12abc" as 12 and "-1"
+as the biggest unsigned long. These take the whole string or nothing and throw an EINVAL system_error that says
+which argument was wrong.
+*/
+namespace args {
+
+// A whole number from min to max. `what` names the argument in the error ("LED count").
+inline unsigned long parse_count(const std::string& text, const std::string& what, unsigned long min = 0,
+                                 unsigned long max = std::numeric_limits<unsigned long>::max()) {
+    std::string range;
+    // stoul skips leading spaces and takes a sign, a count doesn't have either.
+    if (!text.empty() && text[0] >= '0' && text[0] <= '9') {
+        try {
+            std::size_t used = 0;
+            unsigned long value = std::stoul(text, &used);
+            if (used == text.size()) {
+                if (value >= min && value <= max) {
+                    return value;
+                }
+                range = " (has to be " + std::to_string(min) + " to " + std::to_string(max) + ")";
+            }
+        } catch (const std::logic_error&) {
+            // std::invalid_argument or std::out_of_range, reported below
+        }
+    }
+    throw std::system_error(EINVAL, std::generic_category(), "bad " + what + " \"" + text + "\"" + range);
+}
+
+// A line offset.
+inline unsigned int parse_offset(const std::string& text) {
+    return static_cast<unsigned int>(parse_count(text, "line offset", 0, std::numeric_limits<unsigned int>::max()));
+}
+
+// "21" or "21,20,16" to a list of offsets. Empty items are skipped.
+inline std::vector<unsigned int> parse_offsets(const std::string& list) {
+    std::vector<unsigned int> offsets;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            offsets.push_back(parse_offset(item));
+        }
+    }
+    return offsets;
+}
+
+// A number above 0, like a speed or a scale.
+inline double parse_positive(const std::string& text, const std::string& what) {
+    // stod skips leading spaces too.
+    if (!text.empty() && !std::isspace(static_cast<unsigned char>(text[0]))) {
+        try {
+            std::size_t used = 0;
+            double value = std::stod(text, &used);
+            if (used == text.size() && std::isfinite(value) && value > 0) {
+                return value;
+            }
+        } catch (const std::logic_error&) {
+            // std::invalid_argument or std::out_of_range, reported below
+        }
+    }
+    throw std::system_error(EINVAL, std::generic_category(), "bad " + what + " \"" + text + "\" (has to be above 0)");
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <time.h>
+
+#include "gpio_backend.hpp"
+#include "histogram.hpp"
+
+/*
+Drift-free timing on absolute deadlines.
+
+usleep(500000) five times in a row doesn't take 2.5s, it takes 2.5s plus five wake-up delays plus however long the
+code between the sleeps took. Those errors pile up so a pattern slowly drifts away from the wall clock.
+
+A deadline_timer instead remembers when the next step is *supposed* to happen (start + sum of all steps so far) and
+sleeps until exactly then with clock_nanosleep(TIMER_ABSTIME) on CLOCK_MONOTONIC. One late wake-up no longer pushes
+every step after it.
+
+For very short steps (the 10us HC-SR04 trigger pulse for example) the scheduler's wake-up delay is bigger than the
+step itself, so you can give it a spin window: it sleeps until the deadline minus the window, then busy-waits the rest.
+
+How late every step woke up is recorded so you can see min/p50/p99/max lateness.
+*/
+namespace timing {
+
+inline timespec to_timespec(std::uint64_t ns) {
+    return timespec{static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+}
+
+class deadline_timer {
+public:
+    explicit deadline_timer(std::chrono::nanoseconds spin_window = std::chrono::nanoseconds(0))
+        : spin_ns(static_cast<std::uint64_t>(spin_window.count())) {
+        start();
+    }
+
+    // Steps are counted from now.
+    void start() { next_deadline = backend::monotonic_ns(); }
+
+    // Steps are counted from a point in time you pick, like the timestamp of an edge event.
+    void start_at(std::uint64_t timestamp_ns) { next_deadline = timestamp_ns; }
+
+    // Moves the deadline on by step and sleeps until it.
+    void wait(std::chrono::nanoseconds step) {
+        next_deadline += static_cast<std::uint64_t>(step.count());
+        sleep_until(next_deadline);
+    }
+
+    // If we're already past the deadline this returns straight away (and records how late we were).
+    void sleep_until(std::uint64_t deadline_ns) {
+        std::uint64_t now = backend::monotonic_ns();
+
+        if (deadline_ns > now + spin_ns) {
+            timespec wake = to_timespec(deadline_ns - spin_ns);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr) == EINTR) {}
+            now = backend::monotonic_ns();
+        }
+        while (now < deadline_ns) {
+            now = backend::monotonic_ns();
+        }
+
+        lateness_ns.record(now - deadline_ns);
+    }
+
+    // For code that does its waiting somewhere else (an event loop, a coroutine): moves the deadline on by step and
+    // returns it without sleeping. Call woke() once it's been reached to record how late that was.
+    std::uint64_t advance(std::chrono::nanoseconds step) {
+        next_deadline += static_cast<std::uint64_t>(step.count());
+        return next_deadline;
+    }
+
+    void woke(std::uint64_t now_ns) { lateness_ns.record(now_ns > next_deadline ? now_ns - next_deadline : 0); }
+
+    std::uint64_t deadline() const { return next_deadline; }
+    const metrics::latency_histogram& lateness() const { return lateness_ns; }
+
+private:
+    std::uint64_t spin_ns;
+    std::uint64_t next_deadline{0};
+    metrics::latency_histogram lateness_ns;
+};
+
+}
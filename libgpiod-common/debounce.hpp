@@ -0,0 +1,216 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+
+/*
+Debouncing for every input line of a line request.
+
+A mechanical button doesn't switch cleanly, the contacts bounce for a few milliseconds and every bounce is an edge
+event. Pressing once can look like FALLING, RISING, FALLING, RISING, FALLING.
+
+Lines the chip already debounces (line_settings::set_debounce_period() was honoured, see
+line_request::debounce_period()) go straight through. Every other line gets a small state machine run on the event
+timestamps:
+- the first edge that changes the line's level is passed on right away, no added latency
+- for one period after it every edge is swallowed (counted as suppressed)
+- when the period runs out the line's real level is checked, and if the bouncing ended on the other level (a very
+  quick tap for example) a correcting event is passed on so you never get stuck thinking the button is still down
+
+That last check needs a timer, which is fd(): a timerfd that becomes readable when a line's period runs out. Watch it
+in your event loop and call on_timer() when it fires.
+
+Everything clean (passed on right away or as a correction) comes out through the deliver callback you pass in.
+
+Not thread safe, use it from the thread that reads the events.
+*/
+namespace debounce {
+
+struct line_counts {
+    unsigned int offset;
+    bool by_chip;            // debounced by the chip, the state machine is bypassed
+    std::uint64_t passed;    // clean transitions handed on
+    std::uint64_t suppressed;
+    std::uint64_t corrected; // passed on when a period ran out on the other level
+};
+
+class debouncer {
+public:
+    // Every line in the request gets `period`, unless the chip debounces it already.
+    debouncer(backend::line_request& lines, std::chrono::microseconds period) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the debounce timer");
+        }
+
+        for (unsigned int offset : lines.offsets()) {
+            line_state state;
+            state.offset = offset;
+            state.by_chip = lines.debounce_period(offset).count() > 0;
+            state.period_ns = static_cast<std::uint64_t>(std::chrono::nanoseconds(period).count());
+            state.stable = state.raw = lines.get_value(offset) == backend::value::ACTIVE;
+            states.push_back(state);
+        }
+    }
+
+    ~debouncer() { ::close(timer_fd); }
+
+    debouncer(const debouncer&) = delete;
+    debouncer& operator=(const debouncer&) = delete;
+
+    // A different period for one line (a slide switch bounces longer than a tactile button).
+    void set_period(unsigned int offset, std::chrono::microseconds period) {
+        find(offset).period_ns = static_cast<std::uint64_t>(std::chrono::nanoseconds(period).count());
+    }
+
+    // Feed it every event you read, in order. Clean transitions are handed to deliver(const backend::edge_event&).
+    template <typename Deliver>
+    void feed(const backend::edge_event& event, Deliver deliver) {
+        line_state& line = find(event.line_offset());
+        bool high = event.type() == backend::edge_event::event_type::RISING_EDGE;
+
+        if (line.by_chip) {
+            line.stable = line.raw = high;
+            line.passed++;
+            deliver(event);
+            return;
+        }
+
+        // the timer may not have fired yet for a period that's over, settle it first so nothing is out of order.
+        settle(line, event.timestamp_ns(), deliver);
+
+        line.raw = high;
+        line.last_raw = event;
+        if (event.timestamp_ns() < line.lockout_until) {
+            // still bouncing. check the level again once the period is over.
+            line.suppressed++;
+            line.recheck = true;
+            arm();
+            return;
+        }
+        if (high == line.stable) {
+            // an edge back to where we already are, the other half of it was swallowed earlier.
+            line.suppressed++;
+            return;
+        }
+
+        line.stable = high;
+        line.lockout_until = event.timestamp_ns() + line.period_ns;
+        line.passed++;
+        deliver(event);
+    }
+
+    // Call when fd() is readable, hands on any correcting events.
+    template <typename Deliver>
+    void on_timer(Deliver deliver) {
+        std::uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "reading the debounce timer failed");
+        }
+        armed_for = 0;
+        expire_until(backend::monotonic_ns(), deliver);
+    }
+
+    // The same without the timer: finishes every period that ended by `now`.
+    template <typename Deliver>
+    void expire_until(std::uint64_t now, Deliver deliver) {
+        for (line_state& line : states) {
+            settle(line, now, deliver);
+        }
+        arm();
+    }
+
+    // Readable when a period with suppressed edges in it has run out.
+    int fd() const { return timer_fd; }
+
+    std::vector<line_counts> counts() const {
+        std::vector<line_counts> all;
+        for (const line_state& line : states) {
+            all.push_back(line_counts{line.offset, line.by_chip, line.passed, line.suppressed, line.corrected});
+        }
+        return all;
+    }
+
+    std::uint64_t suppressed() const {
+        std::uint64_t total = 0;
+        for (const line_state& line : states) {
+            total += line.suppressed;
+        }
+        return total;
+    }
+
+private:
+    struct line_state {
+        unsigned int offset{0};
+        bool by_chip{false};
+        std::uint64_t period_ns{0};
+        bool stable{false};          // the level we've told everyone about
+        bool raw{false};             // the level the last event said
+        bool recheck{false};         // edges were swallowed, compare raw and stable when the period ends
+        std::uint64_t lockout_until{0};
+        backend::edge_event last_raw;
+        std::uint64_t passed{0};
+        std::uint64_t suppressed{0};
+        std::uint64_t corrected{0};
+    };
+
+    // If the line's period ended by `now` with edges swallowed in it, makes sure we ended up on the real level.
+    template <typename Deliver>
+    void settle(line_state& line, std::uint64_t now, Deliver& deliver) {
+        if (!line.recheck || line.lockout_until > now) {
+            return;
+        }
+        line.recheck = false;
+        if (line.raw != line.stable) {
+            // the bouncing settled on the other level. the last raw edge is when it got there.
+            line.stable = line.raw;
+            line.lockout_until = line.last_raw.timestamp_ns() + line.period_ns;
+            line.corrected++;
+            line.passed++;
+            deliver(line.last_raw);
+        }
+    }
+
+    line_state& find(unsigned int offset) {
+        for (line_state& line : states) {
+            if (line.offset == offset) {
+                return line;
+            }
+        }
+        throw std::system_error(EINVAL, std::generic_category(), "line " + std::to_string(offset) + " isn't debounced here");
+    }
+
+    // Makes sure the timer goes off by the earliest period that still needs a recheck. A timer that goes off too early
+    // (or for nothing) costs one harmless wake-up, so it's only moved when it would otherwise be late: that keeps the
+    // timerfd_settime() syscall off the path of most suppressed bounces.
+    void arm() {
+        std::uint64_t earliest = 0;
+        for (const line_state& line : states) {
+            if (line.recheck && (earliest == 0 || line.lockout_until < earliest)) {
+                earliest = line.lockout_until;
+            }
+        }
+        if (earliest == 0 || (armed_for != 0 && armed_for <= earliest)) {
+            return;
+        }
+        armed_for = earliest;
+
+        itimerspec when{};
+        when.it_value = timing::to_timespec(earliest);
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, nullptr);
+    }
+
+    int timer_fd{-1};
+    std::uint64_t armed_for{0};
+    std::vector<line_state> states;
+};
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "gpio_backend.hpp"
+
+/*
+Reads edge events and notices the ones that never made it.
+
+The kernel gives every event two sequence numbers: one counting all events of the line request (global_seqno) and
+one counting the events of its line (line_seqno). When events come in faster than they're read, the kernel's queue
+(event_buffer_size, 16 per line by default) fills up and the oldest events are thrown away. Nothing tells you about
+it, except that the seqnos of the events you do get skip some numbers. edge_reader checks every event's line_seqno
+against the last one it saw for that line and counts the missing ones per line.
+
+It also sizes its own buffer to the bursts it sees. A read that fills the buffer means more is waiting: it keeps
+reading until the queue is empty and doubles the buffer for next time. If the largest burst over the last
+shrink_after reads would have fit in a quarter of the buffer, it halves it again.
+
+The kernel's queue can't be resized once the lines are requested, so for that recommended_kernel_buffer() says what
+to pass to request_builder::set_event_buffer_size() next time, from the largest burst plus whatever got dropped.
+
+Use it from one thread. The drop counters are atomics and can be read from anywhere.
+*/
+namespace events {
+
+struct reader_options {
+    std::size_t initial_capacity{16};
+    std::size_t min_capacity{4};
+    std::size_t max_capacity{1024};
+    std::size_t shrink_after{1024}; // reads to wait before shrinking the buffer
+};
+
+struct line_drops {
+    unsigned int offset;
+    std::uint64_t received;
+    std::uint64_t dropped;
+    std::uint64_t largest_gap; // most events lost in one go
+};
+
+class edge_reader {
+public:
+    // The kernel caps a request's event buffer at 16 events for each of the 64 lines it can hold.
+    static constexpr std::size_t MAX_KERNEL_BUFFER{1024};
+
+    explicit edge_reader(backend::line_request& lines, reader_options settings = reader_options())
+        : lines(&lines), settings(settings),
+          buffer(std::min(std::max(settings.initial_capacity, settings.min_capacity), settings.max_capacity)) {
+        for (unsigned int offset : lines.offsets()) {
+            if (offset >= line_by_offset.size()) {
+                line_by_offset.resize(offset + 1, -1);
+            }
+            line_by_offset[offset] = static_cast<int>(per_line.size());
+            per_line.push_back(std::make_unique<line_state>());
+            per_line.back()->offset = offset;
+        }
+    }
+
+    int fd() const { return lines->fd(); }
+
+    /*
+    Call when fd() is readable. Reads until the queue is empty and hands every event to deliver (in order).
+    Returns how many events were read.
+    */
+    template <typename Deliver>
+    std::size_t read(Deliver deliver) {
+        std::size_t burst = 0;
+        std::uint64_t dropped_before = dropped();
+        bool filled = false;
+        do {
+            std::size_t got = lines->read_edge_events(buffer);
+            burst += got;
+            for (const auto& event : buffer) {
+                check(event);
+                deliver(event);
+            }
+            filled = got == buffer.capacity();
+        } while (filled && lines->wait_edge_events(std::chrono::nanoseconds(0)));
+
+        resize(burst);
+        // the burst really was as big as what we read plus what the kernel couldn't keep.
+        biggest_arrival = std::max(biggest_arrival, burst + static_cast<std::size_t>(dropped() - dropped_before));
+        return burst;
+    }
+
+    // Without the per-event callback, for when you only want the counters.
+    std::size_t read() {
+        return read([](const backend::edge_event&) {});
+    }
+
+    std::uint64_t dropped() const { return total_dropped.load(std::memory_order_relaxed); }
+
+    std::uint64_t dropped(unsigned int offset) const {
+        int index = offset < line_by_offset.size() ? line_by_offset[offset] : -1;
+        return index < 0 ? 0 : per_line[static_cast<std::size_t>(index)]->dropped.load(std::memory_order_relaxed);
+    }
+
+    std::vector<line_drops> counts() const {
+        std::vector<line_drops> counts;
+        for (const auto& line : per_line) {
+            counts.push_back(line_drops{line->offset, line->received.load(std::memory_order_relaxed),
+                                        line->dropped.load(std::memory_order_relaxed), line->largest_gap.load(std::memory_order_relaxed)});
+        }
+        return counts;
+    }
+
+    // One line per line: "<what> line 21: 120 received, 0 dropped (largest gap 0)", then the buffer sizes.
+    void print(std::ostream& out, const std::string& what) const {
+        for (const auto& line : counts()) {
+            out << what << " line " << line.offset << ": " << line.received << " received, " << line.dropped
+                << " dropped (largest gap " << line.largest_gap << ")" << '\n';
+        }
+        out << what << " buffer: " << capacity() << " events (largest burst " << largest_burst() << ", resized "
+            << resizes() << " times), recommended kernel buffer " << recommended_kernel_buffer() << " events" << '\n';
+    }
+
+    std::size_t capacity() const { return buffer.capacity(); }
+    std::size_t largest_burst() const { return biggest_burst; }
+    std::size_t resizes() const { return resize_count; }
+
+    // Room for twice the largest burst seen (including what was lost from it), rounded up to a power of two.
+    std::size_t recommended_kernel_buffer() const {
+        std::size_t wanted = 2 * biggest_arrival;
+        std::size_t size = 16 * std::max<std::size_t>(per_line.size(), 1);
+        while (size < wanted && size < MAX_KERNEL_BUFFER) {
+            size *= 2;
+        }
+        return std::min(size, MAX_KERNEL_BUFFER);
+    }
+
+private:
+    struct line_state {
+        unsigned int offset{0};
+        std::uint64_t last_seqno{0}; // seqnos start at 1, so a first event with a higher one means some were lost too
+        std::atomic<std::uint64_t> received{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<std::uint64_t> largest_gap{0};
+    };
+
+    void check(const backend::edge_event& event) {
+        int index = event.line_offset() < line_by_offset.size() ? line_by_offset[event.line_offset()] : -1;
+        if (index < 0) {
+            return;
+        }
+        line_state& line = *per_line[static_cast<std::size_t>(index)];
+        line.received.fetch_add(1, std::memory_order_relaxed);
+        if (event.line_seqno() > line.last_seqno + 1) {
+            std::uint64_t gap = event.line_seqno() - line.last_seqno - 1;
+            line.dropped.fetch_add(gap, std::memory_order_relaxed);
+            total_dropped.fetch_add(gap, std::memory_order_relaxed);
+            if (gap > line.largest_gap.load(std::memory_order_relaxed)) {
+                line.largest_gap.store(gap, std::memory_order_relaxed);
+            }
+        }
+        line.last_seqno = event.line_seqno();
+    }
+
+    void resize(std::size_t burst) {
+        biggest_burst = std::max(biggest_burst, burst);
+        window_peak = std::max(window_peak, burst);
+
+        std::size_t wanted = buffer.capacity();
+        if (burst > buffer.capacity()) {
+            while (wanted < burst && wanted < settings.max_capacity) {
+                wanted *= 2;
+            }
+            window_peak = 0;
+            window_reads = 0;
+        } else if (++window_reads >= settings.shrink_after) {
+            if (window_peak * 4 <= buffer.capacity()) {
+                wanted = std::max(buffer.capacity() / 2, settings.min_capacity);
+            }
+            window_peak = 0;
+            window_reads = 0;
+        }
+
+        wanted = std::min(wanted, settings.max_capacity);
+        if (wanted != buffer.capacity()) {
+            buffer = backend::edge_event_buffer(wanted);
+            resize_count++;
+        }
+    }
+
+    backend::line_request* lines;
+    reader_options settings;
+    backend::edge_event_buffer buffer;
+
+    std::vector<std::unique_ptr<line_state>> per_line;
+    std::vector<int> line_by_offset; // offset -> index into per_line, -1 if it isn't in the request
+    std::atomic<std::uint64_t> total_dropped{0};
+
+    std::size_t biggest_burst{0};
+    std::size_t biggest_arrival{0};
+    std::size_t window_peak{0};
+    std::size_t window_reads{0};
+    std::size_t resize_count{0};
+};
+
+}
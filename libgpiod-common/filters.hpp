@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+/*
+Streaming filters for noisy readings like the HC-SR04's distances.
+
+Every filter takes one sample at a time and returns the filtered value right away. They're fixed size and never
+allocate, so they're fine to run on every measurement.
+
+- median_filter<N>: the median of the last N samples. One wild reading (an echo off the wrong thing) is simply never
+  the middle value, so it disappears without dragging the output along like an average would.
+- ema_filter: exponential moving average. Smooths jitter, alpha is how much a new sample counts (1 = no smoothing).
+- kalman_filter: a 1-D Kalman filter for a value that mostly stays put. It keeps an estimate of its own uncertainty
+  and trusts new samples less the more sure it is, so it settles quickly and then smooths hard.
+- distance_filter<N>: the pipeline the sensor example uses, a median to throw out outliers followed by EMA or Kalman
+  smoothing.
+*/
+namespace filters {
+
+template <std::size_t N>
+class median_filter {
+    static_assert(N % 2 == 1, "use an odd window so there's a middle value");
+
+public:
+    double update(double sample) {
+        if (count < N) {
+            // still filling up: just insert it in order.
+            window[count] = sample;
+            sorted[count] = sample;
+            count++;
+            std::sort(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(count));
+        } else {
+            // swap the oldest sample for the new one in the sorted copy, then move it to where it belongs.
+            double oldest = window[next];
+            window[next] = sample;
+            std::size_t at = static_cast<std::size_t>(std::lower_bound(sorted.begin(), sorted.end(), oldest) - sorted.begin());
+            sorted[at] = sample;
+            while (at > 0 && sorted[at - 1] > sorted[at]) {
+                std::swap(sorted[at - 1], sorted[at]);
+                at--;
+            }
+            while (at + 1 < N && sorted[at + 1] < sorted[at]) {
+                std::swap(sorted[at + 1], sorted[at]);
+                at++;
+            }
+        }
+        next = next + 1 == N ? 0 : next + 1;
+        return value();
+    }
+
+    // Until the window is full this is the median of what's there so far.
+    double value() const { return count ? sorted[(count - 1) / 2] : 0.0; }
+    bool full() const { return count == N; }
+
+private:
+    std::array<double, N> window{};  // in arrival order
+    std::array<double, N> sorted{};
+    std::size_t count{0};
+    std::size_t next{0};
+};
+
+class ema_filter {
+public:
+    explicit ema_filter(double alpha = 0.3) : alpha(alpha) {}
+
+    double update(double sample) {
+        estimate = primed ? estimate + alpha * (sample - estimate) : sample;
+        primed = true;
+        return estimate;
+    }
+
+    double value() const { return estimate; }
+
+private:
+    double alpha;
+    double estimate{0};
+    bool primed{false};
+};
+
+class kalman_filter {
+public:
+    // process_noise: how much the real value can change between samples (variance).
+    // measurement_noise: how noisy a single sample is (variance).
+    kalman_filter(double process_noise = 0.05, double measurement_noise = 4.0) : q(process_noise), r(measurement_noise) {}
+
+    double update(double sample) {
+        if (!primed) {
+            estimate = sample;
+            error = r;
+            primed = true;
+            return estimate;
+        }
+        error += q;
+        double gain = error / (error + r);
+        estimate += gain * (sample - estimate);
+        error *= 1 - gain;
+        return estimate;
+    }
+
+    double value() const { return estimate; }
+    double variance() const { return error; }
+
+private:
+    double q;
+    double r;
+    double estimate{0};
+    double error{0};
+    bool primed{false};
+};
+
+enum class smoothing { NONE, EMA, KALMAN };
+
+// Median of N to reject outliers, then smoothing.
+template <std::size_t N = 5>
+class distance_filter {
+public:
+    explicit distance_filter(smoothing kind = smoothing::EMA, double ema_alpha = 0.3, double process_noise = 0.05, double measurement_noise = 4.0)
+        : kind(kind), ema(ema_alpha), kalman(process_noise, measurement_noise) {}
+
+    double update(double sample) {
+        double median = outliers.update(sample);
+        switch (kind) {
+            case smoothing::EMA: filtered = ema.update(median); break;
+            case smoothing::KALMAN: filtered = kalman.update(median); break;
+            case smoothing::NONE: filtered = median; break;
+        }
+        return filtered;
+    }
+
+    double value() const { return filtered; }
+
+private:
+    smoothing kind;
+    median_filter<N> outliers;
+    ema_filter ema;
+    kalman_filter kalman;
+    double filtered{0};
+};
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "tasks.hpp"
+
+/*
+A pattern engine built on frame tables.
+
+A pattern is worked out up front as a list of frames. Each frame is a bitmask saying which channels are on
+(bit i = channel i) and how long to hold it. Playing a frame is one set_values() call no matter how many lines
+there are, so every line changes at the same moment and the number of syscalls doesn't grow with the pin count.
+
+Frames are timed on absolute deadlines (deadline_timer.hpp) so a long pattern ends when it should instead of a
+little later every frame.
+
+frame_stats keeps count of the writes made for every frame and the skew between the first and the last one,
+which shows the frames stay atomic (1 write, 0 skew) however many outputs we drive.
+
+play() blocks the thread until the pattern is done. There's also a task version for tasks::scheduler (tasks.hpp)
+that waits for its deadlines with co_await, so any number of patterns (and whatever else) can play on one thread.
+*/
+namespace frames {
+
+struct frame {
+    std::uint64_t bits;
+    std::chrono::microseconds duration;
+};
+
+struct frame_table {
+    unsigned int num_channels{0};
+    std::vector<frame> frames;
+};
+
+struct frame_stats {
+    std::uint64_t frames_played{0};
+    std::uint64_t writes{0};
+    std::uint64_t max_writes_per_frame{0};
+    std::uint64_t max_skew_ns{0};
+    std::uint64_t total_skew_ns{0};
+};
+
+class frame_player {
+public:
+    // channels[i] is the offset that channel i of a frame table is played on.
+    frame_player(backend::line_request& lines, const std::vector<unsigned int>& channels) : lines(&lines) {
+        for (unsigned int offset : channels) {
+            channel_bits.push_back(lines.line_bit(offset));
+            all_channels |= channel_bits.back();
+        }
+        channel_offsets = channels;
+    }
+
+    // Batched is the whole point, turning it off writes one line at a time like the old modes did (for comparison).
+    void set_batched(bool batched) { this->batched = batched; }
+
+    const frame_stats& stats() const { return totals; }
+
+    // How late each frame after the first went out compared to its deadline.
+    const metrics::latency_histogram& lateness() const { return timer.lateness(); }
+
+    void play(const frame_table& table, unsigned int repeats = 1) {
+        prepare(table);
+
+        timer.start();
+        for (unsigned int round = 0; round < repeats; round++) {
+            for (std::size_t i = 0; i < table.frames.size(); i++) {
+                write_frame(request_bits[i]);
+                if (table.frames[i].duration.count() > 0) {
+                    timer.wait(table.frames[i].duration);
+                }
+            }
+        }
+    }
+
+    /*
+    The same as a task: co_await player.play(sched, table, repeats). The table is copied into the task so a temporary
+    is fine, the player has to outlive it. Frames are still written straight away (not merged with other tasks'
+    writes) so the stats are this player's own.
+    */
+    tasks::task<> play(tasks::scheduler& sched, frame_table table, unsigned int repeats = 1) {
+        prepare(table);
+
+        timer.start();
+        for (unsigned int round = 0; round < repeats; round++) {
+            for (std::size_t i = 0; i < table.frames.size(); i++) {
+                write_frame(request_bits[i]);
+                if (table.frames[i].duration.count() > 0) {
+                    co_await sched.wait(timer, table.frames[i].duration);
+                }
+            }
+        }
+    }
+
+private:
+    // translate channel bits into request bits once, before the clock starts.
+    void prepare(const frame_table& table) {
+        request_bits.clear();
+        for (const auto& step : table.frames) {
+            request_bits.push_back(to_request_bits(step.bits));
+        }
+    }
+
+    std::uint64_t to_request_bits(std::uint64_t bits) const {
+        std::uint64_t converted = 0;
+        for (std::size_t channel = 0; channel < channel_bits.size(); channel++) {
+            if ((bits >> channel) & 1) {
+                converted |= channel_bits[channel];
+            }
+        }
+        return converted;
+    }
+
+    void write_frame(std::uint64_t bits) {
+        std::uint64_t writes_before = lines->write_count();
+        std::uint64_t first_write_ns = 0;
+        std::uint64_t last_write_ns = 0;
+
+        if (batched) {
+            lines->set_values(all_channels, bits);
+            first_write_ns = last_write_ns = backend::monotonic_ns();
+        } else {
+            for (std::size_t channel = 0; channel < channel_offsets.size(); channel++) {
+                lines->set_value(channel_offsets[channel], bits & channel_bits[channel] ? backend::value::ACTIVE : backend::value::INACTIVE);
+                last_write_ns = backend::monotonic_ns();
+                if (channel == 0) {
+                    first_write_ns = last_write_ns;
+                }
+            }
+        }
+
+        std::uint64_t writes = lines->write_count() - writes_before;
+        std::uint64_t skew = last_write_ns - first_write_ns;
+        totals.frames_played++;
+        totals.writes += writes;
+        totals.total_skew_ns += skew;
+        if (writes > totals.max_writes_per_frame) {
+            totals.max_writes_per_frame = writes;
+        }
+        if (skew > totals.max_skew_ns) {
+            totals.max_skew_ns = skew;
+        }
+    }
+
+    backend::line_request* lines;
+    std::vector<unsigned int> channel_offsets;
+    std::vector<std::uint64_t> channel_bits;
+    std::uint64_t all_channels{0};
+    std::vector<std::uint64_t> request_bits;
+    bool batched{true};
+    frame_stats totals;
+    timing::deadline_timer timer;
+};
+
+}
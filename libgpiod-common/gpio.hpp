@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "args.hpp"
+#include "gpio_backend.hpp"
+#include "gpio_daemon.hpp"
+#include "gpio_sim.hpp"
+
+#ifdef WITH_LIBGPIOD
+#include "gpio_libgpiod.hpp"
+#include "gpio_kernel_sim.hpp"
+#endif
+
+namespace backend {
+
+/*
+Opens a chip by name:
+- "sim" or "sim:<lines>"           in-process simulated chip (always available)
+- "gpio-sim" or "gpio-sim:<lines>" kernel gpio-sim chip (needs libgpiod, root and the gpio-sim module)
+- "daemon" or "daemon:<socket>"    lines borrowed from a running gpio daemon (libgpiod-daemon)
+- anything else is a path like "/dev/gpiochip0" and is opened with libgpiod
+*/
+inline std::unique_ptr<chip> open_chip(const std::string& name) {
+    auto num_lines = [&name](const std::string& prefix) -> unsigned int {
+        if (name.size() <= prefix.size()) {
+            return 64;
+        }
+        return static_cast<unsigned int>(args::parse_count(name.substr(prefix.size() + 1), "line count in " + name, 1, 4096));
+    };
+
+    if (name == "sim" || name.rfind("sim:", 0) == 0) {
+        return std::make_unique<sim_chip>(num_lines("sim"));
+    }
+
+    if (name == "daemon" || name.rfind("daemon:", 0) == 0) {
+        return std::make_unique<daemon_chip>(name.size() > 7 ? name.substr(7) : bus::DEFAULT_SOCKET);
+    }
+
+#ifdef WITH_LIBGPIOD
+    if (name == "gpio-sim" || name.rfind("gpio-sim:", 0) == 0) {
+        return std::make_unique<kernel_sim_chip>(num_lines("gpio-sim"));
+    }
+    return std::make_unique<libgpiod_chip>(name);
+#else
+    throw std::system_error(ENOTSUP, std::generic_category(), "built without libgpiod (WITH_LIBGPIOD=0), only the \"sim\" and \"daemon\" chips are available");
+#endif
+}
+
+}
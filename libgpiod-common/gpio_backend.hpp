@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <time.h>
+
+/*
+A thin GPIO backend interface shared by all of the examples.
+
+The examples used to talk to gpiod::chip("/dev/gpiochip0") directly which meant nothing could run (or be measured)
+without a pi sitting on the desk. Everything in here mirrors the libgpiod C++ names on purpose (chip, request_builder,
+line_settings, line_request, edge_event, edge_event_buffer) so the example code reads almost the same as before, but the
+chip behind it can be:
+
+- the real thing via libgpiod                     (gpio_libgpiod.hpp)
+- a kernel gpio-sim chip created through configfs (gpio_kernel_sim.hpp)
+- a simulated chip that lives inside the process  (gpio_sim.hpp)
+
+Use backend::open_chip() from gpio.hpp to pick one by name.
+*/
+namespace backend {
+
+// CLOCK_MONOTONIC in nanoseconds, the same clock the kernel stamps edge events with by default.
+inline std::uint64_t monotonic_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::uint64_t>(now.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(now.tv_nsec);
+}
+
+// Prints offsets the way libgpiod does, e.g. "[5, 6]".
+inline std::string to_string(const std::vector<unsigned int>& offsets) {
+    std::string out = "[";
+    for (std::size_t i = 0; i < offsets.size(); i++) {
+        out += (i ? ", " : "") + std::to_string(offsets[i]);
+    }
+    return out + "]";
+}
+
+enum class direction { INPUT, OUTPUT };
+enum class edge { NONE, RISING, FALLING, BOTH };
+enum class bias { AS_IS, DISABLED, PULL_UP, PULL_DOWN };
+enum class value { INACTIVE = 0, ACTIVE = 1 };
+
+// The clock edge events are stamped with. MONOTONIC is the default (and the same as monotonic_ns()), REALTIME is
+// wall clock time (it jumps when the time is set), HTE is a hardware timestamp engine next to the gpio controller,
+// which only some SoCs have (not the pi).
+enum class event_clock { MONOTONIC, REALTIME, HTE };
+
+// Same idea as gpiod::line_settings, every setter returns itself so calls can be chained.
+class line_settings {
+public:
+    line_settings& set_direction(direction new_direction) { line_direction = new_direction; return *this; }
+    line_settings& set_edge_detection(edge new_edge) { edge_detection = new_edge; return *this; }
+    line_settings& set_bias(bias new_bias) { line_bias = new_bias; return *this; }
+    line_settings& set_output_value(value new_value) { output_value = new_value; return *this; }
+    line_settings& set_event_clock(event_clock new_clock) { timestamp_clock = new_clock; return *this; }
+
+    // Asks the chip to debounce an input line itself. Not every chip can, check line_request::debounce_period().
+    line_settings& set_debounce_period(std::chrono::microseconds period) { debounce = period; return *this; }
+
+    direction line_direction{direction::INPUT};
+    edge edge_detection{edge::NONE};
+    bias line_bias{bias::AS_IS};
+    value output_value{value::INACTIVE};
+    std::chrono::microseconds debounce{0};
+    event_clock timestamp_clock{event_clock::MONOTONIC};
+};
+
+// Everything a chip needs to know to hand out a line request.
+struct request_config {
+    std::string consumer;
+    std::size_t event_buffer_size{0}; // 0 lets the kernel pick (16 events per requested line).
+    std::vector<std::pair<unsigned int, line_settings>> lines;
+};
+
+// A compact copy of gpiod::edge_event. It's plain data so it can be stored in rings and trace files as-is.
+class edge_event {
+public:
+    enum class event_type { RISING_EDGE, FALLING_EDGE };
+
+    edge_event() = default;
+    edge_event(event_type type, unsigned int offset, std::uint64_t timestamp_ns, std::uint64_t global_seqno, std::uint64_t line_seqno)
+        : ts_ns(timestamp_ns), global_seq(global_seqno), line_seq(line_seqno), line(offset), kind(type) {}
+
+    event_type type() const { return kind; }
+    std::uint64_t timestamp_ns() const { return ts_ns; }
+    unsigned int line_offset() const { return line; }
+    std::uint64_t global_seqno() const { return global_seq; }
+    std::uint64_t line_seqno() const { return line_seq; }
+
+private:
+    std::uint64_t ts_ns{0};
+    std::uint64_t global_seq{0};
+    std::uint64_t line_seq{0};
+    unsigned int line{0};
+    event_type kind{event_type::RISING_EDGE};
+};
+
+// Fixed capacity buffer that read_edge_events() fills. Make it once and reuse it, reading never allocates.
+class edge_event_buffer {
+public:
+    explicit edge_event_buffer(std::size_t capacity = 64) : events(capacity) {}
+
+    std::size_t capacity() const { return events.size(); }
+    std::size_t num_events() const { return count; }
+    const edge_event& get_event(std::size_t index) const { return events[index]; }
+
+    const edge_event* begin() const { return events.data(); }
+    const edge_event* end() const { return events.data() + count; }
+
+private:
+    friend class line_request;
+
+    std::vector<edge_event> events;
+    std::size_t count{0};
+};
+
+/*
+A set of lines owned by one consumer, like gpiod::line_request.
+
+set_values() takes bitmasks instead of vectors: bit i means offsets()[i]. The kernel's uAPI works the same way
+(at most 64 lines per request) so one set_values() call is always exactly one ioctl on real hardware.
+*/
+class line_request {
+public:
+    virtual ~line_request() = default;
+
+    const std::vector<unsigned int>& offsets() const { return line_offsets; }
+    std::size_t num_lines() const { return line_offsets.size(); }
+
+    // The mask bit for an offset in this request.
+    std::uint64_t line_bit(unsigned int offset) const {
+        for (std::size_t i = 0; i < line_offsets.size(); i++) {
+            if (line_offsets[i] == offset) {
+                return 1ull << i;
+            }
+        }
+        throw std::system_error(EINVAL, std::generic_category(), "offset " + std::to_string(offset) + " is not part of this request");
+    }
+
+    value get_value(unsigned int offset) { return do_get_value(offset); }
+
+    // The debounce period the chip really applies to a line, 0 if it doesn't debounce it (then you have to).
+    std::chrono::microseconds debounce_period(unsigned int offset) const {
+        std::uint64_t bit = line_bit(offset);
+        std::size_t index = static_cast<std::size_t>(__builtin_ctzll(bit));
+        return index < line_debounce.size() ? line_debounce[index] : std::chrono::microseconds(0);
+    }
+
+    void set_value(unsigned int offset, value new_value) {
+        write_calls++;
+        do_set_value(offset, new_value);
+    }
+
+    // Sets every line in mask to the matching bit in bits, all in one call.
+    void set_values(std::uint64_t mask, std::uint64_t bits) {
+        write_calls++;
+        do_set_values(mask, bits);
+    }
+
+    // Number of set_value()/set_values() calls made, on hardware that's the number of ioctls.
+    std::uint64_t write_count() const { return write_calls; }
+
+    // The file descriptor becomes readable when edge events are waiting, you can poll/epoll it yourself.
+    virtual int fd() const = 0;
+
+    bool wait_edge_events(std::chrono::nanoseconds timeout) const {
+        pollfd pfd{fd(), POLLIN, 0};
+        timespec ts{static_cast<time_t>(timeout.count() / 1000000000), static_cast<long>(timeout.count() % 1000000000)};
+        int ready = ppoll(&pfd, 1, timeout.count() < 0 ? nullptr : &ts, nullptr);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return false;
+            }
+            throw std::system_error(errno, std::generic_category(), "waiting for edge events failed");
+        }
+        return ready > 0;
+    }
+
+    std::size_t read_edge_events(edge_event_buffer& buffer) { return read_edge_events(buffer, buffer.capacity()); }
+
+    std::size_t read_edge_events(edge_event_buffer& buffer, std::size_t max_events) {
+        if (max_events > buffer.capacity()) {
+            max_events = buffer.capacity();
+        }
+        buffer.count = do_read_edge_events(buffer.events.data(), max_events);
+        return buffer.count;
+    }
+
+    virtual void release() = 0;
+
+protected:
+    virtual value do_get_value(unsigned int offset) = 0;
+    virtual void do_set_value(unsigned int offset, value new_value) = 0;
+    virtual void do_set_values(std::uint64_t mask, std::uint64_t bits) = 0;
+    virtual std::size_t do_read_edge_events(edge_event* events, std::size_t max_events) = 0;
+
+    std::vector<unsigned int> line_offsets;
+    std::vector<std::chrono::microseconds> line_debounce; // same order as line_offsets, empty if nothing is debounced
+
+private:
+    std::uint64_t write_calls{0};
+};
+
+class chip;
+
+// Collects line settings then asks the chip for the lines, same flow as gpiod::request_builder.
+class request_builder {
+public:
+    explicit request_builder(chip& owner) : owner(&owner) {}
+
+    request_builder& set_consumer(const std::string& consumer) { config.consumer = consumer; return *this; }
+    request_builder& set_event_buffer_size(std::size_t event_buffer_size) { config.event_buffer_size = event_buffer_size; return *this; }
+
+    // Adding the same offset again replaces its settings, just like libgpiod.
+    request_builder& add_line_settings(unsigned int offset, const line_settings& settings) {
+        for (auto& line : config.lines) {
+            if (line.first == offset) {
+                line.second = settings;
+                return *this;
+            }
+        }
+        config.lines.emplace_back(offset, settings);
+        return *this;
+    }
+
+    const request_config& get_config() const { return config; }
+
+    std::unique_ptr<line_request> do_request();
+
+private:
+    chip* owner;
+    request_config config;
+};
+
+class chip {
+public:
+    virtual ~chip() = default;
+
+    virtual std::string path() const = 0;
+    virtual std::string info() const = 0;
+
+    request_builder prepare_request() { return request_builder(*this); }
+    virtual std::unique_ptr<line_request> request_lines(const request_config& config) = 0;
+
+    virtual void close() {}
+};
+
+inline std::unique_ptr<line_request> request_builder::do_request() {
+    return owner->request_lines(config);
+}
+
+// Chips that let us play the part of the outside world (pressing buttons, reading what the LEDs would show).
+class sim_controls {
+public:
+    virtual ~sim_controls() = default;
+
+    virtual void set_input(unsigned int offset, bool level) = 0;
+    virtual bool output_value(unsigned int offset) = 0;
+};
+
+}
@@ -0,0 +1,758 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "edge_reader.hpp"
+#include "gpio_backend.hpp"
+#include "histogram.hpp"
+#include "reactor.hpp"
+
+/*
+One process owns the lines, any number of local processes use them.
+
+Only one process can request a line, so the led, monitor and sensor examples can't share the pi's button, and every
+one of them pays for setting up its own requests. Here a daemon (libgpiod-daemon) requests the lines once and:
+
+- publishes every edge event into a ring in shared memory. A client reads the events straight out of the ring, no
+  copy through a socket, and any number of clients can read the same events: each one just keeps its own position.
+- takes commands (set outputs, read values) from its clients over a Unix socket. Every command gets a reply, so a
+  failed write comes back to the client as an exception like it would from its own request.
+
+The shared memory is a memfd the daemon hands to every client over the socket (SCM_RIGHTS), together with an eventfd
+of the client's own that the daemon pokes after every batch of events. So a client can sleep on its eventfd in poll
+or a reactor like it would on a line request's fd.
+
+The daemon never waits for a client. The ring just keeps going, a client that falls more than RING_CAPACITY events
+behind loses the oldest ones and counts them (each slot carries a sequence number, so a client can tell a slot it
+was reading got overwritten under it: a seqlock).
+
+Every client has a stats slot in the shared memory too. The client records its delivery latency there (daemon
+publishing an event to the client reading it, and the edge's kernel timestamp to the read) plus how long its
+commands took, and the daemon prints all of them: per-client delivery latency measured where it happens, readable
+from one place.
+
+Clients and daemon have to be built from the same headers, the layout is checked on connect.
+*/
+namespace bus {
+
+constexpr const char* DEFAULT_SOCKET{"/tmp/gpiod-daemon.sock"};
+constexpr std::uint32_t MAGIC{0x47504942}; // "GPIB"
+constexpr std::uint32_t VERSION{1};
+constexpr std::size_t RING_CAPACITY{4096}; // events
+constexpr std::size_t MAX_CLIENTS{16};
+constexpr std::size_t MAX_LINES{64};       // offsets 0..63, so a set of lines is one 64-bit mask
+constexpr std::uint64_t ALL_LINES{~0ull};
+
+// The same atomics are used by two processes through the mapping, that only works if they don't hide a lock.
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared memory needs lock-free 64-bit atomics");
+
+// One published event. seq is 2n+1 while event n is being written and 2n+2 once it's complete.
+struct alignas(64) event_slot {
+    std::atomic<std::uint64_t> seq{0};
+    std::atomic<std::uint64_t> timestamp_ns{0};
+    std::atomic<std::uint64_t> global_seqno{0};
+    std::atomic<std::uint64_t> line_seqno{0};
+    std::atomic<std::uint64_t> line{0}; // offset << 1, plus 1 for a rising edge
+    std::atomic<std::uint64_t> published_ns{0};
+};
+
+// Written by one client, read by the daemon.
+struct client_stats {
+    std::atomic<std::uint32_t> in_use{0};
+    std::atomic<std::int32_t> pid{0};
+    std::atomic<std::uint64_t> received{0};
+    std::atomic<std::uint64_t> lost{0};     // overwritten before the client got to them
+    std::atomic<std::uint64_t> commands{0};
+    metrics::latency_histogram delivery;    // daemon published it -> client read it
+    metrics::latency_histogram edge_age;    // kernel timestamp -> client read it
+    metrics::latency_histogram round_trip;  // command sent -> reply received
+
+    void reset() {
+        received = 0;
+        lost = 0;
+        commands = 0;
+        delivery.reset();
+        edge_age.reset();
+        round_trip.reset();
+    }
+};
+
+struct shared_area {
+    std::uint32_t magic{0};
+    std::uint32_t version{0};
+    std::uint64_t size{0};
+    char chip[64]{};
+    std::uint32_t num_inputs{0};
+    std::uint32_t num_outputs{0};
+    std::uint32_t inputs[MAX_LINES]{};
+    std::uint32_t outputs[MAX_LINES]{};
+
+    alignas(64) std::atomic<std::uint64_t> published{0}; // events published so far, the next one goes in slot published % capacity
+    client_stats clients[MAX_CLIENTS];
+    event_slot ring[RING_CAPACITY];
+};
+
+// The socket protocol. One fixed-size command per packet (SOCK_SEQPACKET keeps them apart), one reply for each.
+enum class op : std::uint32_t { HELLO = 1, SET_VALUES, GET_VALUES, DRIVE_INPUT };
+
+struct command {
+    op kind{op::HELLO};
+    std::uint32_t reserved{0};
+    std::uint64_t mask{0}; // bit n is line offset n
+    std::uint64_t bits{0};
+    char name[32]{};       // HELLO: who's asking, for the daemon's reports
+};
+
+struct reply {
+    std::int32_t error{0}; // 0 or an errno
+    std::uint32_t slot{0}; // HELLO: the client's stats slot
+    std::uint64_t bits{0}; // GET_VALUES
+};
+
+namespace detail {
+
+inline std::uint64_t offset_bit(unsigned int offset) {
+    if (offset >= MAX_LINES) {
+        throw std::system_error(EINVAL, std::generic_category(), "the gpio daemon only serves offsets below 64, not " + std::to_string(offset));
+    }
+    return 1ull << offset;
+}
+
+inline sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "socket path " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Calls f(offset) for every bit set in mask.
+template <typename F>
+void for_each_offset(std::uint64_t mask, F f) {
+    while (mask) {
+        f(static_cast<unsigned int>(__builtin_ctzll(mask)));
+        mask &= mask - 1;
+    }
+}
+
+}
+
+/*
+The daemon's side. Publishes the edge events of inputs and carries out the commands of its clients, all from the
+reactor's thread. Either request can be null (a daemon that only watches, or only drives).
+*/
+struct server_options {
+    std::string socket_path{DEFAULT_SOCKET};
+    std::ostream* log{nullptr}; // clients connecting and leaving are reported here
+};
+
+class server {
+public:
+    server(events::reactor& loop, backend::chip& chip, backend::line_request* inputs, backend::line_request* outputs,
+           server_options settings = server_options())
+        : loop(&loop), gpio_chip(&chip), inputs(inputs), outputs(outputs), settings(std::move(settings)) {
+        map_area();
+        try {
+            listen_socket();
+        } catch (...) {
+            unmap_area();
+            throw;
+        }
+
+        if (inputs) {
+            reader = std::make_unique<events::edge_reader>(*inputs);
+            reader_fd = reader->fd();
+            loop.add(reader_fd, [this](std::uint32_t) { publish_ready(); });
+        }
+    }
+
+    ~server() {
+        while (!connections.empty()) {
+            drop(*connections.back());
+        }
+        if (reader) {
+            loop->remove(reader_fd); // the request may already be released, so not reader->fd()
+        }
+        loop->remove(listen_fd);
+        ::close(listen_fd);
+        unlink(settings.socket_path.c_str());
+        unmap_area();
+    }
+
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+    std::uint64_t published() const { return area->published.load(std::memory_order_relaxed); }
+    std::uint64_t commands() const { return handled_commands; }
+    std::size_t num_clients() const { return connections.size(); }
+    const std::string& socket_path() const { return settings.socket_path; }
+
+    // Edge events the kernel dropped before the daemon could read them (see edge_reader.hpp).
+    const events::edge_reader* edge_reader() const { return reader.get(); }
+
+    // "Client 0 (Thread 1, pid 1234): 120 events, 0 lost, 3 commands", then its latencies.
+    void print(std::ostream& out) const {
+        out << "Daemon: " << published() << " events published, " << handled_commands << " commands, "
+            << connections.size() << " clients" << '\n';
+        if (reader) {
+            reader->print(out, "Daemon");
+        }
+        for (const auto& c : connections) {
+            print_client(out, *c);
+        }
+    }
+
+private:
+    struct connection {
+        int fd{-1};
+        int wake_fd{-1};
+        int slot{-1};
+        pid_t pid{0};
+        std::string name;
+    };
+
+    void map_area() {
+        memory_fd = memfd_create("gpiod-daemon", MFD_CLOEXEC);
+        if (memory_fd < 0 || ftruncate(memory_fd, sizeof(shared_area)) < 0) {
+            int error = errno;
+            if (memory_fd >= 0) {
+                ::close(memory_fd);
+            }
+            throw std::system_error(error, std::generic_category(), "can't create the daemon's shared memory");
+        }
+        void* mapped = mmap(nullptr, sizeof(shared_area), PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+        if (mapped == MAP_FAILED) {
+            int error = errno;
+            ::close(memory_fd);
+            throw std::system_error(error, std::generic_category(), "can't map the daemon's shared memory");
+        }
+        area = new (mapped) shared_area();
+        area->magic = MAGIC;
+        area->version = VERSION;
+        area->size = sizeof(shared_area);
+        std::strncpy(area->chip, gpio_chip->path().c_str(), sizeof(area->chip) - 1);
+        if (inputs) {
+            area->num_inputs = copy_offsets(*inputs, area->inputs);
+        }
+        if (outputs) {
+            area->num_outputs = copy_offsets(*outputs, area->outputs);
+        }
+    }
+
+    void unmap_area() {
+        if (area) {
+            area->~shared_area();
+            munmap(area, sizeof(shared_area));
+            area = nullptr;
+        }
+        if (memory_fd >= 0) {
+            ::close(memory_fd);
+            memory_fd = -1;
+        }
+    }
+
+    static std::uint32_t copy_offsets(const backend::line_request& lines, std::uint32_t* to) {
+        std::uint32_t count = 0;
+        for (unsigned int offset : lines.offsets()) {
+            detail::offset_bit(offset);
+            to[count++] = offset;
+        }
+        return count;
+    }
+
+    void listen_socket() {
+        sockaddr_un address = detail::socket_address(settings.socket_path);
+        listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the daemon's socket");
+        }
+        // a socket file left behind by a daemon that didn't get to clean up would make bind() fail.
+        unlink(settings.socket_path.c_str());
+        if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || listen(listen_fd, 16) < 0) {
+            int error = errno;
+            ::close(listen_fd);
+            throw std::system_error(error, std::generic_category(), "can't listen on " + settings.socket_path);
+        }
+        loop->add(listen_fd, [this](std::uint32_t) { accept_clients(); });
+    }
+
+    void accept_clients() {
+        int fd;
+        while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            connections.push_back(std::make_unique<connection>());
+            connection* c = connections.back().get();
+            c->fd = fd;
+
+            ucred peer{};
+            socklen_t length = sizeof(peer);
+            if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0) {
+                c->pid = peer.pid;
+            }
+            loop->add(fd, [this, c](std::uint32_t) { receive(*c); });
+        }
+    }
+
+    void receive(connection& c) {
+        command cmd;
+        while (true) {
+            ssize_t got = recv(c.fd, &cmd, sizeof(cmd), MSG_DONTWAIT);
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                return;
+            }
+            if (got <= 0) {
+                drop(c); // 0 means the client hung up
+                return;
+            }
+            if (got != sizeof(cmd)) {
+                answer(c, reply{EPROTO, 0, 0});
+                continue;
+            }
+            handle(c, cmd);
+        }
+    }
+
+    void handle(connection& c, const command& cmd) {
+        handled_commands++;
+        reply result;
+        try {
+            switch (cmd.kind) {
+                case op::HELLO: hello(c, cmd); return;
+                case op::SET_VALUES: set_values(cmd.mask, cmd.bits); break;
+                case op::GET_VALUES: result.bits = get_values(cmd.mask); break;
+                case op::DRIVE_INPUT: drive_inputs(cmd.mask, cmd.bits); break;
+                default: result.error = EINVAL; break;
+            }
+        } catch (const std::system_error& e) {
+            result.error = e.code().value();
+        }
+        answer(c, result);
+    }
+
+    void hello(connection& c, const command& cmd) {
+        c.name.assign(cmd.name, strnlen(cmd.name, sizeof(cmd.name)));
+        if (c.slot < 0) {
+            for (std::size_t slot = 0; slot < MAX_CLIENTS; slot++) {
+                if (!area->clients[slot].in_use.load(std::memory_order_relaxed)) {
+                    c.slot = static_cast<int>(slot);
+                    break;
+                }
+            }
+            if (c.slot < 0) {
+                answer(c, reply{EBUSY, 0, 0});
+                return;
+            }
+            client_stats& stats = area->clients[c.slot];
+            stats.reset();
+            stats.pid = c.pid;
+            stats.in_use = 1;
+            c.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (c.wake_fd < 0) {
+                int error = errno;
+                release_slot(c);
+                answer(c, reply{error, 0, 0});
+                return;
+            }
+        }
+
+        reply result{0, static_cast<std::uint32_t>(c.slot), 0};
+        int fds[2] = {memory_fd, c.wake_fd};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))]{};
+        iovec data{&result, sizeof(result)};
+        msghdr message{};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* passed = CMSG_FIRSTHDR(&message);
+        passed->cmsg_level = SOL_SOCKET;
+        passed->cmsg_type = SCM_RIGHTS;
+        passed->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(passed), fds, sizeof(fds));
+        ssize_t sent = sendmsg(c.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent != sizeof(result)) {
+            // without an answer the client waits in recvmsg() forever, so try a plain one.
+            int error = sent < 0 ? errno : EIO;
+            release_slot(c);
+            answer(c, reply{error, 0, 0});
+            return;
+        }
+
+        if (settings.log) {
+            *settings.log << "Client " << c.slot << " connected: " << c.name << " (pid " << c.pid << ")" << '\n';
+        }
+    }
+
+    void answer(connection& c, const reply& result) { send(c.fd, &result, sizeof(result), MSG_NOSIGNAL | MSG_DONTWAIT); }
+
+    // The stats slot and the eventfd go back, the client has to say hello again to get new ones.
+    void release_slot(connection& c) {
+        if (c.slot >= 0) {
+            area->clients[c.slot].in_use = 0;
+            c.slot = -1;
+        }
+        if (c.wake_fd >= 0) {
+            ::close(c.wake_fd);
+            c.wake_fd = -1;
+        }
+    }
+
+    void drop(connection& c) {
+        if (settings.log && c.slot >= 0) {
+            *settings.log << "Client " << c.slot << " left: ";
+            print_client(*settings.log, c);
+        }
+        release_slot(c);
+        loop->remove(c.fd);
+        ::close(c.fd);
+        connections.erase(std::find_if(connections.begin(), connections.end(), [&c](const std::unique_ptr<connection>& e) { return e.get() == &c; }));
+    }
+
+    void print_client(std::ostream& out, const connection& c) const {
+        if (c.slot < 0) {
+            return;
+        }
+        const client_stats& stats = area->clients[c.slot];
+        std::string label = "Client " + std::to_string(c.slot);
+        out << label << " (" << c.name << ", pid " << c.pid << "): " << stats.received.load() << " events, "
+            << stats.lost.load() << " lost, " << stats.commands.load() << " commands" << '\n';
+        if (stats.delivery.count()) {
+            out << label << " delivery: " << stats.delivery.summary_us() << '\n';
+            out << label << " edge to client: " << stats.edge_age.summary_us() << '\n';
+        }
+        if (stats.round_trip.count()) {
+            out << label << " command round trip: " << stats.round_trip.summary_us() << '\n';
+        }
+    }
+
+    void publish_ready() {
+        std::uint64_t now = backend::monotonic_ns();
+        std::uint64_t next = area->published.load(std::memory_order_relaxed);
+        std::size_t got = reader->read([&](const backend::edge_event& event) {
+            event_slot& slot = area->ring[next & (RING_CAPACITY - 1)];
+            slot.seq.store(2 * next + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.timestamp_ns.store(event.timestamp_ns(), std::memory_order_relaxed);
+            slot.global_seqno.store(event.global_seqno(), std::memory_order_relaxed);
+            slot.line_seqno.store(event.line_seqno(), std::memory_order_relaxed);
+            slot.line.store(std::uint64_t{event.line_offset()} << 1 | (event.type() == backend::edge_event::event_type::RISING_EDGE),
+                            std::memory_order_relaxed);
+            slot.published_ns.store(now, std::memory_order_relaxed);
+            slot.seq.store(2 * next + 2, std::memory_order_release);
+            next++;
+        });
+        if (!got) {
+            return;
+        }
+        // the whole batch becomes visible at once, and every client is woken once for it.
+        area->published.store(next, std::memory_order_release);
+        for (const auto& c : connections) {
+            if (c->wake_fd >= 0) {
+                eventfd_write(c->wake_fd, 1);
+            }
+        }
+    }
+
+    static bool serves(const backend::line_request* lines, unsigned int offset) {
+        return lines && std::find(lines->offsets().begin(), lines->offsets().end(), offset) != lines->offsets().end();
+    }
+
+    void set_values(std::uint64_t mask, std::uint64_t bits) {
+        if (!outputs) {
+            throw std::system_error(EPERM, std::generic_category(), "the daemon has no outputs");
+        }
+        std::uint64_t request_mask = 0;
+        std::uint64_t request_bits = 0;
+        detail::for_each_offset(mask, [&](unsigned int offset) {
+            std::uint64_t bit = outputs->line_bit(offset);
+            request_mask |= bit;
+            request_bits |= (bits & (1ull << offset)) ? bit : 0;
+        });
+        outputs->set_values(request_mask, request_bits);
+    }
+
+    std::uint64_t get_values(std::uint64_t mask) {
+        std::uint64_t bits = 0;
+        detail::for_each_offset(mask, [&](unsigned int offset) {
+            backend::line_request* lines = serves(outputs, offset) ? outputs : inputs;
+            if (!serves(lines, offset)) {
+                throw std::system_error(EINVAL, std::generic_category(), "the daemon doesn't serve line " + std::to_string(offset));
+            }
+            bits |= lines->get_value(offset) == backend::value::ACTIVE ? (1ull << offset) : 0;
+        });
+        return bits;
+    }
+
+    // Only on simulated chips: plays the outside world for a client (e.g. a benchmark pressing buttons).
+    void drive_inputs(std::uint64_t mask, std::uint64_t bits) {
+        auto* sim = dynamic_cast<backend::sim_controls*>(gpio_chip);
+        if (!sim) {
+            throw std::system_error(ENOTSUP, std::generic_category(), "the daemon's chip isn't simulated");
+        }
+        detail::for_each_offset(mask, [&](unsigned int offset) { sim->set_input(offset, bits & (1ull << offset)); });
+    }
+
+    events::reactor* loop;
+    backend::chip* gpio_chip;
+    backend::line_request* inputs;
+    backend::line_request* outputs;
+    server_options settings;
+
+    int memory_fd{-1};
+    shared_area* area{nullptr};
+    int listen_fd{-1};
+    std::unique_ptr<events::edge_reader> reader;
+    int reader_fd{-1};
+    std::vector<std::unique_ptr<connection>> connections;
+    std::uint64_t handled_commands{0};
+};
+
+/*
+A client's side: one connection to the daemon, with its own position in the event ring. Use it from one thread.
+
+  bus::client daemon(bus::DEFAULT_SOCKET, "my-program");
+  std::vector<backend::edge_event> events(64);
+  while (daemon.wait(std::chrono::seconds(1))) {
+      std::size_t got = daemon.read(events.data(), events.size());
+      ...
+  }
+  daemon.set_value(5, true);
+
+Only events published after connecting are seen. backend::daemon_chip (gpio_daemon.hpp) wraps this in the usual
+chip/line_request interface so the examples can run through the daemon without changes.
+*/
+class client {
+public:
+    explicit client(const std::string& socket_path = DEFAULT_SOCKET, const std::string& name = "client") {
+        try {
+            connect_to(socket_path, name);
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    ~client() { close(); }
+
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+
+    void close() {
+        if (area) {
+            munmap(area, sizeof(shared_area));
+            area = nullptr;
+        }
+        if (wake_fd >= 0) {
+            ::close(wake_fd);
+            wake_fd = -1;
+        }
+        if (sock >= 0) {
+            ::close(sock);
+            sock = -1;
+        }
+    }
+
+    // Readable when there are events to read, for poll/epoll/a reactor.
+    int fd() const { return wake_fd; }
+
+    const std::vector<unsigned int>& inputs() const { return input_offsets; }
+    const std::vector<unsigned int>& outputs() const { return output_offsets; }
+    std::string chip() const { return area->chip; }
+
+    bool pending() const {
+        check_open();
+        return cursor < area->published.load(std::memory_order_acquire);
+    }
+
+    bool wait(std::chrono::nanoseconds timeout) const {
+        if (pending()) {
+            return true;
+        }
+        pollfd pfd{wake_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()));
+        return ready > 0 || pending();
+    }
+
+    /*
+    Copies up to max_events of the events waiting into events and returns how many. Only events of lines in
+    rising_lines (rising edges) or falling_lines (falling edges) are returned, the others are skipped.
+    fd() stays readable as long as events are left, same as a line request's.
+    */
+    std::size_t read(backend::edge_event* events, std::size_t max_events, std::uint64_t rising_lines = ALL_LINES,
+                     std::uint64_t falling_lines = ALL_LINES) {
+        check_open();
+        eventfd_t ignored;
+        eventfd_read(wake_fd, &ignored);
+
+        std::uint64_t published = area->published.load(std::memory_order_acquire);
+        std::uint64_t now = backend::monotonic_ns();
+        std::size_t count = 0;
+        while (count < max_events && cursor < published) {
+            if (published - cursor > RING_CAPACITY) {
+                stats->lost.fetch_add(published - RING_CAPACITY - cursor, std::memory_order_relaxed);
+                cursor = published - RING_CAPACITY;
+            }
+
+            std::uint64_t at = cursor++;
+            const event_slot& slot = area->ring[at & (RING_CAPACITY - 1)];
+            std::uint64_t before = slot.seq.load(std::memory_order_acquire);
+            std::uint64_t timestamp = slot.timestamp_ns.load(std::memory_order_relaxed);
+            std::uint64_t global_seqno = slot.global_seqno.load(std::memory_order_relaxed);
+            std::uint64_t line_seqno = slot.line_seqno.load(std::memory_order_relaxed);
+            std::uint64_t line = slot.line.load(std::memory_order_relaxed);
+            std::uint64_t published_at = slot.published_ns.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t after = slot.seq.load(std::memory_order_relaxed);
+
+            // the daemon went round the ring and wrote over the slot while we were reading it.
+            if (before != after || before != 2 * at + 2) {
+                stats->lost.fetch_add(1, std::memory_order_relaxed);
+                published = area->published.load(std::memory_order_acquire);
+                continue;
+            }
+
+            unsigned int offset = static_cast<unsigned int>(line >> 1);
+            bool rising = line & 1;
+            if (offset >= MAX_LINES || !((rising ? rising_lines : falling_lines) & (1ull << offset))) {
+                continue;
+            }
+            events[count++] = backend::edge_event(rising ? backend::edge_event::event_type::RISING_EDGE : backend::edge_event::event_type::FALLING_EDGE,
+                                                  offset, timestamp, global_seqno, line_seqno);
+            stats->delivery.record(now > published_at ? now - published_at : 0);
+            stats->edge_age.record(now > timestamp ? now - timestamp : 0);
+        }
+        stats->received.fetch_add(count, std::memory_order_relaxed);
+
+        if (pending()) {
+            eventfd_write(wake_fd, 1);
+        }
+        return count;
+    }
+
+    // Masks here are by line offset (bit 5 is line 5), not by position in a request.
+    void set_values(std::uint64_t mask, std::uint64_t bits) { call(command{op::SET_VALUES, 0, mask, bits, {}}); }
+    void set_value(unsigned int offset, bool level) { set_values(detail::offset_bit(offset), level ? ALL_LINES : 0); }
+    std::uint64_t get_values(std::uint64_t mask) { return call(command{op::GET_VALUES, 0, mask, 0, {}}).bits; }
+    bool get_value(unsigned int offset) { return get_values(detail::offset_bit(offset)) != 0; }
+
+    // Only if the daemon runs on a simulated chip.
+    void drive_input(unsigned int offset, bool level) {
+        call(command{op::DRIVE_INPUT, 0, detail::offset_bit(offset), level ? ALL_LINES : 0, {}});
+    }
+
+    const client_stats& stats_slot() const { return *stats; }
+    std::uint64_t received() const { return stats->received.load(std::memory_order_relaxed); }
+    std::uint64_t lost() const { return stats->lost.load(std::memory_order_relaxed); }
+
+private:
+    void check_open() const {
+        if (!area) {
+            throw std::system_error(EBADF, std::generic_category(), "the connection to the gpio daemon was closed");
+        }
+    }
+
+    void connect_to(const std::string& socket_path, const std::string& name) {
+        sockaddr_un address = detail::socket_address(socket_path);
+        sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (sock < 0 || connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't connect to the gpio daemon at " + socket_path);
+        }
+
+        command hello{};
+        hello.kind = op::HELLO;
+        std::strncpy(hello.name, name.c_str(), sizeof(hello.name) - 1);
+        if (send(sock, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+            throw std::system_error(errno, std::generic_category(), "can't talk to the gpio daemon");
+        }
+
+        reply result;
+        int fds[2] = {-1, -1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))]{};
+        iovec data{&result, sizeof(result)};
+        msghdr message{};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t got;
+        while ((got = recvmsg(sock, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+        if (got != sizeof(result)) {
+            throw std::system_error(got < 0 ? errno : ECONNRESET, std::generic_category(), "the gpio daemon didn't answer");
+        }
+        if (result.error) {
+            throw std::system_error(result.error, std::generic_category(), "the gpio daemon turned us away");
+        }
+        cmsghdr* passed = CMSG_FIRSTHDR(&message);
+        if (!passed || passed->cmsg_type != SCM_RIGHTS || passed->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            throw std::system_error(EPROTO, std::generic_category(), "the gpio daemon didn't send its shared memory");
+        }
+        std::memcpy(fds, CMSG_DATA(passed), sizeof(fds));
+        wake_fd = fds[1];
+
+        // the mapping stays valid after the memfd is closed.
+        void* mapped = mmap(nullptr, sizeof(shared_area), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        int error = errno;
+        ::close(fds[0]);
+        if (mapped == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(), "can't map the gpio daemon's shared memory");
+        }
+        area = static_cast<shared_area*>(mapped);
+        if (area->magic != MAGIC || area->version != VERSION || area->size != sizeof(shared_area) || result.slot >= MAX_CLIENTS) {
+            throw std::system_error(EPROTO, std::generic_category(), "the gpio daemon was built from different headers");
+        }
+
+        stats = &area->clients[result.slot];
+        input_offsets.assign(area->inputs, area->inputs + std::min<std::size_t>(area->num_inputs, MAX_LINES));
+        output_offsets.assign(area->outputs, area->outputs + std::min<std::size_t>(area->num_outputs, MAX_LINES));
+        cursor = area->published.load(std::memory_order_acquire);
+    }
+
+    reply call(const command& cmd) {
+        std::uint64_t sent = backend::monotonic_ns();
+        if (send(sock, &cmd, sizeof(cmd), MSG_NOSIGNAL) != sizeof(cmd)) {
+            throw std::system_error(errno, std::generic_category(), "can't talk to the gpio daemon");
+        }
+        reply result;
+        ssize_t got;
+        while ((got = recv(sock, &result, sizeof(result), 0)) < 0 && errno == EINTR) {}
+        if (got != sizeof(result)) {
+            throw std::system_error(got < 0 ? errno : ECONNRESET, std::generic_category(), "the gpio daemon went away");
+        }
+        stats->round_trip.record(backend::monotonic_ns() - sent);
+        stats->commands.fetch_add(1, std::memory_order_relaxed);
+        if (result.error) {
+            throw std::system_error(result.error, std::generic_category(), "the gpio daemon refused the command");
+        }
+        return result;
+    }
+
+    int sock{-1};
+    int wake_fd{-1};
+    shared_area* area{nullptr};
+    client_stats* stats{nullptr};
+    std::uint64_t cursor{0};
+    std::vector<unsigned int> input_offsets;
+    std::vector<unsigned int> output_offsets;
+};
+
+}
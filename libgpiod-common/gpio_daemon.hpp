@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "gpio_backend.hpp"
+#include "gpio_bus.hpp"
+
+/*
+Lines borrowed from the gpio daemon (libgpiod-daemon, see gpio_bus.hpp) instead of requested from a chip.
+
+To the example code it's a chip like any other: open_chip("daemon"), build a request, read edge events, set values.
+Behind it every line request is a connection to the daemon. Edge events come out of the daemon's shared-memory
+ring, writes go over its socket. So the monitor and sensor examples can watch the same button at the same time,
+which two processes can't do with real line requests.
+
+The daemon decides how the lines are set up (bias, debouncing, event buffer, CLOCK_MONOTONIC timestamps). A request
+can only have lines the daemon serves: outputs among its outputs, everything else among its inputs. Edge detection is
+applied here, a line requested for falling edges only never sees the rising ones.
+*/
+namespace backend {
+
+class daemon_line_request : public line_request {
+public:
+    daemon_line_request(const std::string& socket_path, const request_config& config)
+        : daemon(socket_path, config.consumer.empty() ? "line request" : config.consumer) {
+        for (const auto& line : config.lines) {
+            if (line.second.timestamp_clock != event_clock::MONOTONIC) {
+                throw std::system_error(ENOTSUP, std::generic_category(), "the gpio daemon's events are stamped with CLOCK_MONOTONIC");
+            }
+            const std::vector<unsigned int>& served = line.second.line_direction == direction::OUTPUT ? daemon.outputs() : daemon.inputs();
+            if (std::find(served.begin(), served.end(), line.first) == served.end()) {
+                throw std::system_error(EINVAL, std::generic_category(), "the gpio daemon doesn't serve line " + std::to_string(line.first) +
+                                        (line.second.line_direction == direction::OUTPUT ? " as an output" : " as an input"));
+            }
+            line_offsets.push_back(line.first);
+
+            edge wanted = line.second.edge_detection;
+            std::uint64_t bit = bus::detail::offset_bit(line.first);
+            rising_lines |= wanted == edge::RISING || wanted == edge::BOTH ? bit : 0;
+            falling_lines |= wanted == edge::FALLING || wanted == edge::BOTH ? bit : 0;
+        }
+    }
+
+    ~daemon_line_request() override { release(); }
+
+    int fd() const override { return daemon.fd(); }
+
+    void release() override { daemon.close(); }
+
+    // This request's connection, for its delivery stats.
+    const bus::client& connection() const { return daemon; }
+
+protected:
+    value do_get_value(unsigned int offset) override {
+        line_bit(offset);
+        return daemon.get_value(offset) ? value::ACTIVE : value::INACTIVE;
+    }
+
+    void do_set_value(unsigned int offset, value new_value) override {
+        line_bit(offset);
+        daemon.set_value(offset, new_value == value::ACTIVE);
+    }
+
+    // Request bits (bit i is offsets()[i]) to the daemon's bits (bit n is line n).
+    void do_set_values(std::uint64_t mask, std::uint64_t bits) override {
+        std::uint64_t line_mask = 0;
+        std::uint64_t line_bits = 0;
+        bus::detail::for_each_offset(mask, [&](unsigned int index) {
+            if (index >= line_offsets.size()) {
+                return;
+            }
+            std::uint64_t bit = 1ull << line_offsets[index];
+            line_mask |= bit;
+            line_bits |= (bits & (1ull << index)) ? bit : 0;
+        });
+        daemon.set_values(line_mask, line_bits);
+    }
+
+    /*
+    The seqnos count from when the daemon requested the lines, not from when we connected. Counted from our first
+    event instead, so a client that connects late doesn't think it missed everything before. Gaps after that (events
+    the kernel or the ring dropped) still show.
+    */
+    std::size_t do_read_edge_events(edge_event* events, std::size_t max_events) override {
+        std::size_t count = daemon.read(events, max_events, rising_lines, falling_lines);
+        for (std::size_t i = 0; i < count; i++) {
+            const edge_event& event = events[i];
+            std::uint64_t bit = 1ull << event.line_offset();
+            if (!seen_lines) {
+                global_base = event.global_seqno() - 1;
+            }
+            if (!(seen_lines & bit)) {
+                line_bases[event.line_offset()] = event.line_seqno() - 1;
+                seen_lines |= bit;
+            }
+            events[i] = edge_event(event.type(), event.line_offset(), event.timestamp_ns(), event.global_seqno() - global_base,
+                                   event.line_seqno() - line_bases[event.line_offset()]);
+        }
+        return count;
+    }
+
+private:
+    bus::client daemon;
+    std::uint64_t rising_lines{0};
+    std::uint64_t falling_lines{0};
+    std::uint64_t seen_lines{0}; // lines we've had an event of
+    std::uint64_t global_base{0};
+    std::array<std::uint64_t, bus::MAX_LINES> line_bases{};
+};
+
+class daemon_chip : public chip, public sim_controls {
+public:
+    explicit daemon_chip(std::string socket_path = bus::DEFAULT_SOCKET)
+        : socket(std::move(socket_path)), control(socket, "chip") {}
+
+    std::string path() const override { return "daemon:" + socket; }
+
+    std::string info() const override {
+        std::ostringstream out;
+        out << "gpio daemon at " << socket << " serving " << control.chip() << " (inputs " << to_string(control.inputs())
+            << ", outputs " << to_string(control.outputs()) << ")";
+        return out.str();
+    }
+
+    std::unique_ptr<line_request> request_lines(const request_config& config) override {
+        return std::make_unique<daemon_line_request>(socket, config);
+    }
+
+    void close() override { control.close(); }
+
+    // Only works if the daemon runs on a simulated chip, otherwise the daemon says no (ENOTSUP).
+    void set_input(unsigned int offset, bool level) override { control.drive_input(offset, level); }
+    bool output_value(unsigned int offset) override { return control.get_value(offset); }
+
+private:
+    std::string socket;
+    bus::client control;
+};
+
+}
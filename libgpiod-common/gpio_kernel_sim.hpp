@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gpio_libgpiod.hpp"
+
+/*
+A real gpiochip made by the kernel's gpio-sim module (CONFIG_GPIO_SIM), driven through libgpiod like the pi is.
+
+This is the closest you can get to hardware without hardware: requests, edge events and ioctls all go through the
+actual kernel code paths. Inputs are "pressed" by changing the simulated pull through sysfs.
+
+Needs root, the gpio-sim module loaded (modprobe gpio-sim) and configfs mounted at /sys/kernel/config.
+The chip is created when this object is made and torn down again when it's destroyed.
+*/
+namespace backend {
+
+class gpio_sim_device {
+public:
+    gpio_sim_device(unsigned int num_lines, const std::string& name) : device_dir("/sys/kernel/config/gpio-sim/" + name) {
+        make_dir(device_dir);
+        make_dir(device_dir + "/bank0");
+        write_file(device_dir + "/bank0/num_lines", std::to_string(num_lines));
+        write_file(device_dir + "/live", "1");
+
+        chip_name = read_file(device_dir + "/bank0/chip_name");
+        sysfs_dir = "/sys/devices/platform/" + read_file(device_dir + "/dev_name") + "/" + chip_name;
+    }
+
+    ~gpio_sim_device() {
+        std::ofstream(device_dir + "/live") << "0";
+        rmdir((device_dir + "/bank0").c_str());
+        rmdir(device_dir.c_str());
+    }
+
+    gpio_sim_device(const gpio_sim_device&) = delete;
+    gpio_sim_device& operator=(const gpio_sim_device&) = delete;
+
+    std::string dev_path() const { return "/dev/" + chip_name; }
+
+    void set_pull(unsigned int offset, bool pull_up) {
+        write_file(line_dir(offset) + "/pull", pull_up ? "pull-up" : "pull-down");
+    }
+
+    bool read_value(unsigned int offset) { return read_file(line_dir(offset) + "/value") == "1"; }
+
+private:
+    std::string line_dir(unsigned int offset) const { return sysfs_dir + "/sim_gpio" + std::to_string(offset); }
+
+    static void make_dir(const std::string& path) {
+        if (mkdir(path.c_str(), 0755) < 0) {
+            throw std::system_error(errno, std::generic_category(), "gpio-sim: can't create " + path);
+        }
+    }
+
+    static void write_file(const std::string& path, const std::string& contents) {
+        std::ofstream file(path);
+        if (!(file << contents << std::flush)) {
+            throw std::system_error(EIO, std::generic_category(), "gpio-sim: can't write " + path);
+        }
+    }
+
+    static std::string read_file(const std::string& path) {
+        std::ifstream file(path);
+        std::string contents;
+        if (!std::getline(file, contents)) {
+            throw std::system_error(EIO, std::generic_category(), "gpio-sim: can't read " + path);
+        }
+        return contents;
+    }
+
+    std::string device_dir;
+    std::string chip_name;
+    std::string sysfs_dir;
+};
+
+// "blinker-<pid>-<n>", so one process can make as many of them as it wants (one per shard, for example).
+inline std::string next_sim_device_name() {
+    static std::atomic<unsigned int> made{0};
+    return "blinker-" + std::to_string(getpid()) + "-" + std::to_string(made++);
+}
+
+// gpio_sim_device comes first in the base list so the chip exists before libgpiod_chip opens it,
+// and so it's torn down only after libgpiod_chip has let go of it.
+class kernel_sim_chip : private gpio_sim_device, public libgpiod_chip, public sim_controls {
+public:
+    explicit kernel_sim_chip(unsigned int num_lines = 64, const std::string& name = next_sim_device_name())
+        : gpio_sim_device(num_lines, name), libgpiod_chip(dev_path()) {}
+
+    void set_input(unsigned int offset, bool level) override { set_pull(offset, level); }
+    bool output_value(unsigned int offset) override { return read_value(offset); }
+};
+
+}
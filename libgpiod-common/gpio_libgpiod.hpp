@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <sstream>
+
+#include <gpiod.hpp> // library originally for C so you need to include .hpp version of it
+
+#include "gpio_backend.hpp"
+
+/*
+The real backend, everything here just forwards to libgpiod.
+This is the one to use on the pi: backend::open_chip("/dev/gpiochip0").
+*/
+namespace backend {
+
+class libgpiod_line_request : public line_request {
+public:
+    libgpiod_line_request(gpiod::line_request&& request, const request_config& config, std::size_t event_capacity)
+        : request(std::move(request)), buffer(event_capacity) {
+        for (const auto& offset : this->request.offsets()) {
+            line_offsets.push_back(offset);
+
+            // the kernel debounces any input line it's asked to (in software if the gpio controller can't).
+            line_debounce.emplace_back(0);
+            for (const auto& line : config.lines) {
+                if (line.first == offset && line.second.line_direction == direction::INPUT) {
+                    line_debounce.back() = line.second.debounce;
+                }
+            }
+        }
+        scratch_offsets.reserve(line_offsets.size());
+        scratch_values.reserve(line_offsets.size());
+    }
+
+    int fd() const override { return request.fd(); }
+
+    void release() override {
+        if (request) {
+            request.release();
+        }
+    }
+
+protected:
+    value do_get_value(unsigned int offset) override {
+        return request.get_value(offset) == gpiod::line::value::ACTIVE ? value::ACTIVE : value::INACTIVE;
+    }
+
+    void do_set_value(unsigned int offset, value new_value) override {
+        request.set_value(offset, new_value == value::ACTIVE ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+    }
+
+    void do_set_values(std::uint64_t mask, std::uint64_t bits) override {
+        // the scratch vectors keep their capacity so this doesn't allocate after the first call.
+        scratch_offsets.clear();
+        scratch_values.clear();
+        for (std::uint64_t todo = mask; todo; todo &= todo - 1) {
+            std::size_t index = static_cast<std::size_t>(__builtin_ctzll(todo));
+            scratch_offsets.push_back(line_offsets.at(index));
+            scratch_values.push_back((bits >> index) & 1 ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+        }
+        request.set_values(scratch_offsets, scratch_values);
+    }
+
+    std::size_t do_read_edge_events(edge_event* events, std::size_t max_events) override {
+        std::size_t read = request.read_edge_events(buffer, std::min(max_events, buffer.capacity()));
+        for (std::size_t i = 0; i < read; i++) {
+            const gpiod::edge_event& event = buffer.get_event(static_cast<unsigned int>(i));
+            events[i] = edge_event(event.type() == gpiod::edge_event::event_type::RISING_EDGE ? edge_event::event_type::RISING_EDGE
+                                                                                             : edge_event::event_type::FALLING_EDGE,
+                                   event.line_offset(), event.timestamp_ns(), event.global_seqno(), event.line_seqno());
+        }
+        return read;
+    }
+
+private:
+    gpiod::line_request request;
+    gpiod::edge_event_buffer buffer;
+    gpiod::line::offsets scratch_offsets;
+    gpiod::line::values scratch_values;
+};
+
+class libgpiod_chip : public chip {
+public:
+    explicit libgpiod_chip(const std::string& path) : handle(path), chip_path(path) {}
+
+    std::string path() const override { return chip_path; }
+
+    std::string info() const override {
+        std::ostringstream out;
+        out << handle.get_info();
+        return out.str();
+    }
+
+    std::unique_ptr<line_request> request_lines(const request_config& config) override {
+        gpiod::request_builder builder = handle.prepare_request();
+        builder.set_consumer(config.consumer);
+        if (config.event_buffer_size) {
+            builder.set_event_buffer_size(config.event_buffer_size);
+        }
+
+        for (const auto& line : config.lines) {
+            builder.add_line_settings(line.first, to_gpiod(line.second));
+        }
+
+        // our copy of the events is only as big as the kernel queue could ever hand us in one read.
+        std::size_t event_capacity = config.event_buffer_size ? config.event_buffer_size : 16 * config.lines.size();
+        return std::make_unique<libgpiod_line_request>(builder.do_request(), config, std::max<std::size_t>(event_capacity, 64));
+    }
+
+    void close() override { handle.close(); }
+
+private:
+    static gpiod::line_settings to_gpiod(const line_settings& settings) {
+        gpiod::line_settings converted;
+
+        converted.set_direction(settings.line_direction == direction::OUTPUT ? gpiod::line::direction::OUTPUT : gpiod::line::direction::INPUT);
+        converted.set_output_value(settings.output_value == value::ACTIVE ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+
+        switch (settings.edge_detection) {
+            case edge::NONE: converted.set_edge_detection(gpiod::line::edge::NONE); break;
+            case edge::RISING: converted.set_edge_detection(gpiod::line::edge::RISING); break;
+            case edge::FALLING: converted.set_edge_detection(gpiod::line::edge::FALLING); break;
+            case edge::BOTH: converted.set_edge_detection(gpiod::line::edge::BOTH); break;
+        }
+
+        switch (settings.line_bias) {
+            case bias::AS_IS: converted.set_bias(gpiod::line::bias::AS_IS); break;
+            case bias::DISABLED: converted.set_bias(gpiod::line::bias::DISABLED); break;
+            case bias::PULL_UP: converted.set_bias(gpiod::line::bias::PULL_UP); break;
+            case bias::PULL_DOWN: converted.set_bias(gpiod::line::bias::PULL_DOWN); break;
+        }
+
+        switch (settings.timestamp_clock) {
+            case event_clock::MONOTONIC: converted.set_event_clock(gpiod::line::clock::MONOTONIC); break;
+            case event_clock::REALTIME: converted.set_event_clock(gpiod::line::clock::REALTIME); break;
+            case event_clock::HTE: converted.set_event_clock(gpiod::line::clock::HTE); break;
+        }
+
+        if (settings.line_direction == direction::INPUT && settings.debounce.count() > 0) {
+            converted.set_debounce_period(settings.debounce);
+        }
+
+        return converted;
+    }
+
+    gpiod::chip handle;
+    std::string chip_path;
+};
+
+}
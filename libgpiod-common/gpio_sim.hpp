@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "gpio_backend.hpp"
+
+/*
+An in-process simulated gpiochip. No kernel, no hardware, no root.
+
+It behaves like a real chip where it matters for the examples:
+- a line can only be owned by one request at a time (EBUSY otherwise)
+- input lines with edge detection queue edge events with timestamps and seqnos
+- the queue has a fixed size and drops the oldest event when it overflows, like the kernel does
+- fd() is an eventfd that is readable while events are queued, so poll/epoll work on it
+- it can't debounce (debounce_period() is always 0), like a chip without debounce support
+
+On top of that you can play the outside world: drive inputs (set_input), inject edges with your own timestamps
+(inject_edge), play toggle patterns, square waves or a turning quadrature encoder on a background thread
+(play_pattern, play_square_wave, play_quadrature), wire an output straight into an input (connect) and watch every
+output write (on_output).
+
+The chip has to outlive the requests it hands out.
+*/
+namespace backend {
+
+class sim_line_request;
+
+class sim_chip : public chip, public sim_controls {
+public:
+    using output_hook = std::function<void(unsigned int offset, bool level, std::uint64_t timestamp_ns)>;
+
+    explicit sim_chip(unsigned int num_lines = 64, std::string label = "sim") : lines(num_lines), label(std::move(label)) {}
+    ~sim_chip() override { wait_patterns(); }
+
+    std::string path() const override { return "sim:" + label; }
+
+    std::string info() const override {
+        std::ostringstream out;
+        out << label << " [in-process simulator] (" << lines.size() << " lines)";
+        return out.str();
+    }
+
+    std::unique_ptr<line_request> request_lines(const request_config& config) override;
+
+    void set_input(unsigned int offset, bool level) override {
+        std::lock_guard<std::mutex> guard(lock);
+        drive_locked(check_offset(offset), level, monotonic_ns());
+    }
+
+    bool output_value(unsigned int offset) override {
+        std::lock_guard<std::mutex> guard(lock);
+        return lines[check_offset(offset)].level;
+    }
+
+    // Queue an edge with a made up timestamp. Handy for pushing a lot of events through without sleeping.
+    void inject_edge(unsigned int offset, edge_event::event_type type, std::uint64_t timestamp_ns) {
+        std::lock_guard<std::mutex> guard(lock);
+        drive_locked(check_offset(offset), type == edge_event::event_type::RISING_EDGE, timestamp_ns, true);
+    }
+
+    // Anything written to output also drives input (a wire between two header pins).
+    void connect(unsigned int output, unsigned int input) {
+        std::lock_guard<std::mutex> guard(lock);
+        lines[check_offset(output)].wired_to = static_cast<int>(check_offset(input));
+    }
+
+    // Called after every output change. Set it up before the lines are in use.
+    void on_output(output_hook hook) { output_changed = std::move(hook); }
+
+    // Toggle an input once per interval on a background thread, intervals are measured from absolute deadlines.
+    void play_pattern(unsigned int offset, std::vector<std::chrono::nanoseconds> intervals) {
+        check_offset(offset);
+        pattern_threads.emplace_back([this, offset, intervals = std::move(intervals)]() {
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            for (const auto& interval : intervals) {
+                if (stopping) {
+                    break;
+                }
+                long long nsec = deadline.tv_nsec + interval.count();
+                deadline.tv_sec += nsec / 1000000000;
+                deadline.tv_nsec = nsec % 1000000000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+                std::lock_guard<std::mutex> guard(lock);
+                drive_locked(offset, !lines[offset].level, monotonic_ns());
+            }
+        });
+    }
+
+    /*
+    A square wave on an input for `length`: a rising edge frequency_hz times a second, high for `duty` (0..1) of each
+    period. The background thread wakes up once a millisecond and queues the edges that fell in it with their exact
+    timestamps (like inject_edge), so it goes far past what one wake-up per edge could, and measurements can be
+    checked against the exact frequency and duty cycle.
+    */
+    void play_square_wave(unsigned int offset, double frequency_hz, double duty, std::chrono::nanoseconds length) {
+        check_offset(offset);
+        pattern_threads.emplace_back([this, offset, frequency_hz, duty, length]() {
+            const double period_ns = 1e9 / frequency_hz;
+            const std::uint64_t start = monotonic_ns();
+            const std::uint64_t end = start + static_cast<std::uint64_t>(length.count());
+            std::uint64_t cycle = 0;
+            bool high = false;
+
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            while (!stopping) {
+                long long nsec = deadline.tv_nsec + 1000000;
+                deadline.tv_sec += nsec / 1000000000;
+                deadline.tv_nsec = nsec % 1000000000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+                std::uint64_t now = std::min(monotonic_ns(), end);
+                std::lock_guard<std::mutex> guard(lock);
+                while (true) {
+                    double next = high ? static_cast<double>(cycle) + duty : static_cast<double>(cycle);
+                    std::uint64_t edge_ns = start + static_cast<std::uint64_t>(next * period_ns);
+                    if (edge_ns > now) {
+                        break;
+                    }
+                    drive_locked(offset, !high, edge_ns, true);
+                    cycle += high ? 1 : 0;
+                    high = !high;
+                }
+                if (now >= end) {
+                    break;
+                }
+            }
+        });
+    }
+
+    /*
+    A quadrature encoder turning at counts_per_second for `length`, negative turns it backwards. Forwards a and b go
+    00, 10, 11, 01 (a is ahead of b) and every count is one edge, starting from whatever levels the lines have.
+    Queued once a millisecond with exact timestamps like play_square_wave. Plays exactly
+    floor(length * |counts_per_second|) counts.
+    */
+    void play_quadrature(unsigned int a, unsigned int b, double counts_per_second, std::chrono::nanoseconds length) {
+        check_offset(a);
+        check_offset(b);
+        pattern_threads.emplace_back([this, a, b, counts_per_second, length]() {
+            // the next state (a << 1 | b) going forwards and backwards.
+            static constexpr unsigned int FORWARDS[4]{2, 0, 3, 1};
+            static constexpr unsigned int BACKWARDS[4]{1, 3, 0, 2};
+            const double period_ns = 1e9 / std::abs(counts_per_second);
+            const std::uint64_t start = monotonic_ns();
+            const std::uint64_t end = start + static_cast<std::uint64_t>(length.count());
+            std::uint64_t count = 1;
+
+            timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            while (!stopping) {
+                long long nsec = deadline.tv_nsec + 1000000;
+                deadline.tv_sec += nsec / 1000000000;
+                deadline.tv_nsec = nsec % 1000000000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+
+                std::uint64_t now = std::min(monotonic_ns(), end);
+                std::lock_guard<std::mutex> guard(lock);
+                while (true) {
+                    std::uint64_t edge_ns = start + static_cast<std::uint64_t>(static_cast<double>(count) * period_ns);
+                    if (edge_ns > now) {
+                        break;
+                    }
+                    unsigned int state = (lines[a].level ? 2u : 0u) | (lines[b].level ? 1u : 0u);
+                    unsigned int next = counts_per_second > 0 ? FORWARDS[state] : BACKWARDS[state];
+                    if ((state ^ next) & 2) {
+                        drive_locked(a, next & 2, edge_ns);
+                    } else {
+                        drive_locked(b, next & 1, edge_ns);
+                    }
+                    count++;
+                }
+                if (now >= end) {
+                    break;
+                }
+            }
+        });
+    }
+
+    void wait_patterns() {
+        for (auto& pattern : pattern_threads) {
+            pattern.join();
+        }
+        pattern_threads.clear();
+    }
+
+    // Ends every pattern and square wave early.
+    void stop_patterns() {
+        stopping = true;
+        wait_patterns();
+        stopping = false;
+    }
+
+    // How many times each kind of write reached the chip (every one of these would be an ioctl on hardware).
+    std::uint64_t set_value_calls() const { return single_writes; }
+    std::uint64_t set_values_calls() const { return batch_writes; }
+
+private:
+    friend class sim_line_request;
+
+    struct line_state {
+        bool level{false};
+        int wired_to{-1};
+        sim_line_request* owner{nullptr};
+    };
+
+    unsigned int check_offset(unsigned int offset) const {
+        if (offset >= lines.size()) {
+            throw std::system_error(EINVAL, std::generic_category(), "offset " + std::to_string(offset) + " is out of range for " + label);
+        }
+        return offset;
+    }
+
+    void drive_locked(unsigned int offset, bool level, std::uint64_t timestamp_ns, bool always_edge = false);
+    void write_outputs(sim_line_request& request, std::uint64_t mask, std::uint64_t bits, bool batched);
+    void release_lines(sim_line_request& request);
+
+    std::mutex lock;
+    std::vector<line_state> lines;
+    std::string label;
+    output_hook output_changed;
+    std::vector<std::thread> pattern_threads;
+    std::atomic<bool> stopping{false};
+    std::uint64_t single_writes{0};
+    std::uint64_t batch_writes{0};
+};
+
+class sim_line_request : public line_request {
+public:
+    sim_line_request(sim_chip& owner, const request_config& config) : owner(&owner) {
+        for (const auto& line : config.lines) {
+            if (line.second.timestamp_clock == event_clock::HTE) {
+                throw std::system_error(ENOTSUP, std::generic_category(), "the simulated chip has no hardware timestamp engine");
+            }
+            line_offsets.push_back(line.first);
+            settings.push_back(line.second);
+        }
+        line_seqnos.assign(line_offsets.size(), 0);
+
+        // CLOCK_REALTIME - CLOCK_MONOTONIC, taken once (setting the time after the request doesn't move its timestamps).
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        realtime_offset_ns = static_cast<std::uint64_t>(now.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(now.tv_nsec) - monotonic_ns();
+
+        // the kernel default is 16 events per line.
+        std::size_t queue_size = config.event_buffer_size ? config.event_buffer_size : 16 * line_offsets.size();
+        queue.resize(std::max<std::size_t>(queue_size, 1));
+
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "eventfd failed");
+        }
+    }
+
+    ~sim_line_request() override { release(); }
+
+    int fd() const override { return event_fd; }
+
+    void release() override {
+        if (owner) {
+            owner->release_lines(*this);
+            owner = nullptr;
+            ::close(event_fd);
+            event_fd = -1;
+        }
+    }
+
+    // Events lost because the queue was full when they came in.
+    std::uint64_t overflow_count() const { return overflows; }
+
+protected:
+    value do_get_value(unsigned int offset) override {
+        check_owner();
+        std::lock_guard<std::mutex> guard(owner->lock);
+        line_bit(offset);
+        return owner->lines[offset].level ? value::ACTIVE : value::INACTIVE;
+    }
+
+    void do_set_value(unsigned int offset, value new_value) override {
+        check_owner();
+        std::uint64_t bit = line_bit(offset);
+        owner->write_outputs(*this, bit, new_value == value::ACTIVE ? bit : 0, false);
+    }
+
+    void do_set_values(std::uint64_t mask, std::uint64_t bits) override {
+        check_owner();
+        owner->write_outputs(*this, mask, bits, true);
+    }
+
+    std::size_t do_read_edge_events(edge_event* events, std::size_t max_events) override {
+        check_owner();
+        std::lock_guard<std::mutex> guard(owner->lock);
+
+        std::size_t read = 0;
+        while (read < max_events && queued > 0) {
+            events[read++] = queue[head];
+            head = (head + 1) % queue.size();
+            queued--;
+        }
+
+        // like the kernel, fd() stays readable for as long as something is left in the queue.
+        if (queued == 0) {
+            eventfd_t drained;
+            eventfd_read(event_fd, &drained);
+        }
+        return read;
+    }
+
+private:
+    friend class sim_chip;
+
+    void check_owner() const {
+        if (!owner) {
+            throw std::system_error(EBADF, std::generic_category(), "line request was released");
+        }
+    }
+
+    std::size_t index_of(unsigned int offset) const {
+        return static_cast<std::size_t>(__builtin_ctzll(line_bit(offset)));
+    }
+
+    // Called with the chip lock held.
+    void push_event(std::size_t index, bool rising, std::uint64_t timestamp_ns) {
+        const line_settings& line = settings[index];
+        bool wanted = line.edge_detection == edge::BOTH ||
+                      (rising && line.edge_detection == edge::RISING) ||
+                      (!rising && line.edge_detection == edge::FALLING);
+        if (!wanted) {
+            return;
+        }
+
+        // timestamps come in on CLOCK_MONOTONIC, lines that asked for wall clock time get them moved over.
+        if (line.timestamp_clock == event_clock::REALTIME) {
+            timestamp_ns += realtime_offset_ns;
+        }
+
+        edge_event event(rising ? edge_event::event_type::RISING_EDGE : edge_event::event_type::FALLING_EDGE,
+                         line_offsets[index], timestamp_ns, ++global_seqno, ++line_seqnos[index]);
+
+        if (queued == queue.size()) {
+            head = (head + 1) % queue.size();
+            queued--;
+            overflows++;
+        }
+        queue[(head + queued) % queue.size()] = event;
+        if (queued++ == 0) {
+            eventfd_write(event_fd, 1);
+        }
+    }
+
+    sim_chip* owner;
+    std::vector<line_settings> settings;
+    std::vector<std::uint64_t> line_seqnos;
+    std::uint64_t global_seqno{0};
+    std::uint64_t realtime_offset_ns{0};
+
+    std::vector<edge_event> queue;
+    std::size_t head{0};
+    std::size_t queued{0};
+    std::uint64_t overflows{0};
+
+    int event_fd{-1};
+};
+
+inline std::unique_ptr<line_request> sim_chip::request_lines(const request_config& config) {
+    if (config.lines.empty() || config.lines.size() > 64) {
+        throw std::system_error(EINVAL, std::generic_category(), "a request needs between 1 and 64 lines");
+    }
+
+    auto request = std::make_unique<sim_line_request>(*this, config);
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& line : config.lines) {
+        if (lines[check_offset(line.first)].owner) {
+            // the guard unlocks first, then the request's destructor hands back whatever we claimed so far.
+            throw std::system_error(EBUSY, std::generic_category(), "line " + std::to_string(line.first) + " is already requested");
+        }
+        lines[line.first].owner = request.get();
+    }
+
+    // apply the initial state: outputs take their output value, pulled inputs settle to the pull.
+    for (const auto& line : config.lines) {
+        line_state& state = lines[line.first];
+        if (line.second.line_direction == direction::OUTPUT) {
+            state.level = line.second.output_value == value::ACTIVE;
+        } else if (line.second.line_bias == bias::PULL_UP) {
+            state.level = true;
+        } else if (line.second.line_bias == bias::PULL_DOWN) {
+            state.level = false;
+        }
+    }
+    return request;
+}
+
+inline void sim_chip::drive_locked(unsigned int offset, bool level, std::uint64_t timestamp_ns, bool always_edge) {
+    line_state& state = lines[offset];
+    if (state.level == level && !always_edge) {
+        return;
+    }
+    state.level = level;
+
+    if (state.owner) {
+        sim_line_request& request = *state.owner;
+        std::size_t index = request.index_of(offset);
+        if (request.settings[index].line_direction == direction::INPUT) {
+            request.push_event(index, level, timestamp_ns);
+        }
+    }
+}
+
+inline void sim_chip::write_outputs(sim_line_request& request, std::uint64_t mask, std::uint64_t bits, bool batched) {
+    std::uint64_t changed = 0;
+    std::uint64_t timestamp_ns;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        timestamp_ns = monotonic_ns();
+
+        for (std::uint64_t todo = mask; todo; todo &= todo - 1) {
+            std::size_t index = static_cast<std::size_t>(__builtin_ctzll(todo));
+            if (index >= request.line_offsets.size() || request.settings[index].line_direction != direction::OUTPUT) {
+                throw std::system_error(EPERM, std::generic_category(), "can only set values on output lines");
+            }
+        }
+        (batched ? batch_writes : single_writes)++;
+
+        for (std::uint64_t todo = mask; todo; todo &= todo - 1) {
+            std::size_t index = static_cast<std::size_t>(__builtin_ctzll(todo));
+            unsigned int offset = request.line_offsets[index];
+            bool level = (bits >> index) & 1;
+
+            if (lines[offset].level != level) {
+                changed |= 1ull << index;
+            }
+            lines[offset].level = level;
+            if (lines[offset].wired_to >= 0) {
+                drive_locked(static_cast<unsigned int>(lines[offset].wired_to), level, timestamp_ns);
+            }
+        }
+    }
+
+    if (output_changed) {
+        for (std::uint64_t todo = changed; todo; todo &= todo - 1) {
+            std::size_t index = static_cast<std::size_t>(__builtin_ctzll(todo));
+            output_changed(request.line_offsets[index], (bits >> index) & 1, timestamp_ns);
+        }
+    }
+}
+
+inline void sim_chip::release_lines(sim_line_request& request) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto& state : lines) {
+        if (state.owner == &request) {
+            state.owner = nullptr;
+        }
+    }
+}
+
+}
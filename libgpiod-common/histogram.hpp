@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+A log-bucket histogram for nanosecond timings.
+
+Values are bucketed by their highest set bit plus the next 3 bits below it, so every bucket is at most 12.5% wide
+from 1ns all the way up to centuries. That's plenty to read a p99 off and it's a fixed 512 counters, so recording
+is a couple of instructions and never allocates.
+
+Every counter is a relaxed atomic: one thread can record while another reads percentiles out of it.
+
+line_latencies keeps one of them per GPIO line, e.g. how long each output took to react to the edge that caused it.
+*/
+namespace metrics {
+
+class latency_histogram {
+public:
+    static constexpr unsigned int SUB_BITS{3};
+    static constexpr std::size_t NUM_BUCKETS{64 << SUB_BITS};
+
+    void record(std::uint64_t value_ns) {
+        buckets[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(value_ns, std::memory_order_relaxed);
+
+        std::uint64_t seen = smallest.load(std::memory_order_relaxed);
+        while (value_ns < seen && !smallest.compare_exchange_weak(seen, value_ns, std::memory_order_relaxed)) {}
+        seen = largest.load(std::memory_order_relaxed);
+        while (value_ns > seen && !largest.compare_exchange_weak(seen, value_ns, std::memory_order_relaxed)) {}
+    }
+
+    std::uint64_t count() const { return samples.load(std::memory_order_relaxed); }
+    std::uint64_t min() const { return count() ? smallest.load(std::memory_order_relaxed) : 0; }
+    std::uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+    std::uint64_t mean() const { return count() ? total.load(std::memory_order_relaxed) / count() : 0; }
+
+    // p is 0..100. Returns the upper edge of the bucket the percentile falls in (capped at the max seen).
+    std::uint64_t percentile(double p) const {
+        std::uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        std::uint64_t wanted = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(n - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+            seen += buckets[bucket].load(std::memory_order_relaxed);
+            if (seen >= wanted) {
+                return std::min(upper_edge(bucket), max());
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        samples.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        smallest.store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+        largest.store(0, std::memory_order_relaxed);
+    }
+
+    // "min/p50/p99/p99.9/max" in microseconds, for printing.
+    std::string summary_us() const {
+        auto us = [](std::uint64_t ns) { return std::to_string(ns / 1000) + "." + std::to_string(ns % 1000 / 100); };
+        return "min " + us(min()) + "us, p50 " + us(percentile(50)) + "us, p99 " + us(percentile(99)) + "us, p99.9 " +
+               us(percentile(99.9)) + "us, max " + us(max()) + "us";
+    }
+
+private:
+    static std::size_t bucket_of(std::uint64_t value) {
+        if (value < (1u << SUB_BITS)) {
+            return static_cast<std::size_t>(value);
+        }
+        unsigned int top_bit = 63 - static_cast<unsigned int>(__builtin_clzll(value));
+        std::uint64_t sub = (value >> (top_bit - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+        return ((top_bit - SUB_BITS + 1) << SUB_BITS) + sub;
+    }
+
+    static std::uint64_t upper_edge(std::size_t bucket) {
+        if (bucket < (1u << SUB_BITS)) {
+            return bucket;
+        }
+        unsigned int top_bit = static_cast<unsigned int>(bucket >> SUB_BITS) + SUB_BITS - 1;
+        std::uint64_t sub = bucket & ((1u << SUB_BITS) - 1);
+        std::uint64_t lower = (1ull << top_bit) | (sub << (top_bit - SUB_BITS));
+        return lower + (1ull << (top_bit - SUB_BITS)) - 1;
+    }
+
+    std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> buckets{};
+    std::atomic<std::uint64_t> samples{0};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> smallest{std::numeric_limits<std::uint64_t>::max()};
+    std::atomic<std::uint64_t> largest{0};
+};
+
+// A histogram per line offset. track() every line before any thread starts recording, after that record() and
+// print() can be called from any thread.
+class line_latencies {
+public:
+    explicit line_latencies(unsigned int max_lines = 64) : lines(max_lines) {}
+
+    void track(unsigned int offset) {
+        if (offset < lines.size() && !lines[offset]) {
+            lines[offset] = std::make_unique<latency_histogram>();
+        }
+    }
+
+    // Lines that aren't tracked are ignored.
+    void record(unsigned int offset, std::uint64_t value_ns) {
+        if (offset < lines.size() && lines[offset]) {
+            lines[offset]->record(value_ns);
+        }
+    }
+
+    const latency_histogram* line(unsigned int offset) const { return offset < lines.size() ? lines[offset].get() : nullptr; }
+
+    // One line per tracked line: "<what> line 5: 120 samples, min ... max ...".
+    void print(std::ostream& out, const std::string& what) const {
+        for (std::size_t offset = 0; offset < lines.size(); offset++) {
+            if (lines[offset]) {
+                out << what << " line " << offset << ": " << lines[offset]->count() << " samples, " << lines[offset]->summary_us() << '\n';
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<latency_histogram>> lines;
+};
+
+}
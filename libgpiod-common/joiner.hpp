@@ -0,0 +1,42 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <utility>
+
+/*
+Stops and joins a thread however the scope around it is left.
+
+A std::thread that is still joinable when it's destroyed ends the whole program (std::terminate). In the examples
+that happens when something throws between starting a worker thread and joining it: the exception never reaches
+main's catch. A joiner made right after the thread tells it to stop (sets its flag, wakes it up) and joins it in its
+destructor, so the exception carries on as if the thread had never been there. join() does the same on the normal
+way out, and only once.
+
+std::jthread joins in its destructor too, but it asks the thread to stop through a stop_token, and the examples'
+threads sleep in epoll and poll on flags of their own.
+*/
+namespace threads {
+
+class joiner {
+public:
+    joiner(std::thread& thread, std::function<void()> stop) : thread(&thread), stop(std::move(stop)) {}
+
+    ~joiner() { join(); }
+
+    joiner(const joiner&) = delete;
+    joiner& operator=(const joiner&) = delete;
+
+    void join() {
+        if (thread->joinable()) {
+            stop();
+            thread->join();
+        }
+    }
+
+private:
+    std::thread* thread;
+    std::function<void()> stop;
+};
+
+}
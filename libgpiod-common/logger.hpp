@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "spsc_ring.hpp"
+
+/*
+Logging that doesn't hold up the thread doing the logging.
+
+std::cout formats the message right there and then writes it, and on a slow console (a serial line to the pi, or a
+terminal that's being scrolled) that write can take longer than whatever the loop was actually there to do.
+
+Here every thread that logs opens its own channel. A log call only stores a small binary record in the channel's
+ring (see spsc_ring.hpp): a timestamp, a pointer to the format string and the raw argument values. No formatting, no
+lock, no syscall. A background thread wakes up every flush_every, collects the records of all channels, puts them in
+timestamp order, formats them and writes them to the stream in one go.
+
+  logging::logger log(std::cout);
+  logging::channel& out = log.open_channel("Thread 3");
+  out.log("Button press after {} seconds ({}us late)", seconds, late_us);
+
+Every {} in the format is replaced by the next argument. Because only the pointer is stored, the format and any text
+arguments have to outlive the record: string literals. std::string arguments don't compile for that reason, numbers,
+bools, chars and literals do.
+
+Nothing is ever waited for:
+- A channel whose ring is full drops the new record and counts it (the flusher can't keep up).
+- The flusher writes at most lines_per_second (with bursts of up to burst lines), the rest is dropped and counted.
+  So a storm of messages can't turn into minutes of console output that's late anyway.
+Both show up in the output as a line saying how many messages were lost, and in dropped()/rate_limited().
+
+Each channel must only be written from one thread. Opening channels and the counters are fine from any thread.
+Writing to the same stream yourself while the logger runs works (std::cout is thread-safe) but your lines may end up
+between the logger's batches, stop() the logger first if the order matters.
+*/
+namespace logging {
+
+constexpr std::size_t MAX_ARGS{6};
+constexpr std::size_t CHANNEL_CAPACITY{1024}; // records, per channel
+
+struct options {
+    std::chrono::milliseconds flush_every{50};
+    double lines_per_second{200.0};
+    double burst{100.0};
+};
+
+// One log call, as it waits in a channel for the flusher.
+struct record {
+    enum class kind : std::uint8_t { INT, UINT, DOUBLE, BOOL, CHAR, TEXT };
+    union value {
+        std::int64_t i;
+        std::uint64_t u;
+        double d;
+        bool b;
+        char c;
+        const char* s;
+    };
+
+    std::uint64_t timestamp_ns;
+    const char* format;
+    std::uint8_t num_args;
+    kind kinds[MAX_ARGS];
+    value args[MAX_ARGS];
+};
+
+namespace detail {
+
+template <typename T>
+void store(record& r, std::size_t index, T arg) {
+    using type = std::decay_t<T>;
+    record::value& v = r.args[index];
+    record::kind& k = r.kinds[index];
+    if constexpr (std::is_same<type, bool>::value) {
+        k = record::kind::BOOL;
+        v.b = arg;
+    } else if constexpr (std::is_same<type, char>::value) {
+        k = record::kind::CHAR;
+        v.c = arg;
+    } else if constexpr (std::is_integral<type>::value && std::is_signed<type>::value) {
+        k = record::kind::INT;
+        v.i = static_cast<std::int64_t>(arg);
+    } else if constexpr (std::is_integral<type>::value || std::is_enum<type>::value) {
+        k = record::kind::UINT;
+        v.u = static_cast<std::uint64_t>(arg);
+    } else if constexpr (std::is_floating_point<type>::value) {
+        k = record::kind::DOUBLE;
+        v.d = static_cast<double>(arg);
+    } else {
+        static_assert(std::is_same<type, const char*>::value || std::is_same<type, char*>::value,
+                      "log arguments are numbers, bools, chars or string literals (only the pointer is stored)");
+        k = record::kind::TEXT;
+        v.s = arg;
+    }
+}
+
+inline void append(std::ostream& out, const record& r, std::size_t index) {
+    const record::value& v = r.args[index];
+    switch (r.kinds[index]) {
+        case record::kind::INT: out << v.i; break;
+        case record::kind::UINT: out << v.u; break;
+        case record::kind::DOUBLE: out << v.d; break;
+        case record::kind::BOOL: out << (v.b ? "true" : "false"); break;
+        case record::kind::CHAR: out << v.c; break;
+        case record::kind::TEXT: out << (v.s ? v.s : "(null)"); break;
+    }
+}
+
+// The format with every {} replaced by the next argument, and a newline.
+inline void format(std::ostream& out, const record& r) {
+    std::size_t next_arg = 0;
+    for (const char* c = r.format; *c; c++) {
+        if (c[0] == '{' && c[1] == '}' && next_arg < r.num_args) {
+            append(out, r, next_arg++);
+            c++;
+        } else {
+            out << *c;
+        }
+    }
+    out << '\n';
+}
+
+}
+
+class channel {
+public:
+    explicit channel(const std::string& name) : label(name) {}
+
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+
+    // Returns false if the record was dropped because the ring was full.
+    template <typename... Args>
+    bool log(const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        record r;
+        r.timestamp_ns = backend::monotonic_ns();
+        r.format = format;
+        r.num_args = static_cast<std::uint8_t>(sizeof...(Args));
+        std::size_t index = 0;
+        (detail::store(r, index++, args), ...);
+        return ring.push(r);
+    }
+
+    const std::string& name() const { return label; }
+    std::uint64_t dropped() const { return ring.dropped_count(); }
+
+private:
+    friend class logger;
+
+    rings::spsc_ring<record, CHANNEL_CAPACITY> ring{rings::backpressure::DROP_NEWEST};
+    std::string label;
+    std::uint64_t reported_drops{0}; // flusher side
+};
+
+class logger {
+public:
+    explicit logger(std::ostream& out, options settings = options())
+        : out(&out), settings(settings), tokens(settings.burst), refilled_at(backend::monotonic_ns()) {
+        flusher = std::thread([this]() { run(); });
+    }
+
+    ~logger() { stop(); }
+
+    logger(const logger&) = delete;
+    logger& operator=(const logger&) = delete;
+
+    // The channel lives as long as the logger does.
+    channel& open_channel(const std::string& name) {
+        std::lock_guard<std::mutex> lock(channels_lock);
+        channels.push_back(std::make_unique<channel>(name));
+        return *channels.back();
+    }
+
+    // Writes out whatever is still waiting and stops the background thread. Records logged after this are lost.
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        flusher.join();
+        drain();
+    }
+
+    std::uint64_t written() const { return lines_written.load(std::memory_order_relaxed); }
+    std::uint64_t rate_limited() const { return lines_limited.load(std::memory_order_relaxed); }
+
+    std::uint64_t dropped() const {
+        std::lock_guard<std::mutex> lock(channels_lock);
+        std::uint64_t total = 0;
+        for (const auto& c : channels) {
+            total += c->dropped();
+        }
+        return total;
+    }
+
+private:
+    struct pending_record {
+        record r;
+        std::size_t order; // keeps records with the same timestamp in the order they were logged
+    };
+
+    void run() {
+        timing::deadline_timer ticks;
+        while (running.load(std::memory_order_relaxed)) {
+            ticks.wait(settings.flush_every);
+            drain();
+        }
+    }
+
+    void drain() {
+        batch.clear();
+        text.str("");
+        {
+            std::lock_guard<std::mutex> lock(channels_lock);
+            for (auto& c : channels) {
+                record r;
+                while (c->ring.pop(r)) {
+                    batch.push_back(pending_record{r, batch.size()});
+                }
+                std::uint64_t drops = c->dropped();
+                if (drops != c->reported_drops) {
+                    text << "(" << drops - c->reported_drops << " log messages from " << c->name() << " dropped, the logger fell behind)" << '\n';
+                    c->reported_drops = drops;
+                }
+            }
+        }
+        std::sort(batch.begin(), batch.end(), [](const pending_record& a, const pending_record& b) {
+            return a.r.timestamp_ns != b.r.timestamp_ns ? a.r.timestamp_ns < b.r.timestamp_ns : a.order < b.order;
+        });
+
+        std::uint64_t now = backend::monotonic_ns();
+        tokens = std::min(settings.burst, tokens + static_cast<double>(now - refilled_at) / 1e9 * settings.lines_per_second);
+        refilled_at = now;
+
+        std::uint64_t limited = 0;
+        std::uint64_t written = 0;
+        for (const auto& p : batch) {
+            if (tokens < 1.0) {
+                limited++;
+                continue;
+            }
+            tokens -= 1.0;
+            detail::format(text, p.r);
+            written++;
+        }
+        if (limited) {
+            text << "(" << limited << " log messages dropped by the rate limit)" << '\n';
+        }
+        lines_written.fetch_add(written, std::memory_order_relaxed);
+        lines_limited.fetch_add(limited, std::memory_order_relaxed);
+
+        // the one place anything gets written, as one block.
+        if (text.tellp() > 0) {
+            *out << text.str();
+            out->flush();
+        }
+    }
+
+    std::ostream* out;
+    options settings;
+
+    mutable std::mutex channels_lock;
+    std::vector<std::unique_ptr<channel>> channels;
+
+    // flusher side
+    std::vector<pending_record> batch;
+    std::ostringstream text;
+    double tokens;
+    std::uint64_t refilled_at;
+
+    std::atomic<std::uint64_t> lines_written{0};
+    std::atomic<std::uint64_t> lines_limited{0};
+    std::atomic<bool> running{true};
+    std::thread flusher;
+};
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#include "edge_reader.hpp"
+#include "gpio_backend.hpp"
+
+/*
+Frequency, period, duty cycle and pulse width of signals on input lines, worked out from the kernel's edge
+timestamps.
+
+The sensor example times one echo pulse at a time, sleeping in between, which is fine at 40 measurements a second but
+nowhere near a 20kHz signal. At that rate the only thing that keeps up is reading edge events in big batches and
+doing as little as possible per event, so pulse_meter:
+
+- drains the request's queue through an events::edge_reader with reads of up to batch_size events (give the request
+  a big kernel buffer too, request_builder::set_event_buffer_size, up to 1024). It only reads again after a full
+  read if more is queued, so a read never blocks.
+- looks a line up by offset in a table and folds the edge into that line's running stats. Nothing is stored per
+  event and nothing is allocated after construction.
+- takes every time from the event's timestamp, never from when we got around to reading it, so how late the read is
+  doesn't matter. Only how many events the queue holds does.
+
+Per line, from BOTH edges:
+  period  rising edge to the next rising edge (falling to falling on lines that only report falling edges)
+  high    rising to falling edge, the pulse width
+  low     falling to rising edge
+  frequency = 1 / mean period, duty cycle = mean high / (mean high + mean low)
+
+Events the kernel dropped show up as gaps in line_seqno, which the edge_reader counts. They're counted as missed here
+too and the pulse in progress is thrown away, the next complete one starts fresh. The same goes for a timestamp going backwards (with the REALTIME
+event clock when the time is set) and two edges of the same kind in a row on a line that reports both, which is a
+pulse too short for the controller. Those are counted as glitches.
+
+Timestamps come in whatever clock the lines asked for (line_settings::set_event_clock). Durations are the same in all
+of them, but HTE (a hardware timestamp engine) stamps the edge itself instead of the interrupt and gets rid of most
+of the jitter.
+
+take_reports() hands out the stats since the last call and starts over, a pulse in progress carries over. Use it
+from the thread that drains.
+*/
+namespace pulses {
+
+// Count, mean, spread and extremes of a stream of durations without keeping them (Welford's algorithm).
+struct running_stats {
+    std::uint64_t count{0};
+    double mean_ns{0.0};
+    double m2{0.0};
+    std::uint64_t min_ns{0};
+    std::uint64_t max_ns{0};
+
+    void add(std::uint64_t ns) {
+        count++;
+        double delta = static_cast<double>(ns) - mean_ns;
+        mean_ns += delta / static_cast<double>(count);
+        m2 += delta * (static_cast<double>(ns) - mean_ns);
+        min_ns = count == 1 ? ns : std::min(min_ns, ns);
+        max_ns = std::max(max_ns, ns);
+    }
+
+    double stddev_ns() const { return count > 1 ? std::sqrt(m2 / static_cast<double>(count - 1)) : 0.0; }
+};
+
+struct line_report {
+    unsigned int offset{0};
+    std::uint64_t edges{0};
+    std::uint64_t missed{0};   // dropped by the kernel (seqno gaps)
+    std::uint64_t glitches{0}; // timestamps going backwards, the same edge twice in a row
+    running_stats period;
+    running_stats high;
+    running_stats low;
+
+    double frequency_hz() const { return period.count ? 1e9 / period.mean_ns : 0.0; }
+    double duty_cycle() const { return high.count && low.count ? high.mean_ns / (high.mean_ns + low.mean_ns) : 0.0; }
+};
+
+class pulse_meter {
+public:
+    explicit pulse_meter(backend::line_request& lines, std::size_t batch_size = 1024)
+        : reader(lines, events::reader_options{batch_size, batch_size, batch_size, 1024}) {
+        for (unsigned int offset : lines.offsets()) {
+            if (offset >= line_by_offset.size()) {
+                line_by_offset.resize(offset + 1, -1);
+            }
+            line_by_offset[offset] = static_cast<int>(states.size());
+            states.emplace_back();
+            states.back().report.offset = offset;
+        }
+    }
+
+    // Readable while events are queued, for a reactor.
+    int fd() const { return reader.fd(); }
+
+    // Reads until the queue is empty. Returns how many events that was.
+    std::size_t drain() {
+        drains++;
+        return reader.read([this](const backend::edge_event& event) { add(event); });
+    }
+
+    void add(const backend::edge_event& event) {
+        unsigned int offset = event.line_offset();
+        if (offset >= line_by_offset.size() || line_by_offset[offset] < 0) {
+            return;
+        }
+        line_state& line = states[static_cast<std::size_t>(line_by_offset[offset])];
+        line_report& report = line.report;
+        std::uint64_t now = event.timestamp_ns();
+        bool rising = event.type() == backend::edge_event::event_type::RISING_EDGE;
+        report.edges++;
+        total_events++;
+
+        // the reader checked the seqno before handing the event over. The first event has nothing to be compared to:
+        // the request may have queued events before we came along.
+        std::uint64_t dropped = reader.dropped(offset);
+        if (line.has_seqno && dropped != line.dropped_seen) {
+            report.missed += dropped - line.dropped_seen;
+            line.resync();
+        }
+        line.dropped_seen = dropped;
+        line.has_seqno = true;
+
+        bool out_of_step = line.seen_rising && line.seen_falling && line.last_was_rising == rising;
+        if ((line.has_edge && now < line.last_edge_ns) || (line.has_edge && out_of_step)) {
+            report.glitches++;
+            line.resync();
+        }
+
+        // the last edge was the other kind, so it started the pulse (or gap) that ends now.
+        bool ends_pulse = line.has_edge && line.last_was_rising != rising;
+        if (rising) {
+            if (line.has_rise) {
+                report.period.add(now - line.last_rise_ns);
+            }
+            if (ends_pulse) {
+                report.low.add(now - line.last_fall_ns);
+            }
+            line.last_rise_ns = now;
+            line.has_rise = true;
+            line.seen_rising = true;
+        } else {
+            if (!line.seen_rising && line.has_fall) {
+                report.period.add(now - line.last_fall_ns);
+            }
+            if (ends_pulse) {
+                report.high.add(now - line.last_rise_ns);
+            }
+            line.last_fall_ns = now;
+            line.has_fall = true;
+            line.seen_falling = true;
+        }
+        line.last_edge_ns = now;
+        line.last_was_rising = rising;
+        line.has_edge = true;
+    }
+
+    // Stats since the last call, then start over.
+    std::vector<line_report> take_reports() {
+        std::vector<line_report> taken;
+        for (line_state& line : states) {
+            taken.push_back(line.report);
+            line.report = line_report();
+            line.report.offset = taken.back().offset;
+        }
+        return taken;
+    }
+
+    std::uint64_t events() const { return total_events; }
+    // drain() calls, and the most events one of them read.
+    std::uint64_t drain_calls() const { return drains; }
+    std::size_t largest_burst() const { return reader.largest_burst(); }
+
+    static void print(const std::vector<line_report>& reports, std::ostream& out) {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        for (const line_report& report : reports) {
+            out << "Line " << report.offset << ": " << std::fixed << std::setprecision(1) << report.frequency_hz() << "Hz, duty "
+                << 100.0 * report.duty_cycle() << "%, period " << report.period.mean_ns / 1000.0 << "us (+-"
+                << report.period.stddev_ns() / 1000.0 << "us, " << report.period.min_ns / 1000.0 << ".." << report.period.max_ns / 1000.0
+                << "us), high " << report.high.mean_ns / 1000.0 << "us (" << report.high.min_ns / 1000.0 << ".."
+                << report.high.max_ns / 1000.0 << "us), " << report.edges << " edges, " << report.missed << " missed, "
+                << report.glitches << " glitches" << '\n';
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    struct line_state {
+        line_report report;
+        std::uint64_t dropped_seen{0}; // the reader's drop count for the line when we last looked
+        bool has_seqno{false};         // dropped_seen is good
+        std::uint64_t last_edge_ns{0};
+        std::uint64_t last_rise_ns{0};
+        std::uint64_t last_fall_ns{0};
+        bool has_edge{false}; // last_edge_ns and last_was_rising are good
+        bool has_rise{false}; // last_rise_ns is good
+        bool has_fall{false}; // last_fall_ns is good
+        bool last_was_rising{false};
+        bool seen_rising{false};
+        bool seen_falling{false};
+
+        // forget the pulse in progress, the next edge starts over.
+        void resync() { has_edge = has_rise = has_fall = false; }
+    };
+
+    events::edge_reader reader;
+    std::vector<int> line_by_offset;
+    std::vector<line_state> states;
+    std::uint64_t total_events{0};
+    std::uint64_t drains{0};
+};
+
+}
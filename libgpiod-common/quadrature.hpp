@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "edge_reader.hpp"
+#include "gpio_backend.hpp"
+
+/*
+Quadrature encoders: position and speed of a motor shaft from two lines, A and B.
+
+The two lines are square waves a quarter of a cycle apart. Turning forwards A is ahead of B and the pair goes
+00 -> 10 -> 11 -> 01 -> 00 (A, B), backwards it goes the other way round. Every edge on either line is one count, so
+an encoder with 600 lines a revolution gives 2400 counts.
+
+Every line of every encoder is requested with BOTH edges (request_encoders() does that). An edge event says which
+line changed and to which level, so with the pair's last state that's the new state, and a 16 entry table indexed by
+old and new state says what happened: +1, -1, or invalid. Invalid is the line "changing" to the level it already had.
+That means an edge went missing in between (the kernel dropped it, or a pulse was too short for the controller), so
+the count is off by an unknown amount. It's counted instead of guessed at. Seqno gaps (dropped events, counted by
+the events::edge_reader the queue is read through) are counted as missed.
+
+Speed comes from the event timestamps, not from when we read them: counts moved over at least velocity_window of edge
+time, divided by that time. When a shaft goes slow enough that edges are further apart than the window, that's
+simply one count over the time between two edges. With no edge for stop_after settle() (call it from a timer) says
+it stopped, so anything slower than a count per stop_after reads as standing still.
+
+All encoders of a request are decoded on one thread, the queue drained in batches. After each batch every encoder
+that moved publishes a snapshot (position, velocity, edge counts) behind a seqlock. read() gets a consistent snapshot
+from any thread without locks and without ever holding up the decoding thread: it retries if the decoder wrote the
+snapshot while it was being copied.
+
+Add the encoders before draining or handing the decoder to other threads.
+*/
+namespace quadrature {
+
+struct options {
+    std::chrono::microseconds velocity_window{10000};
+    std::chrono::microseconds stop_after{100000};
+    std::size_t batch_size{1024};
+};
+
+struct snapshot {
+    std::int64_t position{0};      // counts, forwards is up
+    double velocity{0.0};          // counts per second
+    std::uint64_t last_edge_ns{0}; // timestamp of the last edge
+    std::uint64_t edges{0};
+    std::uint64_t invalid{0};      // transitions the table doesn't allow, an edge went missing
+    std::uint64_t missed{0};       // edges the kernel dropped (seqno gaps)
+};
+
+struct pins {
+    unsigned int a;
+    unsigned int b;
+};
+
+// Both lines of every encoder as inputs with both edges, pulled up (encoders are usually open collector), with the
+// largest event buffer the kernel gives out.
+inline std::unique_ptr<backend::line_request> request_encoders(backend::chip& chip, const std::vector<pins>& encoders,
+                                                               const std::string& consumer, backend::event_clock clock = backend::event_clock::MONOTONIC) {
+    backend::request_builder builder = chip.prepare_request();
+    builder.set_consumer(consumer);
+    builder.set_event_buffer_size(1024);
+    backend::line_settings settings = backend::line_settings().set_edge_detection(backend::edge::BOTH).set_bias(backend::bias::PULL_UP).set_event_clock(clock);
+    for (const pins& encoder : encoders) {
+        builder.add_line_settings(encoder.a, settings);
+        builder.add_line_settings(encoder.b, settings);
+    }
+    return builder.do_request();
+}
+
+class decoder {
+public:
+    static constexpr int INVALID{2};
+
+    // TRANSITIONS[old << 2 | new], states are A << 1 | B.
+    static constexpr int TRANSITIONS[16]{
+        //     00       01       10       11    <- new
+        INVALID,      -1,      +1, INVALID, // 00
+             +1, INVALID, INVALID,      -1, // 01
+             -1, INVALID, INVALID,      +1, // 10
+        INVALID,      +1,      -1, INVALID, // 11
+    };
+
+    explicit decoder(backend::line_request& lines, options settings = options())
+        : lines(&lines), settings(settings),
+          reader(lines, events::reader_options{settings.batch_size, settings.batch_size, settings.batch_size, 1024}) {}
+
+    decoder(const decoder&) = delete;
+    decoder& operator=(const decoder&) = delete;
+
+    // Both lines have to be inputs with edge::BOTH in the request. Starts from the levels they have now.
+    // Returns the encoder's index.
+    std::size_t add_encoder(unsigned int a, unsigned int b) {
+        if (events_seen) {
+            throw std::system_error(EBUSY, std::generic_category(), "can't add encoders once decoding started");
+        }
+        std::size_t index = encoders.size();
+        encoders.push_back(std::make_unique<encoder>());
+        encoder& added = *encoders.back();
+        added.state = static_cast<std::uint8_t>((lines->get_value(a) == backend::value::ACTIVE ? 2 : 0) |
+                                                (lines->get_value(b) == backend::value::ACTIVE ? 1 : 0));
+        for (auto [offset, bit] : {std::pair<unsigned int, std::uint8_t>{a, 2}, std::pair<unsigned int, std::uint8_t>{b, 1}}) {
+            lines->line_bit(offset);
+            if (offset >= line_by_offset.size()) {
+                line_by_offset.resize(offset + 1);
+            }
+            line_by_offset[offset] = line_ref{static_cast<int>(index), bit, 0, false};
+        }
+        return index;
+    }
+
+    std::size_t num_encoders() const { return encoders.size(); }
+
+    // Readable while events are queued, for a reactor.
+    int fd() const { return reader.fd(); }
+
+    // Reads until the queue is empty, then publishes every encoder that moved. Returns how many events that was.
+    std::size_t drain() {
+        drains++;
+        std::size_t total = reader.read([this](const backend::edge_event& event) { add(event); });
+        publish();
+        return total;
+    }
+
+    // Decodes one event. Nothing is published until publish().
+    void add(const backend::edge_event& event) {
+        unsigned int offset = event.line_offset();
+        if (offset >= line_by_offset.size() || line_by_offset[offset].encoder < 0) {
+            return;
+        }
+        line_ref& line = line_by_offset[offset];
+        encoder& decoding = *encoders[static_cast<std::size_t>(line.encoder)];
+        std::uint64_t now = event.timestamp_ns();
+        events_seen++;
+        decoding.edges++;
+
+        // the reader checked the seqno before handing the event over. The first event has nothing to be compared to.
+        std::uint64_t dropped = reader.dropped(offset);
+        if (line.has_seqno && dropped != line.dropped_seen) {
+            decoding.missed += dropped - line.dropped_seen;
+        }
+        line.dropped_seen = dropped;
+        line.has_seqno = true;
+
+        std::uint8_t next = event.type() == backend::edge_event::event_type::RISING_EDGE ? decoding.state | line.bit : decoding.state & ~line.bit;
+        int step = TRANSITIONS[decoding.state << 2 | next];
+        decoding.state = next;
+        if (step == INVALID) {
+            decoding.invalid++;
+        } else {
+            decoding.position += step;
+        }
+
+        if (!decoding.moving) {
+            decoding.window_start_ns = now;
+            decoding.window_position = decoding.position;
+            decoding.moving = true;
+        } else if (now - decoding.window_start_ns >= window_ns()) {
+            decoding.velocity = static_cast<double>(decoding.position - decoding.window_position) * 1e9 / static_cast<double>(now - decoding.window_start_ns);
+            decoding.window_start_ns = now;
+            decoding.window_position = decoding.position;
+        }
+        decoding.last_edge_ns = now;
+
+        if (!decoding.dirty) {
+            decoding.dirty = true;
+            dirty.push_back(static_cast<std::size_t>(line.encoder));
+        }
+    }
+
+    // Writes the snapshots of the encoders that changed since the last publish().
+    void publish() {
+        for (std::size_t index : dirty) {
+            encoder& changed = *encoders[index];
+            changed.dirty = false;
+
+            std::uint64_t seq = changed.seq.load(std::memory_order_relaxed);
+            changed.seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            changed.shown_position.store(changed.position, std::memory_order_relaxed);
+            changed.shown_velocity.store(changed.velocity, std::memory_order_relaxed);
+            changed.shown_last_edge_ns.store(changed.last_edge_ns, std::memory_order_relaxed);
+            changed.shown_edges.store(changed.edges, std::memory_order_relaxed);
+            changed.shown_invalid.store(changed.invalid, std::memory_order_relaxed);
+            changed.shown_missed.store(changed.missed, std::memory_order_relaxed);
+            changed.seq.store(seq + 2, std::memory_order_release);
+        }
+        dirty.clear();
+    }
+
+    // Encoders without an edge for stop_after have stopped: velocity 0. now_ns has to be on the event clock.
+    void settle(std::uint64_t now_ns) {
+        for (std::size_t index = 0; index < encoders.size(); index++) {
+            encoder& idle = *encoders[index];
+            if (idle.moving && now_ns - idle.last_edge_ns >= static_cast<std::uint64_t>(settings.stop_after.count()) * 1000) {
+                idle.moving = false;
+                idle.velocity = 0.0;
+                if (!idle.dirty) {
+                    idle.dirty = true;
+                    dirty.push_back(index);
+                }
+            }
+        }
+        publish();
+    }
+
+    // From any thread.
+    snapshot read(std::size_t index) const {
+        const encoder& shown = *encoders.at(index);
+        snapshot copy;
+        while (true) {
+            std::uint64_t before = shown.seq.load(std::memory_order_acquire);
+            copy.position = shown.shown_position.load(std::memory_order_relaxed);
+            copy.velocity = shown.shown_velocity.load(std::memory_order_relaxed);
+            copy.last_edge_ns = shown.shown_last_edge_ns.load(std::memory_order_relaxed);
+            copy.edges = shown.shown_edges.load(std::memory_order_relaxed);
+            copy.invalid = shown.shown_invalid.load(std::memory_order_relaxed);
+            copy.missed = shown.shown_missed.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t after = shown.seq.load(std::memory_order_relaxed);
+
+            // odd: the decoder was halfway through writing it. Changed: it wrote it while we copied.
+            if (before == after && !(before & 1)) {
+                return copy;
+            }
+        }
+    }
+
+    std::uint64_t events() const { return events_seen; }
+    // drain() calls, and the most events one of them read.
+    std::uint64_t drain_calls() const { return drains; }
+    std::size_t largest_burst() const { return reader.largest_burst(); }
+
+private:
+    struct line_ref {
+        int encoder{-1};
+        std::uint8_t bit{0}; // 2 for A, 1 for B
+        std::uint64_t dropped_seen{0}; // the reader's drop count for the line when we last looked
+        bool has_seqno{false};         // dropped_seen is good
+    };
+
+    // The decoder's working state, then the published copy on its own cache line so readers polling it don't slow
+    // down the decoding.
+    struct encoder {
+        std::uint8_t state{0};
+        std::int64_t position{0};
+        double velocity{0.0};
+        std::uint64_t last_edge_ns{0};
+        std::uint64_t edges{0};
+        std::uint64_t invalid{0};
+        std::uint64_t missed{0};
+        std::uint64_t window_start_ns{0};
+        std::int64_t window_position{0};
+        bool moving{false};
+        bool dirty{false};
+
+        alignas(64) std::atomic<std::uint64_t> seq{0};
+        std::atomic<std::int64_t> shown_position{0};
+        std::atomic<double> shown_velocity{0.0};
+        std::atomic<std::uint64_t> shown_last_edge_ns{0};
+        std::atomic<std::uint64_t> shown_edges{0};
+        std::atomic<std::uint64_t> shown_invalid{0};
+        std::atomic<std::uint64_t> shown_missed{0};
+    };
+
+    std::uint64_t window_ns() const { return static_cast<std::uint64_t>(settings.velocity_window.count()) * 1000; }
+
+    backend::line_request* lines;
+    options settings;
+    events::edge_reader reader;
+    std::vector<std::unique_ptr<encoder>> encoders;
+    std::vector<line_ref> line_by_offset;
+    std::vector<std::size_t> dirty;
+    std::uint64_t events_seen{0};
+    std::uint64_t drains{0};
+};
+
+}
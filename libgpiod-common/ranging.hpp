@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "deadline_timer.hpp"
+#include "edge_reader.hpp"
+#include "gpio_backend.hpp"
+#include "tasks.hpp"
+#include "trace.hpp"
+
+/*
+Non-blocking ranging for HC-SR04 ultrasonic sensors, one or a whole ring of them.
+
+The sensor measures distance like this: a 10us pulse on its trigger pin makes it send an ultrasonic burst, then its
+echo pin goes high until the burst comes back. The length of that echo pulse is the round trip time of the sound.
+
+Instead of trigger, sleep, read, sleep, this is a state machine driven by two file descriptors for an event loop:
+- echo_fd(): the request holding every echo line, readable when any echo goes up or down. Events are routed to their
+  sensor by line offset and the edge *timestamps* are used for the pulse length, so it doesn't matter how quickly we
+  get around to reading them.
+- timer_fd(): a timerfd that goes off when an echo has taken too long (echo_timeout) or when it's a sensor's turn to
+  be triggered again.
+
+Sensors that can hear each other's bursts (pointing the same way, same room) have to take turns, otherwise one
+sensor's burst comes back as another one's echo. Put those in the same group: within a group only one sensor is
+listening at a time, the next one fires as soon as the previous echo is over (plus a short handover_guard for the
+room to go quiet). Different groups run at the same time and the triggers of groups that are due together go out in
+one pulse. A single sensor re-triggers as soon as its cycle time allows: 25ms by default, 40 measurements a second.
+
+If an echo line rises while another sensor of its group is listening anyway (a late echo we'd already given up on,
+wiring crosstalk) the listening sensor's measurement can't be trusted. It's dropped and counted as a collision.
+
+Every finished (or timed out) measurement is handed to the deliver callback. Keep that callback short, hand the
+result to another thread if you want to do anything slow with it.
+
+Not thread safe, everything has to happen on the event loop's thread. Only rate_hz() can be read from anywhere.
+*/
+namespace ranging {
+
+struct measurement {
+    std::size_t sensor{0};          // index from add_sensor()
+    std::uint64_t trigger_ns{0};    // when the trigger pulse ended
+    std::uint64_t echo_start_ns{0}; // rising edge of the echo
+    std::uint64_t echo_end_ns{0};   // falling edge of the echo
+    double distance_cm{0};
+    bool timed_out{false};          // no echo, or no end to it, within echo_timeout
+
+    std::uint64_t echo_ns() const { return echo_end_ns - echo_start_ns; }
+};
+
+struct options {
+    std::chrono::microseconds cycle_time{25000};     // trigger to trigger, for each sensor
+    std::chrono::microseconds echo_timeout{24000};   // longest echo we wait for, ~4m of range
+    std::chrono::microseconds trigger_pulse{10};
+    std::chrono::microseconds drain_limit{40000};    // how long a timed out echo gets to drop before its group moves on
+    std::chrono::microseconds handover_guard{2000};  // quiet time before the next sensor of a group fires
+};
+
+struct sensor_report {
+    unsigned int trigger;
+    unsigned int echo;
+    unsigned int group;
+    std::uint64_t triggers;
+    std::uint64_t completed;
+    std::uint64_t timed_out;
+    std::uint64_t collisions;
+    double rate_hz;
+};
+
+class sensor_array {
+public:
+    static constexpr double SPEED_OF_SOUND{0.0343}; // cm per microsecond.
+
+    // Trigger lines have to be outputs in trigger_lines, echo lines inputs with edge::BOTH in echo_lines.
+    sensor_array(backend::line_request& trigger_lines, backend::line_request& echo_lines, options settings = options())
+        : trigger_lines(&trigger_lines), echo_lines(&echo_lines), settings(settings), pulse(std::chrono::microseconds(100)), echoes(echo_lines) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the ranging timer");
+        }
+    }
+
+    ~sensor_array() { ::close(timer); }
+
+    sensor_array(const sensor_array&) = delete;
+    sensor_array& operator=(const sensor_array&) = delete;
+
+    // Sensors have to be added before start(). Returns the sensor's index (measurement::sensor).
+    std::size_t add_sensor(unsigned int trigger, unsigned int echo, unsigned int group = 0) {
+        if (started) {
+            throw std::system_error(EBUSY, std::generic_category(), "can't add sensors while ranging");
+        }
+        sensors.push_back(std::make_unique<sensor>());
+        sensor& added = *sensors.back();
+        added.trigger = trigger;
+        added.echo = echo;
+        added.group = group;
+        added.trigger_bit = trigger_lines->line_bit(trigger);
+        echo_lines->line_bit(echo);
+
+        if (echo >= sensor_by_echo.size()) {
+            sensor_by_echo.resize(echo + 1, -1);
+        }
+        sensor_by_echo[echo] = static_cast<int>(sensors.size() - 1);
+        if (group >= groups.size()) {
+            groups.resize(group + 1);
+        }
+        groups[group].members.push_back(sensors.size() - 1);
+        return sensors.size() - 1;
+    }
+
+    std::size_t num_sensors() const { return sensors.size(); }
+
+    int echo_fd() const { return echo_lines->fd(); }
+    int timer_fd() const { return timer; }
+
+    // Every echo edge read from now on is also written to this trace, raw, before it's matched to a sensor.
+    // nullptr stops recording.
+    void record_to(trace::recorder* recorder) { tracer = recorder; }
+
+    // Echo edges the kernel had to drop (seqno gaps) per echo line, and the reader's buffer sizing.
+    const events::edge_reader& echo_reader() const { return echoes; }
+
+    // Fires the first sensor of every group, after that it keeps going by itself.
+    void start() {
+        started = true;
+        firing.clear();
+        for (std::size_t g = 0; g < groups.size(); g++) {
+            if (!groups[g].members.empty()) {
+                groups[g].turn = 0;
+                firing.push_back(g);
+            }
+        }
+        fire_all();
+        arm_earliest();
+    }
+
+    // Call when echo_fd() is readable.
+    template <typename Deliver>
+    void on_echo(Deliver deliver) {
+        firing.clear();
+        echoes.read([&](const backend::edge_event& event) {
+            if (tracer) {
+                tracer->record(event);
+            }
+            int index = event.line_offset() < sensor_by_echo.size() ? sensor_by_echo[event.line_offset()] : -1;
+            if (index < 0) {
+                strays++;
+                return;
+            }
+            handle_edge(static_cast<std::size_t>(index), event, deliver);
+        });
+        fire_all();
+        arm_earliest();
+    }
+
+    // Call when timer_fd() is readable.
+    template <typename Deliver>
+    void on_timer(Deliver deliver) {
+        std::uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "reading the ranging timer failed");
+        }
+
+        firing.clear();
+        std::uint64_t now = backend::monotonic_ns();
+        for (std::size_t g = 0; g < groups.size(); g++) {
+            if (groups[g].phase != state::IDLE && groups[g].deadline <= now) {
+                expire(g, now, deliver);
+            }
+        }
+        fire_all();
+        arm_earliest();
+    }
+
+    // Measurements per second of all sensors together, over each sensor's last full second.
+    double rate_hz() const {
+        double total = 0;
+        for (const auto& s : sensors) {
+            total += s->rate.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    std::uint64_t triggers() const { return sum(&sensor::triggers); }
+    std::uint64_t completed() const { return sum(&sensor::completed); }
+    std::uint64_t timed_out() const { return sum(&sensor::timeouts); }
+    std::uint64_t collisions() const { return sum(&sensor::collisions); }
+    std::uint64_t stray_edges() const { return strays; }
+    const metrics::latency_histogram& trigger_lateness() const { return pulse.lateness(); }
+
+    std::vector<sensor_report> report() const {
+        std::vector<sensor_report> reports;
+        for (const auto& s : sensors) {
+            reports.push_back(sensor_report{s->trigger, s->echo, s->group, s->triggers, s->completed, s->timeouts, s->collisions,
+                                            s->rate.load(std::memory_order_relaxed)});
+        }
+        return reports;
+    }
+
+private:
+    enum class state { IDLE, WAIT_RISE, WAIT_FALL, DRAIN, COOL_DOWN };
+
+    struct sensor {
+        unsigned int trigger{0};
+        unsigned int echo{0};
+        unsigned int group{0};
+        std::uint64_t trigger_bit{0};
+        std::uint64_t next_allowed{0}; // earliest the cycle time lets it fire again
+        bool echo_high{false};
+        bool collided{false};
+        measurement current;
+
+        std::uint64_t triggers{0};
+        std::uint64_t completed{0};
+        std::uint64_t timeouts{0};
+        std::uint64_t collisions{0};
+        std::uint64_t window_start{0};
+        std::uint64_t window_count{0};
+        std::atomic<double> rate{0};
+    };
+
+    struct group {
+        std::vector<std::size_t> members;
+        std::size_t turn{0};           // which member is (or is about to be) listening
+        state phase{state::IDLE};
+        std::uint64_t deadline{0};     // when the timer has to look at this group again
+    };
+
+    static std::uint64_t ns(std::chrono::microseconds us) { return static_cast<std::uint64_t>(std::chrono::nanoseconds(us).count()); }
+
+    std::uint64_t sum(std::uint64_t sensor::*counter) const {
+        std::uint64_t total = 0;
+        for (const auto& s : sensors) {
+            total += (*s).*counter;
+        }
+        return total;
+    }
+
+    template <typename Deliver>
+    void handle_edge(std::size_t index, const backend::edge_event& event, Deliver& deliver) {
+        sensor& s = *sensors[index];
+        group& g = groups[s.group];
+        bool active = g.members[g.turn] == index;
+        bool listening = g.phase == state::WAIT_RISE || g.phase == state::WAIT_FALL;
+
+        if (event.type() == backend::edge_event::event_type::RISING_EDGE) {
+            s.echo_high = true;
+            if (active && g.phase == state::WAIT_RISE && event.timestamp_ns() + pulse_slack_ns >= s.current.trigger_ns) {
+                s.current.echo_start_ns = event.timestamp_ns();
+                g.phase = state::WAIT_FALL;
+                g.deadline = s.current.echo_start_ns + ns(settings.echo_timeout);
+                return;
+            }
+            // an echo nobody triggered just now. whoever in the group is listening may be hearing it too.
+            strays++;
+            if (!active && listening) {
+                sensors[g.members[g.turn]]->collided = true;
+            }
+            return;
+        }
+
+        s.echo_high = false;
+        if (!active) {
+            return; // the end of an echo we gave up on earlier
+        }
+        if (g.phase == state::WAIT_FALL) {
+            s.current.echo_end_ns = event.timestamp_ns();
+            // DISTANCE(cm) = DURATION(in microseconds) * SPEED OF SOUND / 2.
+            s.current.distance_cm = static_cast<double>(s.current.echo_ns()) / 1000.0 * SPEED_OF_SOUND / 2;
+            if (s.collided) {
+                s.collisions++;
+            } else {
+                s.completed++;
+                count_for_rate(s, s.current.echo_end_ns);
+                deliver(s.current);
+            }
+            hand_over(s.group, backend::monotonic_ns());
+        } else if (g.phase == state::DRAIN) {
+            hand_over(s.group, backend::monotonic_ns());
+        }
+    }
+
+    template <typename Deliver>
+    void expire(std::size_t g, std::uint64_t now, Deliver& deliver) {
+        group& grp = groups[g];
+        sensor& s = *sensors[grp.members[grp.turn]];
+
+        switch (grp.phase) {
+            case state::WAIT_RISE:
+            case state::WAIT_FALL:
+                // the echo never came back or never ended: report it and let the sensor finish on its own.
+                s.current.timed_out = true;
+                s.timeouts++;
+                deliver(s.current);
+                if (grp.phase == state::WAIT_FALL) {
+                    // the sensor ignores triggers while its echo is high, wait for it to drop (or give up after a while).
+                    grp.phase = state::DRAIN;
+                    grp.deadline = s.current.trigger_ns + ns(settings.drain_limit);
+                } else {
+                    hand_over(g, now);
+                }
+                break;
+            case state::DRAIN:
+                hand_over(g, now);
+                break;
+            case state::COOL_DOWN:
+                firing.push_back(g);
+                break;
+            case state::IDLE:
+                break;
+        }
+    }
+
+    // The group's next sensor gets its turn: right away if it's allowed to, otherwise the timer fires it later.
+    void hand_over(std::size_t g, std::uint64_t now) {
+        group& grp = groups[g];
+        grp.turn = (grp.turn + 1) % grp.members.size();
+
+        std::uint64_t due = sensors[grp.members[grp.turn]]->next_allowed;
+        if (grp.members.size() > 1) {
+            due = std::max(due, now + ns(settings.handover_guard));
+        }
+        if (due <= now) {
+            firing.push_back(g);
+        } else {
+            grp.phase = state::COOL_DOWN;
+            grp.deadline = due;
+        }
+    }
+
+    // One trigger pulse for the current sensor of every group in `firing`.
+    void fire_all() {
+        if (firing.empty()) {
+            return;
+        }
+        std::uint64_t mask = 0;
+        for (std::size_t g : firing) {
+            mask |= sensors[groups[g].members[groups[g].turn]]->trigger_bit;
+        }
+
+        pulse.start();
+        trigger_lines->set_values(mask, mask);
+        pulse.wait(settings.trigger_pulse);
+        trigger_lines->set_values(mask, 0);
+        std::uint64_t fired = backend::monotonic_ns();
+
+        for (std::size_t g : firing) {
+            group& grp = groups[g];
+            std::size_t index = grp.members[grp.turn];
+            sensor& s = *sensors[index];
+            s.current = measurement();
+            s.current.sensor = index;
+            s.current.trigger_ns = fired;
+            s.triggers++;
+
+            // the next trigger is one cycle after this one was *due*, so a lone sensor's rate stays steady. if it fell
+            // more than a cycle behind, start counting again from now instead of firing a burst to catch up.
+            std::uint64_t cycle = ns(settings.cycle_time);
+            std::uint64_t was_due = s.next_allowed;
+            if (was_due == 0 || fired > was_due + cycle) {
+                was_due = fired;
+            }
+            s.next_allowed = was_due + cycle;
+
+            // someone else in the group is still sending an echo, this one could hear it.
+            s.collided = std::any_of(grp.members.begin(), grp.members.end(), [&](std::size_t other) {
+                return other != index && sensors[other]->echo_high;
+            });
+
+            grp.phase = state::WAIT_RISE;
+            grp.deadline = fired + ns(settings.echo_timeout);
+        }
+        firing.clear();
+    }
+
+    void arm_earliest() {
+        std::uint64_t earliest = 0;
+        for (const group& g : groups) {
+            if (g.phase != state::IDLE && (earliest == 0 || g.deadline < earliest)) {
+                earliest = g.deadline;
+            }
+        }
+        if (earliest == 0) {
+            return;
+        }
+        itimerspec when{};
+        when.it_value = timing::to_timespec(earliest);
+        timerfd_settime(timer, TFD_TIMER_ABSTIME, &when, nullptr);
+    }
+
+    void count_for_rate(sensor& s, std::uint64_t now) {
+        if (s.window_count == 0 && s.window_start == 0) {
+            s.window_start = now;
+        }
+        s.window_count++;
+        if (now - s.window_start >= 1000000000) {
+            s.rate.store(static_cast<double>(s.window_count) * 1e9 / static_cast<double>(now - s.window_start), std::memory_order_relaxed);
+            s.window_start = now;
+            s.window_count = 0;
+        }
+    }
+
+    // an echo edge can carry a timestamp from just before we took ours after the trigger write.
+    static constexpr std::uint64_t pulse_slack_ns{50000};
+
+    backend::line_request* trigger_lines;
+    backend::line_request* echo_lines;
+    options settings;
+    timing::deadline_timer pulse;
+    events::edge_reader echoes;
+    int timer{-1};
+    bool started{false};
+    trace::recorder* tracer{nullptr};
+
+    std::vector<std::unique_ptr<sensor>> sensors;
+    std::vector<int> sensor_by_echo; // echo offset -> sensor index, -1 if it isn't one
+    std::vector<group> groups;
+    std::vector<std::size_t> firing; // groups due to fire, collected so they share one trigger pulse
+    std::uint64_t strays{0};
+};
+
+// A single sensor, the trigger and echo lines can be in separate requests.
+class hcsr04 : public sensor_array {
+public:
+    hcsr04(backend::line_request& trigger_lines, unsigned int trigger, backend::line_request& echo_lines, unsigned int echo, options settings = options())
+        : sensor_array(trigger_lines, echo_lines, settings) {
+        add_sensor(trigger, echo);
+    }
+};
+
+/*
+One measurement as straight-line code, for tasks::scheduler (see tasks.hpp):
+
+  ranging::measurement result = co_await ranging::measure(sched, *triggers, 20, *echoes, 21);
+
+Trigger pulse, wait for the echo to go up, wait for it to come down, distance from the two edge timestamps. It's
+sensor_array without the scheduling (no groups, no collision checks), so run one task per sensor and keep the
+cycle time between triggers yourself. The trigger pulse is a timer sleep and comes out longer than 10us (often
+50-100us), the sensor doesn't mind: the burst starts when the pulse ends.
+*/
+inline tasks::task<measurement> measure(tasks::scheduler& sched, backend::line_request& trigger_lines, unsigned int trigger,
+                                        backend::line_request& echo_lines, unsigned int echo, options settings = options()) {
+    measurement result;
+    sched.discard_edges(echo_lines, echo); // whatever is left of an echo we gave up on
+
+    co_await sched.set_value(trigger_lines, trigger, backend::value::ACTIVE);
+    co_await sched.sleep_for(settings.trigger_pulse);
+    co_await sched.set_value(trigger_lines, trigger, backend::value::INACTIVE);
+    result.trigger_ns = backend::monotonic_ns();
+
+    // echo_timeout counts from the trigger for both edges. (A timeout of 0 would mean forever, hence the 1ns.)
+    std::uint64_t give_up = result.trigger_ns + static_cast<std::uint64_t>(std::chrono::nanoseconds(settings.echo_timeout).count());
+    auto left = [give_up]() {
+        std::uint64_t now = backend::monotonic_ns();
+        return std::chrono::nanoseconds(give_up > now ? give_up - now : 1);
+    };
+
+    std::optional<backend::edge_event> rise = co_await sched.next_edge(echo_lines, echo, backend::edge::RISING, left());
+    if (!rise) {
+        result.timed_out = true;
+        co_return result;
+    }
+    std::optional<backend::edge_event> fall = co_await sched.next_edge(echo_lines, echo, backend::edge::FALLING, left());
+    if (!fall) {
+        result.timed_out = true;
+        co_return result;
+    }
+    result.echo_start_ns = rise->timestamp_ns();
+    result.echo_end_ns = fall->timestamp_ns();
+    result.distance_cm = static_cast<double>(result.echo_ns()) / 1000.0 * sensor_array::SPEED_OF_SOUND / 2;
+    co_return result;
+}
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+/*
+An epoll event loop.
+
+Anything with a file descriptor can be watched: a line request's fd() becomes readable the moment the kernel queues
+an edge event, so the callback runs right away instead of whenever a polling loop next gets around to checking.
+The thread sleeps in epoll_wait() the rest of the time and uses no cpu.
+
+Signals can be watched too (signalfd): CTRL+C becomes one more event handled on the loop's thread like everything
+else, instead of a handler that interrupts whatever the program was in the middle of.
+
+stop() is safe to call from any thread. Everything else belongs to the thread that calls run().
+*/
+namespace events {
+
+class reactor {
+public:
+    using callback = std::function<void(std::uint32_t ready)>;
+
+    reactor() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't set up the event loop");
+        }
+        add(wake_fd, [this](std::uint32_t) {
+            eventfd_t ignored;
+            eventfd_read(wake_fd, &ignored);
+        });
+    }
+
+    ~reactor() {
+        if (signal_fd >= 0) {
+            ::close(signal_fd);
+        }
+        ::close(wake_fd);
+        ::close(epoll_fd);
+    }
+
+    reactor(const reactor&) = delete;
+    reactor& operator=(const reactor&) = delete;
+
+    // Calls on_ready every time fd has something for us (EPOLLIN unless you ask for other events).
+    void add(int fd, callback on_ready, std::uint32_t wanted = EPOLLIN) {
+        auto entry = std::make_unique<handler>(handler{fd, std::move(on_ready), true});
+        epoll_event event{};
+        event.events = wanted;
+        event.data.ptr = entry.get();
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't watch fd " + std::to_string(fd));
+        }
+        handlers[fd] = std::move(entry);
+    }
+
+    // Safe to call from inside a callback, even for the fd being handled.
+    void remove(int fd) {
+        auto found = handlers.find(fd);
+        if (found == handlers.end()) {
+            return;
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        found->second->alive = false;
+        retired.push_back(std::move(found->second));
+        handlers.erase(found);
+    }
+
+    /*
+    Blocks the signals and delivers them through a signalfd instead.
+
+    Signal masks are per thread and new threads copy the mask of the thread that made them, so call this from main()
+    BEFORE starting any other thread. Otherwise the signal can still land on one of those threads the old way.
+    */
+    void watch_signals(std::initializer_list<int> signals, std::function<void(int signum)> on_signal) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (int signum : signals) {
+            sigaddset(&mask, signum);
+        }
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+        signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create signalfd");
+        }
+        add(signal_fd, [this, on_signal = std::move(on_signal)](std::uint32_t) {
+            signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                on_signal(static_cast<int>(info.ssi_signo));
+            }
+        });
+    }
+
+    // Handles events until stop() is called.
+    void run() {
+        while (!stopping.load(std::memory_order_relaxed)) {
+            run_once(-1);
+        }
+        stopping = false;
+    }
+
+    // Waits up to timeout_ms (-1 = forever) and handles whatever is ready. Returns how many fds were handled.
+    int run_once(int timeout_ms) {
+        int ready = epoll_wait(epoll_fd, ready_events, MAX_EVENTS, timeout_ms);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            throw std::system_error(errno, std::generic_category(), "epoll_wait failed");
+        }
+
+        for (int i = 0; i < ready; i++) {
+            handler* entry = static_cast<handler*>(ready_events[i].data.ptr);
+            if (entry->alive) {
+                entry->on_ready(ready_events[i].events);
+            }
+        }
+        retired.clear();
+        return ready;
+    }
+
+    void stop() {
+        stopping = true;
+        eventfd_write(wake_fd, 1);
+    }
+
+private:
+    struct handler {
+        int fd;
+        callback on_ready;
+        bool alive;
+    };
+
+    static constexpr int MAX_EVENTS{32};
+
+    int epoll_fd{-1};
+    int wake_fd{-1};
+    int signal_fd{-1};
+    std::atomic<bool> stopping{false};
+    std::unordered_map<int, std::unique_ptr<handler>> handlers;
+    std::vector<std::unique_ptr<handler>> retired;
+    epoll_event ready_events[MAX_EVENTS];
+};
+
+}
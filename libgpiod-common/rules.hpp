@@ -0,0 +1,274 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "histogram.hpp"
+#include "timer_wheel.hpp"
+
+/*
+Timed outputs from a table of rules instead of hand-written sleeps.
+
+A rule reads "a falling edge on line 21 drives line 5 active for 300ms". Add as many as you like (thousands is fine)
+and feed the engine edge events: every rule that matches switches its output on and starts a timer on a timer wheel
+(see timer_wheel.hpp), when the timer runs out the output goes off again. Nothing ever sleeps, so one thread runs all
+of them at once and can go straight back to reading events.
+
+If an edge matches a rule that is still running, its retrigger policy decides:
+- RESTART: the time starts over from this edge (a motion light that stays on while there's motion).
+- IGNORE: this edge is ignored, the running one finishes as planned (a fixed length pulse).
+- CANCEL: this edge switches it off early (press once for on, again for off, or wait).
+
+Several rules can drive the same line, it stays on while any of them is running.
+
+Output changes aren't written straight away. Everything one batch of edges (or one timer tick) changes is collected
+and written in one set_values() call by flush(), so 500 timers running out on the same tick cost one write.
+
+Durations are counted from the edge's timestamp, not from when we got to it, and rounded up to whole ticks.
+fd() is a timerfd armed for the next tick the wheel has something to do at, give it to an event loop and call
+on_timer() when it's readable. Everything has to happen on one thread.
+*/
+namespace rules {
+
+enum class retrigger { RESTART, IGNORE, CANCEL };
+
+struct rule {
+    unsigned int input;
+    backend::edge trigger;            // RISING, FALLING or BOTH
+    unsigned int output;
+    std::chrono::microseconds active_for;
+    retrigger policy{retrigger::RESTART};
+};
+
+class engine {
+public:
+    // Every rule's output has to be a line of `outputs`.
+    explicit engine(backend::line_request& outputs, std::chrono::microseconds tick = std::chrono::microseconds(1000))
+        : outputs(&outputs), tick_ns(static_cast<std::uint64_t>(std::chrono::nanoseconds(tick).count())),
+          origin(backend::monotonic_ns()), on_count(64, 0) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the rule timer");
+        }
+    }
+
+    ~engine() { ::close(timer); }
+
+    engine(const engine&) = delete;
+    engine& operator=(const engine&) = delete;
+
+    // Returns the rule's index.
+    std::size_t add_rule(const rule& added) {
+        compiled c;
+        c.definition = added;
+        c.bit = outputs->line_bit(added.output);
+        c.line = static_cast<std::size_t>(__builtin_ctzll(c.bit));
+        c.duration_ns = static_cast<std::uint64_t>(std::chrono::nanoseconds(added.active_for).count());
+
+        if (added.input >= rules_by_input.size()) {
+            rules_by_input.resize(added.input + 1);
+        }
+        rules_by_input[added.input].push_back(table.size());
+        table.push_back(c);
+        wheel.resize(table.size());
+        return table.size() - 1;
+    }
+
+    std::size_t num_rules() const { return table.size(); }
+
+    int fd() const { return timer; }
+
+    // Runs every rule the edge matches. The output changes wait for flush().
+    // Returns the mask bits of the outputs whose rules it started, restarted or cancelled.
+    std::uint64_t on_edge(const backend::edge_event& event) {
+        if (event.line_offset() >= rules_by_input.size()) {
+            return 0;
+        }
+        bool rising = event.type() == backend::edge_event::event_type::RISING_EDGE;
+        std::uint64_t edge_tick = tick_of(event.timestamp_ns());
+        if (wheel.pending() == 0 && edge_tick > wheel.now()) {
+            wheel.advance(edge_tick, [](std::size_t) {}); // it stood still while nothing was running, catch up
+        }
+
+        std::uint64_t touched = 0;
+        for (std::size_t index : rules_by_input[event.line_offset()]) {
+            compiled& c = table[index];
+            backend::edge wanted = c.definition.trigger;
+            if (wanted != backend::edge::BOTH && wanted != (rising ? backend::edge::RISING : backend::edge::FALLING)) {
+                continue;
+            }
+            triggered++;
+
+            if (wheel.is_pending(index)) {
+                switch (c.definition.policy) {
+                    case retrigger::IGNORE: continue;
+                    case retrigger::CANCEL: wheel.cancel(index); release(c); touched |= c.bit; continue;
+                    case retrigger::RESTART: break;
+                }
+            } else {
+                hold(c);
+            }
+            touched |= c.bit;
+            // the first tick that starts at or after the edge + the duration.
+            std::uint64_t since_origin = event.timestamp_ns() > origin ? event.timestamp_ns() - origin : 0;
+            wheel.start(index, (since_origin + c.duration_ns + tick_ns - 1) / tick_ns);
+        }
+        return touched;
+    }
+
+    template <typename Buffer>
+    void on_edges(const Buffer& events) {
+        for (const auto& event : events) {
+            on_edge(event);
+        }
+        flush();
+    }
+
+    // Writes every output change collected so far in one set_values() call and re-arms the timer.
+    void flush() {
+        if (change_mask) {
+            outputs->set_values(change_mask, change_bits);
+            writes++;
+            change_mask = 0;
+            change_bits = 0;
+        }
+        arm();
+    }
+
+    // Call when fd() is readable: switches off whatever ran out, in one write per tick.
+    void on_timer() {
+        std::uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "reading the rule timer failed");
+        }
+        armed_for = 0;
+        std::uint64_t now = backend::monotonic_ns();
+        std::uint64_t until = tick_of(now);
+        while (wheel.now() < until) {
+            // one tick at a time so every tick's changes are their own write, in order.
+            std::uint64_t next = wheel.next_tick();
+            if (next == timing::timer_wheel::NONE || next > until) {
+                wheel.advance(until, [](std::size_t) {});
+                break;
+            }
+            std::uint64_t expired_before = expired;
+            wheel.advance(next, [&](std::size_t index) {
+                release(table[index]);
+                expired++;
+            });
+            if (change_mask) {
+                outputs->set_values(change_mask, change_bits);
+                writes++;
+                change_mask = 0;
+                change_bits = 0;
+            }
+            if (expired != expired_before) {
+                std::uint64_t due = origin + next * tick_ns;
+                std::uint64_t done = backend::monotonic_ns();
+                lateness_ns.record(done > due ? done - due : 0);
+            }
+        }
+        arm();
+    }
+
+    // Switches every output off and forgets every running timer.
+    void stop_all() {
+        for (std::size_t index = 0; index < table.size(); index++) {
+            if (wheel.is_pending(index)) {
+                wheel.cancel(index);
+                release(table[index]);
+            }
+        }
+        flush();
+    }
+
+    std::size_t running() const { return wheel.pending(); }
+    bool is_running(std::size_t index) const { return wheel.is_pending(index); }
+
+    std::uint64_t triggers() const { return triggered; }
+    std::uint64_t expiries() const { return expired; }
+    std::uint64_t write_count() const { return writes; }
+
+    // From the tick timers were due to run out to the return of the write that switched their outputs off (or to
+    // when they were handled, if another rule keeps the output on).
+    const metrics::latency_histogram& lateness() const { return lateness_ns; }
+
+private:
+    struct compiled {
+        rule definition;
+        std::uint64_t bit{0};
+        std::size_t line{0};   // bit's index, for the per-line counts
+        std::uint64_t duration_ns{0};
+    };
+
+    // Ticks are counted from when the engine was made. An edge from before then counts as tick 0.
+    std::uint64_t tick_of(std::uint64_t ns) const { return ns > origin ? (ns - origin) / tick_ns : 0; }
+
+    void hold(const compiled& c) {
+        if (on_count[c.line]++ == 0) {
+            change(c.bit, true);
+        }
+    }
+
+    void release(const compiled& c) {
+        if (--on_count[c.line] == 0) {
+            change(c.bit, false);
+        }
+    }
+
+    // A line switched on and off again within one batch cancels out and isn't written at all. Only called when a
+    // line's level actually changes, so the first change of a batch says what the line was at before.
+    void change(std::uint64_t bit, bool on) {
+        if (!(change_mask & bit)) {
+            change_mask |= bit;
+            change_from = on ? change_from & ~bit : change_from | bit;
+        }
+        change_bits = on ? change_bits | bit : change_bits & ~bit;
+        if ((change_bits & bit) == (change_from & bit)) {
+            change_mask &= ~bit; // back where it started
+        }
+    }
+
+    void arm() {
+        std::uint64_t next = wheel.next_tick();
+        std::uint64_t wanted = next == timing::timer_wheel::NONE ? 0 : origin + next * tick_ns;
+        if (wanted == armed_for) {
+            return;
+        }
+        itimerspec spec{};
+        if (wanted) {
+            spec.it_value = timing::to_timespec(wanted);
+        }
+        timerfd_settime(timer, wanted ? TFD_TIMER_ABSTIME : 0, &spec, nullptr);
+        armed_for = wanted;
+    }
+
+    backend::line_request* outputs;
+    std::uint64_t tick_ns;
+    std::uint64_t origin;
+    int timer{-1};
+    std::uint64_t armed_for{0};
+
+    std::vector<compiled> table;
+    std::vector<std::vector<std::size_t>> rules_by_input; // input offset -> rules that watch it
+    std::vector<unsigned int> on_count;                   // running rules per output line (by bit index)
+    timing::timer_wheel wheel;
+
+    std::uint64_t change_mask{0};
+    std::uint64_t change_bits{0};
+    std::uint64_t change_from{0}; // the levels of the lines in change_mask before this batch
+
+    std::uint64_t triggered{0};
+    std::uint64_t expired{0};
+    std::uint64_t writes{0};
+    metrics::latency_histogram lateness_ns;
+};
+
+}
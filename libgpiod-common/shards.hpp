@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "edge_reader.hpp"
+#include "gpio.hpp"
+#include "histogram.hpp"
+#include "reactor.hpp"
+#include "spsc_ring.hpp"
+
+/*
+One event loop per chip (or per group of lines), each on its own thread pinned to its own core.
+
+A board with a couple of gpiochips plus an I2C expander or two, all on one reactor, gets everything handled one after
+the other: a burst on one chip holds up the lines of every other chip. Here every chip gets a shard: a reactor on a
+thread of its own, optionally pinned to a core (and given SCHED_FIFO) like the soft_pwm thread. The shards share
+nothing, so they don't wait on each other.
+
+  shards::runtime boards;
+  std::size_t buttons = boards.add_chip("/dev/gpiochip0", 1);
+  std::size_t relays = boards.add_chip("/dev/gpiochip1", 2);
+  ... request lines on boards.at(buttons).chip() and boards.at(relays).chip() ...
+  boards.at(buttons).watch(*inputs, [&](shards::shard& self, const backend::edge_event& event) {
+      self.post_set_values(relays, *outputs, 1, event.type() == backend::edge_event::event_type::RISING_EDGE);
+  });
+  boards.start();
+
+A line request belongs to the shard that watches or writes it, and only that shard's thread touches it. Anything that
+has to happen on another shard is posted to it as a message. A message is small and fixed-size (a function pointer
+plus a few words), and goes through a lock-free ring (spsc_ring.hpp). Every sender has its own ring into every other
+shard, so each ring has exactly one producer and one consumer and no locks are needed anywhere. The thread that
+calls start() counts as one more sender.
+
+Posting never waits. A full ring drops the message and counts it, because a shard waiting for room in another shard's
+ring while that shard waits for room in its ring would be a deadlock. The receiving side is woken with an eventfd,
+but only when it isn't already awake and going to look anyway, so a busy shard doesn't pay a syscall per message.
+
+Per shard it counts edge events and messages handled, messages dropped on the way in, how long edges took from their
+kernel timestamp to their handler and messages from post to handler, and how much of its time the thread was busy.
+
+Everything (chips, shards, watches, the loops' own fds) is set up before start(). If you use reactor::watch_signals,
+call it before start() too so the shard threads inherit the blocked signals. A handler that throws stops its shard,
+the exception comes out of rethrow_failure().
+*/
+namespace shards {
+
+constexpr std::size_t INBOX_CAPACITY{1024}; // messages, per sender
+
+class shard;
+class runtime;
+
+// A cross-shard message. Trivially copyable so it fits in a ring slot: run(target shard, message) on the other side.
+struct message {
+    using handler = void (*)(shard& on, const message& m);
+
+    handler run{nullptr};
+    void* target{nullptr}; // whatever run works on, e.g. a line request of the target shard
+    std::uint64_t a{0};
+    std::uint64_t b{0};
+    std::uint64_t sent_ns{0};
+};
+
+class shard {
+public:
+    using edge_handler = std::function<void(shard& self, const backend::edge_event& event)>;
+
+    shard(const shard&) = delete;
+    shard& operator=(const shard&) = delete;
+
+    ~shard() { ::close(wake_fd); }
+
+    const std::string& name() const { return label; }
+    std::size_t index() const { return position; }
+    int core() const { return cpu; }
+    backend::chip& chip() { return *gpio_chip; }
+
+    // For your own fds and timers (tasks::scheduler, rules::engine, ...). Add them before runtime::start().
+    events::reactor& loop() { return reactor; }
+
+    // Calls on_event on this shard's thread for every edge event of lines. Before runtime::start().
+    void watch(backend::line_request& lines, edge_handler on_event) {
+        readers.push_back(std::make_unique<events::edge_reader>(lines));
+        events::edge_reader* reader = readers.back().get();
+        reactor.add(reader->fd(), [this, reader, on_event = std::move(on_event)](std::uint32_t) {
+            std::uint64_t began = backend::monotonic_ns();
+            std::size_t got = reader->read([&](const backend::edge_event& event) {
+                edge_latency.record(began > event.timestamp_ns() ? began - event.timestamp_ns() : 0);
+                on_event(*this, event);
+            });
+            handled_events.fetch_add(got, std::memory_order_relaxed);
+            busy_ns.fetch_add(backend::monotonic_ns() - began, std::memory_order_relaxed);
+        });
+    }
+
+    /*
+    Runs run(shard to, message) on shard to's thread. Only call this from this shard's own thread (from a handler),
+    the main thread uses runtime::post(). Returns false if the message was dropped because to's ring from us is full.
+    */
+    bool post(std::size_t to, message::handler run, void* target, std::uint64_t a = 0, std::uint64_t b = 0);
+
+    // Sets outputs of a line request that belongs to shard to.
+    bool post_set_values(std::size_t to, backend::line_request& lines, std::uint64_t mask, std::uint64_t bits) {
+        return post(to, &apply_set_values, &lines, mask, bits);
+    }
+
+    std::uint64_t events() const { return handled_events.load(std::memory_order_relaxed); }
+    std::uint64_t messages() const { return handled_messages.load(std::memory_order_relaxed); }
+
+    // Messages other senders couldn't get into this shard.
+    std::uint64_t dropped() const {
+        std::uint64_t total = 0;
+        for (const auto& inbox : inboxes) {
+            total += inbox->dropped_count();
+        }
+        return total;
+    }
+
+    // Edge events the kernel dropped before this shard read them (seqno gaps, see edge_reader.hpp).
+    std::uint64_t edges_dropped() const {
+        std::uint64_t total = 0;
+        for (const auto& reader : readers) {
+            total += reader->dropped();
+        }
+        return total;
+    }
+
+    const metrics::latency_histogram& event_latency() const { return edge_latency; }
+    const metrics::latency_histogram& message_latency() const { return post_latency; }
+
+    // Seconds the thread has been running (so far, or until it stopped) and the share of that it spent in handlers.
+    double seconds() const {
+        std::uint64_t from = started_ns.load(std::memory_order_relaxed);
+        std::uint64_t until = stopped_ns.load(std::memory_order_relaxed);
+        if (!from) {
+            return 0.0;
+        }
+        return static_cast<double>((until ? until : backend::monotonic_ns()) - from) / 1e9;
+    }
+
+    double busy() const {
+        double elapsed = seconds();
+        return elapsed > 0.0 ? static_cast<double>(busy_ns.load(std::memory_order_relaxed)) / 1e9 / elapsed : 0.0;
+    }
+
+    // "shard0 (sim:sim, cpu 0): 1200 events (400/s), 1200 messages (400/s), 0 dropped, 3% busy", then the latencies.
+    void print(std::ostream& out) const {
+        double elapsed = std::max(seconds(), 1e-9);
+        out << label << " (" << gpio_chip->path() << ", " << (cpu >= 0 ? "cpu " + std::to_string(cpu) : "not pinned") << "): "
+            << events() << " events (" << static_cast<std::uint64_t>(static_cast<double>(events()) / elapsed) << "/s), "
+            << messages() << " messages (" << static_cast<std::uint64_t>(static_cast<double>(messages()) / elapsed) << "/s), "
+            << dropped() << " messages dropped, " << edges_dropped() << " edges dropped, "
+            << static_cast<int>(busy() * 100.0) << "% busy" << '\n';
+        if (edge_latency.count()) {
+            out << label << " edge to handler: " << edge_latency.summary_us() << '\n';
+        }
+        if (post_latency.count()) {
+            out << label << " post to handler: " << post_latency.summary_us() << '\n';
+        }
+    }
+
+private:
+    friend class runtime;
+
+    using inbox = rings::spsc_ring<message, INBOX_CAPACITY>;
+
+    shard(runtime& owner, std::size_t position, backend::chip& gpio_chip, int cpu, std::string label)
+        : owner(&owner), position(position), cpu(cpu), label(std::move(label)), gpio_chip(&gpio_chip) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the shard's eventfd");
+        }
+        reactor.add(wake_fd, [this](std::uint32_t) { drain(); });
+    }
+
+    static void apply_set_values(shard&, const message& m) {
+        static_cast<backend::line_request*>(m.target)->set_values(m.a, m.b);
+    }
+
+    // Sender side, from whichever thread owns ring from.
+    bool deliver(std::size_t from, const message& m) {
+        bool pushed = inboxes[from]->push(m);
+        // only the sender that finds the shard "asleep" pays for the write, see drain().
+        if (!awake.exchange(true, std::memory_order_acq_rel)) {
+            eventfd_write(wake_fd, 1);
+        }
+        return pushed;
+    }
+
+    /*
+    Clearing awake with an exchange (not a plain store) means we read the flag the last sender set, so we see its
+    message too. A sender that finds awake still set knows we haven't cleared it yet, so we'll see its message as
+    well without another eventfd write.
+    */
+    void drain() {
+        std::uint64_t began = backend::monotonic_ns();
+        eventfd_t ignored;
+        eventfd_read(wake_fd, &ignored);
+        awake.exchange(false, std::memory_order_acq_rel);
+
+        std::uint64_t handled = 0;
+        message m;
+        for (auto& from : inboxes) {
+            while (from->pop(m)) {
+                std::uint64_t now = backend::monotonic_ns();
+                post_latency.record(now > m.sent_ns ? now - m.sent_ns : 0);
+                m.run(*this, m);
+                handled++;
+            }
+        }
+        handled_messages.fetch_add(handled, std::memory_order_relaxed);
+        busy_ns.fetch_add(backend::monotonic_ns() - began, std::memory_order_relaxed);
+    }
+
+    void run() {
+        started_ns.store(backend::monotonic_ns(), std::memory_order_relaxed);
+        try {
+            reactor.run();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        stopped_ns.store(backend::monotonic_ns(), std::memory_order_relaxed);
+    }
+
+    runtime* owner;
+    std::size_t position;
+    int cpu;
+    std::string label;
+    backend::chip* gpio_chip;
+
+    events::reactor reactor;
+    std::vector<std::unique_ptr<events::edge_reader>> readers;
+    std::vector<std::unique_ptr<inbox>> inboxes; // one per sender, made by runtime::start()
+    int wake_fd{-1};
+    std::atomic<bool> awake{false};
+
+    std::thread worker;
+    std::exception_ptr failure;
+
+    std::atomic<std::uint64_t> handled_events{0};
+    std::atomic<std::uint64_t> handled_messages{0};
+    std::atomic<std::uint64_t> busy_ns{0};
+    std::atomic<std::uint64_t> started_ns{0};
+    std::atomic<std::uint64_t> stopped_ns{0};
+    metrics::latency_histogram edge_latency;
+    metrics::latency_histogram post_latency;
+};
+
+class runtime {
+public:
+    static constexpr int ANY_CORE{-1};
+
+    runtime() = default;
+    ~runtime() { stop(); }
+
+    runtime(const runtime&) = delete;
+    runtime& operator=(const runtime&) = delete;
+
+    // How many cores there are to spread shards over, e.g. add_chip(name, i % runtime::cores()).
+    static int cores() { return std::max(1, static_cast<int>(std::thread::hardware_concurrency())); }
+
+    // Opens a chip (any name backend::open_chip() takes) and gives it a shard. Returns the shard's index.
+    std::size_t add_chip(const std::string& name, int core = ANY_CORE) {
+        chips.push_back(backend::open_chip(name));
+        return add_shard(*chips.back(), core);
+    }
+
+    /*
+    A shard for a chip you opened yourself, or another shard for a chip that already has one: request a different
+    group of its lines on each shard and they're handled in parallel. The chip has to outlive the runtime.
+    */
+    std::size_t add_shard(backend::chip& chip, int core = ANY_CORE, std::string name = "") {
+        if (started) {
+            throw std::system_error(EBUSY, std::generic_category(), "can't add shards once the runtime is running");
+        }
+        std::size_t index = all.size();
+        all.push_back(std::unique_ptr<shard>(new shard(*this, index, chip, core, name.empty() ? "shard" + std::to_string(index) : std::move(name))));
+        return index;
+    }
+
+    shard& at(std::size_t index) { return *all.at(index); }
+    const shard& at(std::size_t index) const { return *all.at(index); }
+    std::size_t size() const { return all.size(); }
+
+    // Starts every shard's thread. fifo_priority > 0 also gives the pinned ones SCHED_FIFO (needs root or CAP_SYS_NICE).
+    void start(int fifo_priority = 0) {
+        if (started) {
+            return;
+        }
+        // every shard and the outside thread get their own ring into every shard.
+        for (auto& to : all) {
+            for (std::size_t from = 0; from <= all.size(); from++) {
+                to->inboxes.push_back(std::make_unique<shard::inbox>(rings::backpressure::DROP_NEWEST));
+            }
+        }
+        started = true;
+
+        for (auto& s : all) {
+            s->worker = std::thread(&shard::run, s.get());
+
+            int error = 0;
+            if (s->cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(s->cpu, &cpus);
+                error = pthread_setaffinity_np(s->worker.native_handle(), sizeof(cpus), &cpus);
+                if (!error && fifo_priority > 0) {
+                    sched_param param{};
+                    param.sched_priority = fifo_priority;
+                    error = pthread_setschedparam(s->worker.native_handle(), SCHED_FIFO, &param);
+                }
+            }
+            if (error) {
+                stop();
+                throw std::system_error(error, std::generic_category(), "can't pin/prioritise the thread of " + s->label);
+            }
+        }
+    }
+
+    // Stops every shard's loop and waits for the threads. Messages still in the rings are not handled.
+    void stop() {
+        if (!started) {
+            return;
+        }
+        for (auto& s : all) {
+            s->reactor.stop();
+        }
+        for (auto& s : all) {
+            if (s->worker.joinable()) {
+                s->worker.join();
+            }
+        }
+        started = false;
+    }
+
+    bool running() const { return started; }
+
+    // Same as shard::post(), from the thread that called start().
+    bool post(std::size_t to, message::handler run, void* target, std::uint64_t a = 0, std::uint64_t b = 0) {
+        return send(all.size(), to, run, target, a, b);
+    }
+
+    bool post_set_values(std::size_t to, backend::line_request& lines, std::uint64_t mask, std::uint64_t bits) {
+        return post(to, &shard::apply_set_values, &lines, mask, bits);
+    }
+
+    // After stop(): rethrows the first exception a shard's handler threw, if any did.
+    void rethrow_failure() {
+        for (auto& s : all) {
+            if (s->failure) {
+                std::exception_ptr failure = s->failure;
+                s->failure = nullptr;
+                std::rethrow_exception(failure);
+            }
+        }
+    }
+
+    void print(std::ostream& out) const {
+        for (const auto& s : all) {
+            s->print(out);
+        }
+    }
+
+private:
+    friend class shard;
+
+    bool send(std::size_t from, std::size_t to, message::handler run, void* target, std::uint64_t a, std::uint64_t b) {
+        if (!started) {
+            throw std::system_error(EAGAIN, std::generic_category(), "can't post before the runtime is started");
+        }
+        return all.at(to)->deliver(from, message{run, target, a, b, backend::monotonic_ns()});
+    }
+
+    std::vector<std::unique_ptr<backend::chip>> chips; // the ones add_chip() opened
+    std::vector<std::unique_ptr<shard>> all;
+    bool started{false};
+};
+
+inline bool shard::post(std::size_t to, message::handler run, void* target, std::uint64_t a, std::uint64_t b) {
+    return owner->send(position, to, run, target, a, b);
+}
+
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "tasks.hpp"
+
+/*
+Hundreds of outputs on three lines: 74HC595 shift registers.
+
+A 74HC595 has a data input, a shift clock (SRCLK) and a latch (RCLK). Every rising clock edge shifts the data bit in
+and moves the 8 bits along by one, the last one spills out of QH' into the next register of the chain. Nothing shows
+on the outputs until the latch rises, then all of them change at once. Chain 32 of them and the same three lines
+drive 256 LEDs.
+
+A frame is a framebuffer with one bit per output. Output 0 is QA of the register next to the pi, output 7 its QH,
+output 8 QA of the second register and so on. The bit for the far end has to go in first, so a frame is shifted out
+last output first.
+
+Clocking is bit-banging, so it's all about set_values() calls. A frame is compiled up front into the values the
+lines go through, two writes per bit:
+  - data set and clock low (the latch drops with it, it doesn't matter when that happens)
+  - clock high with the same data, which shifts the bit in. The data was set one write earlier, plenty of setup time.
+and one more at the end that drops the clock and raises the latch. 2 * bits + 1 writes a frame.
+
+Several chains can share the clock and the latch, each with its own data line. One write then clocks a bit into
+every chain: 256 outputs as 4 chains of 64 take 129 writes a frame instead of 513. All the lines have to be in the
+same request (and like everything else here the request can have 64 lines at most).
+
+play() compiles every frame of an animation before the clock starts and writes them out on absolute deadlines
+(deadline_timer.hpp), blocking or as a task like frames::frame_player. The stats say how many bits went into the
+registers and how long the writes took, which gives the bit rate the lines manage and the most frames a second
+they could show.
+*/
+namespace shiftreg {
+
+// One bit per output.
+class framebuffer {
+public:
+    framebuffer() = default;
+    explicit framebuffer(std::size_t num_outputs) : num_outputs(num_outputs), words((num_outputs + 63) / 64, 0) {}
+
+    std::size_t size() const { return num_outputs; }
+
+    bool get(std::size_t output) const {
+        check(output);
+        return (words[output / 64] >> (output % 64)) & 1;
+    }
+
+    void set(std::size_t output, bool on = true) {
+        check(output);
+        std::uint64_t bit = 1ull << (output % 64);
+        words[output / 64] = on ? words[output / 64] | bit : words[output / 64] & ~bit;
+    }
+
+    void fill(bool on) {
+        for (std::size_t i = 0; i < words.size(); i++) {
+            std::size_t left = num_outputs - i * 64;
+            words[i] = !on ? 0 : left >= 64 ? ~0ull : (1ull << left) - 1;
+        }
+    }
+
+    // Outputs 64 * index .. 64 * index + 63 as a bitmask (bit i = output 64 * index + i).
+    std::uint64_t word(std::size_t index) const { return index < words.size() ? words[index] : 0; }
+
+    bool operator==(const framebuffer& other) const = default;
+
+private:
+    void check(std::size_t output) const {
+        if (output >= num_outputs) {
+            throw std::system_error(EINVAL, std::generic_category(), "output " + std::to_string(output) + " isn't in the framebuffer");
+        }
+    }
+
+    std::size_t num_outputs{0};
+    std::vector<std::uint64_t> words;
+};
+
+struct panel_frame {
+    framebuffer image;
+    std::chrono::microseconds duration;
+};
+
+using animation = std::vector<panel_frame>;
+
+// The lines the registers hang off. One data line per chain, the chains share clock and latch.
+struct wiring {
+    std::vector<unsigned int> data;
+    unsigned int clock{0};
+    unsigned int latch{0};
+};
+
+struct shift_stats {
+    std::uint64_t frames{0};
+    std::uint64_t writes{0};   // set_values() calls
+    std::uint64_t bits{0};     // bits clocked into the registers, all chains together
+    std::uint64_t busy_ns{0};  // time spent writing
+};
+
+class shift_register_output {
+public:
+    // num_outputs is rounded up to whole registers and split evenly over the chains.
+    shift_register_output(backend::line_request& lines, const wiring& pins, std::size_t num_outputs)
+        : lines(&lines), num_outputs(num_outputs) {
+        if (pins.data.empty() || num_outputs == 0) {
+            throw std::system_error(EINVAL, std::generic_category(), "shift registers need at least one data line and one output");
+        }
+        for (unsigned int offset : pins.data) {
+            data_bits.push_back(lines.line_bit(offset));
+            all_lines |= data_bits.back();
+        }
+        clock_bit = lines.line_bit(pins.clock);
+        latch_bit = lines.line_bit(pins.latch);
+        all_lines |= clock_bit | latch_bit;
+
+        std::size_t per_chain = (num_outputs + pins.data.size() - 1) / pins.data.size();
+        chain_depth = (per_chain + 7) / 8 * 8;
+    }
+
+    std::size_t size() const { return num_outputs; }
+    std::size_t chains() const { return data_bits.size(); }
+    std::size_t depth() const { return chain_depth; } // outputs per chain, i.e. clock pulses per frame
+
+    // The values the lines go through to show image (see the top of this file). Outputs the framebuffer doesn't
+    // have are switched off.
+    std::vector<std::uint64_t> compile(const framebuffer& image) const {
+        if (image.size() > num_outputs) {
+            throw std::system_error(EINVAL, std::generic_category(), "the framebuffer has more outputs than the shift registers");
+        }
+        std::vector<std::uint64_t> sequence;
+        sequence.reserve(2 * chain_depth + 1);
+
+        for (std::size_t step = 0; step < chain_depth; step++) {
+            std::size_t position = chain_depth - 1 - step;
+            std::uint64_t data = 0;
+            for (std::size_t chain = 0; chain < data_bits.size(); chain++) {
+                std::size_t output = chain * chain_depth + position;
+                if (output < image.size() && image.get(output)) {
+                    data |= data_bits[chain];
+                }
+            }
+            sequence.push_back(data);
+            sequence.push_back(data | clock_bit);
+        }
+        sequence.push_back(latch_bit);
+        return sequence;
+    }
+
+    // Clock out one compiled frame.
+    void write(const std::vector<std::uint64_t>& sequence) {
+        std::uint64_t start = backend::monotonic_ns();
+        for (std::uint64_t values : sequence) {
+            lines->set_values(all_lines, values);
+        }
+        totals.busy_ns += backend::monotonic_ns() - start;
+        totals.frames++;
+        totals.writes += sequence.size();
+        totals.bits += sequence.size() / 2 * data_bits.size();
+    }
+
+    void show(const framebuffer& image) {
+        write(compile(image));
+        shown = image;
+    }
+
+    // The last frame show() or play() put on the outputs.
+    const framebuffer& showing() const { return shown; }
+
+    void play(const animation& frames, unsigned int repeats = 1) {
+        prepare(frames);
+
+        timer.start();
+        for (unsigned int round = 0; round < repeats; round++) {
+            for (std::size_t i = 0; i < frames.size(); i++) {
+                write(sequences[i]);
+                shown = frames[i].image;
+                if (frames[i].duration.count() > 0) {
+                    timer.wait(frames[i].duration);
+                }
+            }
+        }
+    }
+
+    // The same as a task. The animation is copied into the task, the output has to outlive it.
+    tasks::task<> play(tasks::scheduler& sched, animation frames, unsigned int repeats = 1) {
+        prepare(frames);
+
+        timer.start();
+        for (unsigned int round = 0; round < repeats; round++) {
+            for (std::size_t i = 0; i < frames.size(); i++) {
+                write(sequences[i]);
+                shown = frames[i].image;
+                if (frames[i].duration.count() > 0) {
+                    co_await sched.wait(timer, frames[i].duration);
+                }
+            }
+        }
+    }
+
+    const shift_stats& stats() const { return totals; }
+
+    // Bits per second while writing.
+    double bit_rate() const { return totals.busy_ns ? static_cast<double>(totals.bits) * 1e9 / static_cast<double>(totals.busy_ns) : 0.0; }
+
+    // How many frames a second the lines could take if there was nothing else to do.
+    double frames_per_second() const { return totals.busy_ns ? static_cast<double>(totals.frames) * 1e9 / static_cast<double>(totals.busy_ns) : 0.0; }
+
+    // How late each frame after the first went out compared to its deadline.
+    const metrics::latency_histogram& lateness() const { return timer.lateness(); }
+
+    void print(std::ostream& out) const {
+        out << "Shift registers: " << num_outputs << " outputs on " << data_bits.size() << (data_bits.size() == 1 ? " chain" : " chains")
+            << ", " << totals.frames << " frames, " << (totals.frames ? totals.writes / totals.frames : 0) << " writes per frame, "
+            << static_cast<std::uint64_t>(bit_rate()) << " bits/s, up to " << static_cast<std::uint64_t>(frames_per_second()) << " frames/s" << '\n';
+        out << "Frame lateness: " << timer.lateness().summary_us() << '\n';
+    }
+
+private:
+    // compile every frame once, before the clock starts.
+    void prepare(const animation& frames) {
+        sequences.clear();
+        for (const auto& frame : frames) {
+            sequences.push_back(compile(frame.image));
+        }
+    }
+
+    backend::line_request* lines;
+    std::size_t num_outputs;
+    std::size_t chain_depth{0};
+    std::vector<std::uint64_t> data_bits; // request bit of each chain's data line
+    std::uint64_t clock_bit{0};
+    std::uint64_t latch_bit{0};
+    std::uint64_t all_lines{0};
+    std::vector<std::vector<std::uint64_t>> sequences;
+    framebuffer shown;
+    shift_stats totals;
+    timing::deadline_timer timer;
+};
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "gpio_sim.hpp"
+#include "shift_register.hpp"
+
+/*
+Pretend 74HC595 chains for the simulated chip, to check what shift_register.hpp clocks out really lands where it
+should.
+
+It watches the data, clock and latch lines through the chip's on_output hook (so, like sim_ultrasonic, nothing else
+can use that hook) and does what the registers do: a rising clock shifts every chain's data bit in, a rising latch
+copies the shift registers to the outputs. outputs() is what the LEDs would show, numbered like a
+shiftreg::framebuffer with the same wiring and size.
+
+The hook runs on whichever thread writes the lines, read the results once the writing is done.
+*/
+namespace backend {
+
+class sim_shift_register {
+public:
+    sim_shift_register(sim_chip& chip, const shiftreg::wiring& pins, std::size_t num_outputs)
+        : chip(&chip), pins(pins), latched(num_outputs), data_levels(pins.data.size(), false) {
+        std::size_t per_chain = (num_outputs + pins.data.size() - 1) / pins.data.size();
+        depth = (per_chain + 7) / 8 * 8;
+        registers.assign(pins.data.size(), std::vector<bool>(depth, false));
+        chip.on_output([this](unsigned int offset, bool level, std::uint64_t) { on_output(offset, level); });
+    }
+
+    ~sim_shift_register() { chip->on_output(nullptr); }
+
+    sim_shift_register(const sim_shift_register&) = delete;
+    sim_shift_register& operator=(const sim_shift_register&) = delete;
+
+    const shiftreg::framebuffer& outputs() const { return latched; }
+
+    std::uint64_t clock_pulses() const { return pulses; }
+    std::uint64_t latches() const { return latch_count; }
+
+private:
+    void on_output(unsigned int offset, bool level) {
+        for (std::size_t chain = 0; chain < pins.data.size(); chain++) {
+            if (offset == pins.data[chain]) {
+                data_levels[chain] = level;
+            }
+        }
+        if (offset == pins.clock && level) {
+            // everything moves one position further from the pi, the new bit goes in at position 0.
+            head = (head + depth - 1) % depth;
+            for (std::size_t chain = 0; chain < registers.size(); chain++) {
+                registers[chain][head] = data_levels[chain];
+            }
+            pulses++;
+        }
+        if (offset == pins.latch && level) {
+            for (std::size_t output = 0; output < latched.size(); output++) {
+                latched.set(output, registers[output / depth][(head + output % depth) % depth]);
+            }
+            latch_count++;
+        }
+    }
+
+    sim_chip* chip;
+    shiftreg::wiring pins;
+    shiftreg::framebuffer latched;
+    std::vector<bool> data_levels;
+    std::vector<std::vector<bool>> registers; // a ring per chain, position p is registers[chain][(head + p) % depth]
+    std::size_t depth{0};
+    std::size_t head{0};
+    std::uint64_t pulses{0};
+    std::uint64_t latch_count{0};
+};
+
+}
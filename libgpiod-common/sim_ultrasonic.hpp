@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "gpio_sim.hpp"
+
+/*
+Fake HC-SR04 ultrasonic sensors for the simulated chip, so the sensor example and the benchmarks have something
+answering their trigger pulses.
+
+Every sensor watches its trigger output (through the chip's on_output hook, so nothing else can use that hook).
+When the trigger pulse ends it does what the real part does: about 450us later the echo line goes high and stays high
+for as long as sound would take to reach an object `distance_cm` away and come back. With nothing in range (a
+negative distance) the echo stays high for 38ms, the sensor's own timeout.
+
+A trigger that comes in while the sensor is still busy with the previous one is ignored, like on the real part.
+
+Real sensors are noisy, set_noise() adds some jitter to every echo and now and then a wild reading (an echo off
+something else entirely).
+*/
+namespace backend {
+
+class sim_ultrasonic {
+public:
+    explicit sim_ultrasonic(sim_chip& chip) : chip(&chip) {
+        chip.on_output([this](unsigned int offset, bool level, std::uint64_t timestamp_ns) { on_output(offset, level, timestamp_ns); });
+        worker = std::thread(&sim_ultrasonic::run, this);
+    }
+
+    ~sim_ultrasonic() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running = false;
+        }
+        wake.notify_all();
+        worker.join();
+        chip->on_output(nullptr);
+    }
+
+    sim_ultrasonic(const sim_ultrasonic&) = delete;
+    sim_ultrasonic& operator=(const sim_ultrasonic&) = delete;
+
+    // Add every sensor before the trigger lines are written to. Returns the sensor's index.
+    std::size_t add_sensor(unsigned int trigger, unsigned int echo, double distance_cm) {
+        sensors.push_back(std::make_unique<sensor>());
+        sensors.back()->trigger = trigger;
+        sensors.back()->echo = echo;
+        sensors.back()->distance_cm = distance_cm;
+        return sensors.size() - 1;
+    }
+
+    void set_distance(std::size_t index, double distance_cm) { sensors.at(index)->distance_cm = distance_cm; }
+
+    // jitter_cm is the standard deviation added to every reading, outlier_chance (0..1) how often a reading is
+    // replaced by a random distance between 2cm and 4m.
+    void set_noise(std::size_t index, double jitter_cm, double outlier_chance) {
+        std::lock_guard<std::mutex> guard(lock);
+        sensors.at(index)->jitter_cm = jitter_cm;
+        sensors.at(index)->outlier_chance = outlier_chance;
+    }
+
+    // Trigger pulses that got an echo.
+    std::uint64_t pings() const { return ping_count.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr std::uint64_t ECHO_DELAY_NS{450000};     // trigger end to echo start
+    static constexpr std::uint64_t NO_OBJECT_NS{38000000};    // echo length with nothing in range
+    static constexpr double SPEED_OF_SOUND{0.0343};           // cm per microsecond
+
+    struct sensor {
+        unsigned int trigger{0};
+        unsigned int echo{0};
+        std::atomic<double> distance_cm{0};
+        std::uint64_t busy_until{0}; // guarded by lock, like the noise settings
+        double jitter_cm{0};
+        double outlier_chance{0};
+    };
+
+    struct echo_edge {
+        std::uint64_t at;
+        unsigned int offset;
+        bool level;
+        bool operator>(const echo_edge& other) const { return at > other.at; }
+    };
+
+    void on_output(unsigned int offset, bool level, std::uint64_t timestamp_ns) {
+        if (level) {
+            return; // it's the end of the trigger pulse that starts a measurement
+        }
+        for (auto& s : sensors) {
+            if (s->trigger != offset) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (timestamp_ns < s->busy_until) {
+                continue;
+            }
+
+            double distance = s->distance_cm.load(std::memory_order_relaxed);
+            if (distance >= 0 && s->outlier_chance > 0 && std::uniform_real_distribution<double>(0, 1)(noise) < s->outlier_chance) {
+                distance = std::uniform_real_distribution<double>(2, 400)(noise);
+            } else if (distance >= 0 && s->jitter_cm > 0) {
+                distance = std::max(0.0, distance + std::normal_distribution<double>(0, s->jitter_cm)(noise));
+            }
+            std::uint64_t echo_ns = distance < 0 ? NO_OBJECT_NS : static_cast<std::uint64_t>(distance * 2 / SPEED_OF_SOUND * 1000);
+
+            std::uint64_t rise = timestamp_ns + ECHO_DELAY_NS;
+            s->busy_until = rise + echo_ns;
+            pending.push(echo_edge{rise, s->echo, true});
+            pending.push(echo_edge{rise + echo_ns, s->echo, false});
+            ping_count.fetch_add(1, std::memory_order_relaxed);
+            wake.notify_all();
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (running) {
+            if (pending.empty()) {
+                wake.wait(guard);
+                continue;
+            }
+            echo_edge next = pending.top();
+            std::uint64_t now = monotonic_ns();
+            if (next.at > now) {
+                wake.wait_for(guard, std::chrono::nanoseconds(next.at - now));
+                continue;
+            }
+            pending.pop();
+
+            // the edge gets the time it was due, not the time this thread woke up to deliver it.
+            guard.unlock();
+            chip->inject_edge(next.offset, next.level ? edge_event::event_type::RISING_EDGE : edge_event::event_type::FALLING_EDGE, next.at);
+            guard.lock();
+        }
+    }
+
+    sim_chip* chip;
+    std::vector<std::unique_ptr<sensor>> sensors;
+    std::atomic<std::uint64_t> ping_count{0};
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::priority_queue<echo_edge, std::vector<echo_edge>, std::greater<echo_edge>> pending;
+    std::minstd_rand noise{42};
+    bool running{true};
+    std::thread worker;
+};
+
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "histogram.hpp"
+
+/*
+Software PWM for any number of output lines of one line request.
+
+The lines can only be fully on or fully off, but switch one fast enough and the on/off ratio (the duty cycle) looks
+like brightness to an eye or volume to an ear. Every channel has its own frequency and duty cycle.
+
+All channels run on one thread. Their rising and falling edges are merged into one schedule sorted by time, and every
+transition that falls within merge_window of the earliest one goes out in the same set_values() call. So 20 channels
+at the same frequency cost one write per edge, not twenty. It also means a channel can't show a pulse (or a gap) that
+isn't longer than merge_window: a duty that small rounds to fully off, one that close to 1 to fully on.
+
+The thread can be pinned to a cpu and given SCHED_FIFO priority (needs root or CAP_SYS_NICE) so nothing else on the
+system gets in the way of the edges.
+
+report() compares what each channel actually did (timed from the moment the writes returned) against what was asked
+for, which is how you find out how many channels a core can keep up with.
+
+If a duty change was caused by something with a timestamp (an edge event), pass that timestamp to set_duty() and give
+the pwm a metrics::line_latencies with record_reactions(): when the write that starts the first period with that duty
+returns, the time since the cause is recorded for that channel's line.
+*/
+namespace pwm {
+
+struct channel_report {
+    unsigned int offset;
+    double requested_hz;
+    double requested_duty;
+    double achieved_hz;
+    double achieved_duty;
+    double duty_error; // achieved_duty - requested_duty
+};
+
+class soft_pwm {
+public:
+    explicit soft_pwm(backend::line_request& lines, std::chrono::nanoseconds merge_window = std::chrono::microseconds(2))
+        : lines(&lines), merge_ns(static_cast<std::uint64_t>(merge_window.count())) {}
+
+    ~soft_pwm() { stop(); }
+
+    soft_pwm(const soft_pwm&) = delete;
+    soft_pwm& operator=(const soft_pwm&) = delete;
+
+    // Channels have to be added before start(), their duty cycle and frequency can change at any time after.
+    void add_channel(unsigned int offset, double frequency_hz, double duty) {
+        if (running) {
+            throw std::system_error(EBUSY, std::generic_category(), "can't add pwm channels while running");
+        }
+        channels.push_back(std::make_unique<channel>());
+        channels.back()->offset = offset;
+        channels.back()->bit = lines->line_bit(offset);
+        set_channel(channels.size() - 1, frequency_hz, duty);
+    }
+
+    // Takes effect at the start of the channel's next period. duty is 0..1.
+    void set_channel(std::size_t index, double frequency_hz, double duty) {
+        channels.at(index)->setting.store(pack(frequency_hz, duty), std::memory_order_relaxed);
+    }
+
+    // cause_ns is the (CLOCK_MONOTONIC) timestamp of whatever made you change the duty, 0 if there's nothing to time.
+    void set_duty(std::size_t index, double duty, std::uint64_t cause_ns = 0) {
+        std::atomic<std::uint64_t>& setting = channels.at(index)->setting;
+        std::uint64_t was = setting.load(std::memory_order_relaxed);
+        while (!setting.compare_exchange_weak(was, pack(frequency_of(was), duty), std::memory_order_relaxed)) {}
+        if (cause_ns) {
+            channels.at(index)->cause_ns.store(cause_ns, std::memory_order_release);
+        }
+    }
+
+    // Call before start(). Every channel's line gets tracked in `table`.
+    void record_reactions(metrics::line_latencies* table) {
+        reactions = table;
+        for (const auto& ch : channels) {
+            if (reactions) {
+                reactions->track(ch->offset);
+            }
+        }
+    }
+
+    std::size_t num_channels() const { return channels.size(); }
+
+    // cpu < 0 leaves the thread wherever the scheduler puts it, fifo_priority 0 leaves it as a normal thread.
+    void start(int cpu = -1, int fifo_priority = 0) {
+        if (running.exchange(true)) {
+            return;
+        }
+        worker = std::thread(&soft_pwm::run, this);
+
+        int error = 0;
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            error = pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus);
+        }
+        if (!error && fifo_priority > 0) {
+            sched_param param{};
+            param.sched_priority = fifo_priority;
+            error = pthread_setschedparam(worker.native_handle(), SCHED_FIFO, &param);
+        }
+        if (error) {
+            stop();
+            throw std::system_error(error, std::generic_category(), "can't pin/prioritise the pwm thread");
+        }
+    }
+
+    // Stops the thread and leaves every channel off.
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        worker.join();
+
+        std::uint64_t all = 0;
+        for (const auto& ch : channels) {
+            all |= ch->bit;
+        }
+        lines->set_values(all, 0);
+    }
+
+    std::vector<channel_report> report() const {
+        std::vector<channel_report> reports;
+        for (const auto& ch : channels) {
+            std::uint64_t setting = ch->setting.load(std::memory_order_relaxed);
+            channel_report r{ch->offset, frequency_of(setting), duty_of(setting), 0, 0, 0};
+
+            std::uint64_t periods = ch->periods.load(std::memory_order_relaxed);
+            std::uint64_t measured_ns = ch->measured_ns.load(std::memory_order_relaxed);
+            if (periods > 0 && measured_ns > 0) {
+                r.achieved_hz = static_cast<double>(periods) * 1e9 / static_cast<double>(measured_ns);
+                r.achieved_duty = static_cast<double>(ch->high_ns.load(std::memory_order_relaxed)) / static_cast<double>(measured_ns);
+                r.duty_error = r.achieved_duty - r.requested_duty;
+            }
+            reports.push_back(r);
+        }
+        return reports;
+    }
+
+    // set_values() calls made and how late they went out.
+    std::uint64_t batches() const { return batch_count.load(std::memory_order_relaxed); }
+    const metrics::latency_histogram& lateness() const { return timer.lateness(); }
+
+private:
+    // A channel's frequency and duty are two floats in one 64-bit atomic, so a period never starts with the new
+    // frequency and the old duty (or the other way round). A float's 7 digits are plenty for both.
+    static std::uint64_t pack(double frequency_hz, double duty) {
+        float hz = static_cast<float>(frequency_hz);
+        float clamped = static_cast<float>(std::min(1.0, std::max(0.0, duty)));
+        return std::uint64_t{std::bit_cast<std::uint32_t>(hz)} << 32 | std::bit_cast<std::uint32_t>(clamped);
+    }
+    static double frequency_of(std::uint64_t setting) { return std::bit_cast<float>(static_cast<std::uint32_t>(setting >> 32)); }
+    static double duty_of(std::uint64_t setting) { return std::bit_cast<float>(static_cast<std::uint32_t>(setting)); }
+
+    struct channel {
+        unsigned int offset{0};
+        std::uint64_t bit{0};
+        std::atomic<std::uint64_t> setting{0}; // frequency and duty, see pack()
+        std::atomic<std::uint64_t> cause_ns{0};
+
+        // only touched by the pwm thread.
+        bool level{false};
+        bool rising_next{true};
+        std::uint64_t period_start{0};
+        std::uint64_t period_ns{0};
+        std::uint64_t last_rise_write{0};
+        std::uint64_t last_period_write{0};
+        std::uint64_t reacting_to{0}; // cause of the duty change the next boundary write applies
+
+        // written by the pwm thread, read by report().
+        std::atomic<std::uint64_t> periods{0};
+        std::atomic<std::uint64_t> high_ns{0};
+        std::atomic<std::uint64_t> measured_ns{0};
+    };
+
+    struct transition {
+        std::uint64_t at;
+        std::size_t index;
+        bool operator>(const transition& other) const { return at > other.at; }
+    };
+
+    struct due_transition {
+        std::size_t index;
+        bool boundary;  // a period boundary (rising edge), otherwise a falling edge
+        bool was_high;  // the level the channel had before this transition
+    };
+
+    // Begins a new period for a channel at its (absolute) start time, sets the level the channel should go to
+    // and returns when it next needs attention.
+    std::uint64_t begin_period(channel& ch, std::uint64_t start) {
+        // the cause first: if there is one, the duty that came with it is already stored.
+        std::uint64_t cause = ch.cause_ns.exchange(0, std::memory_order_acquire);
+        std::uint64_t setting = ch.setting.load(std::memory_order_relaxed);
+        double hz = frequency_of(setting);
+        double duty = duty_of(setting);
+        if (cause) {
+            ch.reacting_to = cause;
+        }
+        ch.period_start = start;
+        ch.period_ns = hz > 0 ? static_cast<std::uint64_t>(1e9 / hz) : 1000000000;
+        std::uint64_t on_ns = static_cast<std::uint64_t>(std::llround(duty * static_cast<double>(ch.period_ns)));
+
+        // a pulse (or gap) shorter than the merge window would go out in the same write as the edge that starts it,
+        // so it can't be shown. Round it to fully off (or fully on) instead.
+        if (on_ns <= merge_ns) {
+            on_ns = 0;
+        } else if (ch.period_ns - std::min(on_ns, ch.period_ns) <= merge_ns) {
+            on_ns = ch.period_ns;
+        }
+
+        if (on_ns == 0 || on_ns >= ch.period_ns) {
+            // fully off or fully on: no falling edge this period.
+            ch.level = on_ns != 0;
+            ch.rising_next = true;
+            return start + ch.period_ns;
+        }
+        ch.level = true;
+        ch.rising_next = false;
+        return start + on_ns;
+    }
+
+    // Sleeps in short slices when the next edge is far away so stop() never waits long.
+    void wait_for(std::uint64_t deadline) {
+        const std::uint64_t slice = 20000000;
+        while (running.load(std::memory_order_relaxed) && deadline > backend::monotonic_ns() + slice) {
+            timespec pause{0, static_cast<long>(slice / 2)};
+            nanosleep(&pause, nullptr);
+        }
+        timer.sleep_until(deadline);
+    }
+
+    void run() {
+        std::priority_queue<transition, std::vector<transition>, std::greater<transition>> schedule;
+        std::vector<due_transition> due;
+        due.reserve(channels.size());
+
+        // every channel starts its first period on the same first write.
+        std::uint64_t mask = 0;
+        std::uint64_t bits = 0;
+        std::uint64_t start = backend::monotonic_ns() + 1000000;
+        for (std::size_t i = 0; i < channels.size(); i++) {
+            channel& ch = *channels[i];
+            schedule.push(transition{begin_period(ch, start), i});
+            mask |= ch.bit;
+            bits |= ch.level ? ch.bit : 0;
+        }
+        wait_for(start);
+        lines->set_values(mask, bits);
+        batch_count.fetch_add(1, std::memory_order_relaxed);
+        std::uint64_t written = backend::monotonic_ns();
+        for (auto& ch : channels) {
+            ch->last_rise_write = ch->last_period_write = written;
+        }
+
+        while (running.load(std::memory_order_relaxed) && !schedule.empty()) {
+            // pull everything due within the merge window of the earliest transition.
+            std::uint64_t batch_at = schedule.top().at;
+            mask = 0;
+            bits = 0;
+            due.clear();
+            while (!schedule.empty() && schedule.top().at <= batch_at + merge_ns) {
+                std::size_t index = schedule.top().index;
+                schedule.pop();
+
+                channel& ch = *channels[index];
+                due_transition next{index, ch.rising_next, ch.level};
+                if (next.boundary) {
+                    // the next period starts exactly where this one was meant to end, so nothing drifts.
+                    schedule.push(transition{begin_period(ch, ch.period_start + ch.period_ns), index});
+                } else {
+                    ch.level = false;
+                    ch.rising_next = true;
+                    schedule.push(transition{ch.period_start + ch.period_ns, index});
+                }
+                due.push_back(next);
+
+                // only lines that actually change go into the write. A channel can be due twice in one batch, the
+                // later transition wins.
+                if (ch.level != next.was_high) {
+                    mask |= ch.bit;
+                    bits = (bits & ~ch.bit) | (ch.level ? ch.bit : 0);
+                }
+            }
+
+            wait_for(batch_at);
+            if (!running.load(std::memory_order_relaxed)) {
+                break;
+            }
+            if (mask) {
+                lines->set_values(mask, bits);
+                batch_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            written = backend::monotonic_ns();
+
+            for (const auto& transition : due) {
+                record_write(*channels[transition.index], transition, written);
+            }
+        }
+    }
+
+    void record_write(channel& ch, const due_transition& transition, std::uint64_t written) {
+        if (transition.was_high && (!ch.level || transition.boundary)) {
+            // the line was high since the last rising write (up to now, or up to the end of a fully on period).
+            ch.high_ns.fetch_add(written - ch.last_rise_write, std::memory_order_relaxed);
+            ch.last_rise_write = written;
+        }
+        if (transition.boundary) {
+            ch.measured_ns.fetch_add(written - ch.last_period_write, std::memory_order_relaxed);
+            ch.periods.fetch_add(1, std::memory_order_relaxed);
+            ch.last_period_write = written;
+            if (ch.level) {
+                ch.last_rise_write = written;
+            }
+            if (ch.reacting_to) {
+                if (reactions) {
+                    reactions->record(ch.offset, written > ch.reacting_to ? written - ch.reacting_to : 0);
+                }
+                ch.reacting_to = 0;
+            }
+        }
+    }
+
+    backend::line_request* lines;
+    std::uint64_t merge_ns;
+    std::vector<std::unique_ptr<channel>> channels;
+    std::atomic<bool> running{false};
+    std::atomic<std::uint64_t> batch_count{0};
+    metrics::line_latencies* reactions{nullptr};
+    std::thread worker;
+    timing::deadline_timer timer;
+};
+
+}
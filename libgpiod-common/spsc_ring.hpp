@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+A lock-free single producer / single consumer ring buffer.
+
+One thread pushes, one other thread pops, nobody ever waits on a lock. The producer only writes `tail` and the
+consumer only writes `head`, each on its own cache line so the two threads don't keep stealing the line from
+each other.
+
+What happens when the ring is full is up to you (backpressure):
+- DROP_NEWEST: the new item is thrown away and counted, the producer never waits. Good when the producer is
+  draining something that must not back up (like the kernel's edge event queue).
+- BLOCK: the producer yields until there's room, nothing is lost. It calls notify() before it starts waiting, so a
+  consumer sleeping on notify_fd() wakes up even if the producer only notifies once per batch.
+
+It also keeps the highest fill level it has seen (peak_fill()), so you can tell how close you came to dropping things.
+
+notify_fd() is an eventfd the consumer can sleep on (poll/epoll/read) instead of spinning: push_notify() pokes it.
+*/
+namespace rings {
+
+enum class backpressure { DROP_NEWEST, BLOCK };
+
+template <typename T, std::size_t Capacity>
+class spsc_ring {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    explicit spsc_ring(backpressure policy = backpressure::DROP_NEWEST) : policy(policy) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't create the ring's eventfd");
+        }
+    }
+
+    ~spsc_ring() { ::close(wake_fd); }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // Producer side. Returns false if the item was dropped.
+    bool push(const T& item) {
+        std::size_t at = tail.load(std::memory_order_relaxed);
+        bool woke_consumer = false;
+        while (at - cached_head >= Capacity) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (at - cached_head < Capacity) {
+                break;
+            }
+            if (policy == backpressure::DROP_NEWEST) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // the consumer may be asleep waiting for a notify that only comes after this push: both would wait forever.
+            if (!woke_consumer) {
+                notify();
+                woke_consumer = true;
+            }
+            std::this_thread::yield();
+        }
+
+        slots[at & (Capacity - 1)] = item;
+        tail.store(at + 1, std::memory_order_release);
+
+        // cached_head can be a little behind the consumer, so this errs on the full side.
+        std::size_t fill = at + 1 - cached_head;
+        if (fill > producer_peak) {
+            producer_peak = fill;
+            peak.store(fill, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Producer side. Same as push() but wakes up a consumer sleeping on notify_fd().
+    bool push_notify(const T& item) {
+        bool pushed = push(item);
+        notify();
+        return pushed;
+    }
+
+    void notify() { eventfd_write(wake_fd, 1); }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool pop(T& item) {
+        std::size_t at = head.load(std::memory_order_relaxed);
+        if (at == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (at == cached_tail) {
+                return false;
+            }
+        }
+        item = slots[at & (Capacity - 1)];
+        head.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Blocks on notify_fd() until something is pushed (or notify() is called).
+    void wait() {
+        // the eventfd is non-blocking (so it can sit in an epoll set), so block in poll instead.
+        pollfd pfd{wake_fd, POLLIN, 0};
+        while (size() == 0 && poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+
+        eventfd_t ignored;
+        eventfd_read(wake_fd, &ignored);
+    }
+
+    int notify_fd() const { return wake_fd; }
+
+    // Consumer side, for an event loop watching notify_fd(): clears it so it only turns readable on the next push.
+    void consume_notify() {
+        eventfd_t ignored;
+        eventfd_read(wake_fd, &ignored);
+    }
+
+    std::size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    static constexpr std::size_t capacity() { return Capacity; }
+
+    std::uint64_t dropped_count() const { return dropped.load(std::memory_order_relaxed); }
+    std::size_t peak_fill() const { return peak.load(std::memory_order_relaxed); }
+
+private:
+    alignas(64) std::atomic<std::size_t> head{0};
+    std::size_t cached_tail{0};            // consumer's copy of tail
+
+    alignas(64) std::atomic<std::size_t> tail{0};
+    std::size_t cached_head{0};            // producer's copy of head
+    std::size_t producer_peak{0};
+
+    alignas(64) std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::size_t> peak{0};
+    backpressure policy;
+    int wake_fd{-1};
+
+    std::array<T, Capacity> slots{};
+};
+
+}
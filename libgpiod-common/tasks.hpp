@@ -0,0 +1,642 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "deadline_timer.hpp"
+#include "edge_reader.hpp"
+#include "gpio_backend.hpp"
+#include "histogram.hpp"
+#include "reactor.hpp"
+
+/*
+GPIO tasks as C++20 coroutines, all of them on one event loop thread.
+
+Blocking code reads nicely (trigger, sleep 10us, wait for the echo, wait for it to end) but every activity written
+like that needs a thread of its own to sit in its sleeps. The state machines in ranging.hpp and rules.hpp don't, but
+they're a lot harder to follow. Coroutines give you both: straight-line code that gives the thread back at every
+co_await, so hundreds of them can share one core.
+
+  tasks::task<> blink(tasks::scheduler& sched, backend::line_request& leds, unsigned int led) {
+      for (int i = 0; i < 5; i++) {
+          co_await sched.set_value(leds, led, backend::value::ACTIVE);
+          co_await sched.sleep_for(std::chrono::milliseconds(500));
+          co_await sched.set_value(leds, led, backend::value::INACTIVE);
+          co_await sched.sleep_for(std::chrono::milliseconds(500));
+      }
+  }
+
+  events::reactor loop;
+  tasks::scheduler sched(loop);
+  sched.spawn(blink(sched, *leds, 18));  // runs alongside whatever else the loop does, or
+  sched.run(blink(sched, *leds, 18));    // runs the loop until it's done
+
+What you can co_await:
+- sleep_until(deadline) / sleep_for(duration): a timerfd armed for the earliest sleeper (a heap of deadlines).
+- wait(deadline_timer, step): the next step of a deadline_timer (deadline_timer.hpp), so a pattern doesn't drift.
+- next_edge(request, offset, edge, timeout): the next edge on a line, std::nullopt if the timeout ran out first.
+  The request's fd is added to the loop the first time, and its events are read with an edge_reader (drop counting).
+  Every task waiting on the line gets the event. Events nobody was waiting for are kept (up to 64 per line) for the
+  next next_edge(), call discard_edges() to throw old ones away (before a trigger for example).
+- set_values(request, mask, bits) / set_value(request, offset, value): the writes of every task that runs in one go
+  (one batch of edges, one timer tick) are merged into one set_values() call per request, after which they all carry on.
+- another task<T>: runs it and gives you its result (or its exception).
+
+Tasks are lazy: nothing happens until they're awaited, spawn()ed or run(). An exception that leaves a spawned task
+stops the loop and is rethrown by rethrow_failure() (and by run()), so a hardware error still ends up in main's catch.
+
+Everything here belongs to the loop's thread. Parameters a task takes by reference have to outlive the task.
+*/
+namespace tasks {
+
+class scheduler;
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base {
+    std::coroutine_handle<> continuation; // whoever co_awaits this task
+    std::exception_ptr error;
+    scheduler* owner{nullptr};            // set for spawned tasks, nobody awaits those
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept;
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object();
+    void return_void() {}
+};
+
+}
+
+template <typename T>
+class [[nodiscard]] task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    task(task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    ~task() { reset(); }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    // co_await some_task: starts it, and carries on here once it's finished.
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) noexcept {
+        handle.promise().continuation = waiting;
+        return handle;
+    }
+    T await_resume() {
+        if (handle.promise().error) {
+            std::rethrow_exception(handle.promise().error);
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return std::move(*handle.promise().value);
+        }
+    }
+
+private:
+    friend class scheduler;
+
+    std::coroutine_handle<promise_type> release() { return std::exchange(handle, {}); }
+
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = {};
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+task<T> detail::promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::promise<void>::get_return_object() {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+class scheduler {
+    // What a suspended task is waiting for. It lives in the awaiter, inside the task's coroutine frame.
+    struct line_queue;
+
+    struct waiter {
+        std::coroutine_handle<> handle;
+        std::uint64_t deadline{0};
+        std::uint64_t timer_id{0};         // 0 = no timer
+
+        // edges
+        line_queue* queue{nullptr};
+        backend::edge wanted{backend::edge::BOTH};
+        std::optional<backend::edge_event> event;
+
+        // writes
+        backend::line_request* lines{nullptr};
+        std::uint64_t mask{0};
+        std::uint64_t bits{0};
+        std::exception_ptr error;
+
+        bool matches(const backend::edge_event& candidate) const {
+            bool rising = candidate.type() == backend::edge_event::event_type::RISING_EDGE;
+            return wanted == backend::edge::BOTH || wanted == (rising ? backend::edge::RISING : backend::edge::FALLING);
+        }
+    };
+
+    struct line_queue {
+        std::vector<waiter*> waiting;
+        std::deque<backend::edge_event> backlog;
+    };
+
+public:
+    // Events nobody is waiting for are kept for the next next_edge() on the line, up to this many.
+    static constexpr std::size_t EDGE_BACKLOG{64};
+
+    explicit scheduler(events::reactor& loop) : loop(&loop) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (timer < 0 || wake_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't set up the task scheduler");
+        }
+        loop.add(timer, [this](std::uint32_t) { on_timer(); });
+        loop.add(wake_fd, [this](std::uint32_t) { on_wake(); });
+    }
+
+    // Tasks that haven't finished are destroyed (their frames freed), they don't get to run to the end.
+    ~scheduler() {
+        loop->remove(timer);
+        loop->remove(wake_fd);
+        for (auto& watched : requests) {
+            loop->remove(watched.second->reader.fd());
+        }
+        for (auto& root : roots) {
+            root.second.destroy();
+        }
+        ::close(timer);
+        ::close(wake_fd);
+    }
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    // Starts the task on the loop's next turn and forgets about it (its result, if any, is thrown away).
+    template <typename T>
+    void spawn(task<T> started) {
+        auto handle = started.release();
+        handle.promise().owner = this;
+        roots.emplace(handle.address(), handle);
+        ready.push_back(handle);
+        eventfd_write(wake_fd, 1);
+    }
+
+    // Runs the loop until the task is finished and returns its result. Other tasks keep running meanwhile.
+    template <typename T>
+    T run(task<T> main_task) {
+        bool done = false;
+        if constexpr (std::is_void<T>::value) {
+            spawn(finish(std::move(main_task), done));
+            drive(done);
+        } else {
+            std::optional<T> result;
+            spawn(finish(std::move(main_task), result, done));
+            drive(done);
+            return std::move(*result);
+        }
+    }
+
+    // After loop.run() returns: throws whatever made a spawned task fail (and stopped the loop), if anything did.
+    void rethrow_failure() {
+        if (failure) {
+            std::exception_ptr failed = std::exchange(failure, nullptr);
+            std::rethrow_exception(failed);
+        }
+    }
+
+    // Spawned tasks that haven't finished yet.
+    std::size_t running() const { return roots.size(); }
+
+    class sleep_awaiter {
+    public:
+        sleep_awaiter(scheduler& owner, std::uint64_t deadline_ns) : owner(&owner) { state.deadline = deadline_ns; }
+        bool await_ready() const { return state.deadline <= backend::monotonic_ns(); }
+        void await_suspend(std::coroutine_handle<> handle) {
+            state.handle = handle;
+            owner->add_timer(state);
+        }
+        void await_resume() {}
+
+    private:
+        scheduler* owner;
+        waiter state;
+    };
+
+    sleep_awaiter sleep_until(std::uint64_t deadline_ns) { return sleep_awaiter(*this, deadline_ns); }
+    sleep_awaiter sleep_for(std::chrono::nanoseconds duration) {
+        return sleep_awaiter(*this, backend::monotonic_ns() + static_cast<std::uint64_t>(duration.count()));
+    }
+
+    class step_awaiter {
+    public:
+        step_awaiter(scheduler& owner, timing::deadline_timer& steps, std::chrono::nanoseconds step)
+            : sleep(owner, steps.advance(step)), steps(&steps) {}
+        bool await_ready() const { return sleep.await_ready(); }
+        void await_suspend(std::coroutine_handle<> handle) { sleep.await_suspend(handle); }
+        void await_resume() { steps->woke(backend::monotonic_ns()); }
+
+    private:
+        sleep_awaiter sleep;
+        timing::deadline_timer* steps;
+    };
+
+    // Like steps.wait(step), without blocking the thread.
+    step_awaiter wait(timing::deadline_timer& steps, std::chrono::nanoseconds step) { return step_awaiter(*this, steps, step); }
+
+    class edge_awaiter {
+    public:
+        edge_awaiter(scheduler& owner, backend::line_request& lines, unsigned int offset, backend::edge wanted, std::chrono::nanoseconds timeout)
+            : owner(&owner), queue(&owner.queue_for(lines, offset)), timeout_ns(static_cast<std::uint64_t>(timeout.count())) {
+            state.wanted = wanted;
+        }
+        // An event that came in before anyone asked for it is taken straight away.
+        bool await_ready() {
+            while (!queue->backlog.empty()) {
+                backend::edge_event queued = queue->backlog.front();
+                queue->backlog.pop_front();
+                if (state.matches(queued)) {
+                    state.event = queued;
+                    return true;
+                }
+            }
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            state.handle = handle;
+            state.queue = queue;
+            queue->waiting.push_back(&state);
+            if (timeout_ns) {
+                state.deadline = backend::monotonic_ns() + timeout_ns;
+                owner->add_timer(state);
+            }
+        }
+        std::optional<backend::edge_event> await_resume() { return state.event; }
+
+    private:
+        scheduler* owner;
+        line_queue* queue;
+        std::uint64_t timeout_ns;
+        waiter state;
+    };
+
+    // The next edge on a line of `lines` (which needs edge detection). A timeout of 0 waits forever.
+    edge_awaiter next_edge(backend::line_request& lines, unsigned int offset, backend::edge wanted = backend::edge::BOTH,
+                           std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0)) {
+        return edge_awaiter(*this, lines, offset, wanted, timeout);
+    }
+
+    // Forgets the events of a line that came in while nobody was waiting.
+    void discard_edges(backend::line_request& lines, unsigned int offset) { queue_for(lines, offset).backlog.clear(); }
+
+    class write_awaiter {
+    public:
+        write_awaiter(scheduler& owner, backend::line_request& lines, std::uint64_t mask, std::uint64_t bits) : owner(&owner) {
+            state.lines = &lines;
+            state.mask = mask;
+            state.bits = bits;
+        }
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            state.handle = handle;
+            owner->queue_write(state);
+        }
+        void await_resume() {
+            if (state.error) {
+                std::rethrow_exception(state.error);
+            }
+        }
+
+    private:
+        scheduler* owner;
+        waiter state;
+    };
+
+    write_awaiter set_values(backend::line_request& lines, std::uint64_t mask, std::uint64_t bits) { return write_awaiter(*this, lines, mask, bits); }
+    write_awaiter set_value(backend::line_request& lines, unsigned int offset, backend::value level) {
+        std::uint64_t bit = lines.line_bit(offset);
+        return write_awaiter(*this, lines, bit, level == backend::value::ACTIVE ? bit : 0);
+    }
+
+    // The edge_reader next_edge() reads a request's events with (seqno gaps, buffer sizes), nullptr if it has none yet.
+    const events::edge_reader* edges(const backend::line_request& lines) const {
+        auto found = requests.find(&lines);
+        return found == requests.end() ? nullptr : &found->second->reader;
+    }
+
+    std::uint64_t write_count() const { return writes; }               // set_values() calls made
+    std::uint64_t write_requests() const { return writes_requested; }  // co_await set_values()/set_value()
+    std::uint64_t edges_delivered() const { return delivered; }
+    std::uint64_t edges_dropped() const { return backlog_dropped; }    // backlog full, nobody was waiting
+    // How late sleeping tasks were woken up, from their deadline to being resumed.
+    const metrics::latency_histogram& wake_lateness() const { return lateness_ns; }
+
+private:
+    friend struct detail::promise_base::final_awaiter;
+
+    struct watched_request {
+        explicit watched_request(backend::line_request& lines) : reader(lines) {}
+        events::edge_reader reader;
+        std::unordered_map<unsigned int, line_queue> lines;
+    };
+
+    struct timer_entry {
+        std::uint64_t deadline;
+        std::uint64_t id;
+        bool operator>(const timer_entry& other) const { return deadline != other.deadline ? deadline > other.deadline : id > other.id; }
+    };
+
+    struct pending_write {
+        backend::line_request* lines;
+        std::uint64_t mask;
+        std::uint64_t bits;
+    };
+
+    template <typename T>
+    task<void> finish(task<T> main_task, std::optional<T>& result, bool& done) {
+        result.emplace(co_await main_task);
+        done = true;
+        loop->stop();
+    }
+
+    task<void> finish(task<void> main_task, bool& done) {
+        co_await main_task;
+        done = true;
+        loop->stop();
+    }
+
+    void drive(const bool& done) {
+        while (!done && !failure) {
+            loop->run();
+        }
+        rethrow_failure();
+    }
+
+    // A spawned task ran to the end (from its final suspend point).
+    void finished(std::coroutine_handle<> handle, std::exception_ptr error) {
+        roots.erase(handle.address());
+        handle.destroy();
+        if (error && !failure) {
+            failure = error;
+            loop->stop();
+        }
+    }
+
+    line_queue& queue_for(backend::line_request& lines, unsigned int offset) {
+        auto found = requests.find(&lines);
+        if (found == requests.end()) {
+            lines.line_bit(offset); // throws if the line isn't part of the request
+            auto added = std::make_unique<watched_request>(lines);
+            watched_request* watched = added.get();
+            loop->add(lines.fd(), [this, watched](std::uint32_t) { on_edges(*watched); });
+            found = requests.emplace(&lines, std::move(added)).first;
+        }
+        return found->second->lines[offset];
+    }
+
+    void add_timer(waiter& sleeper) {
+        sleeper.timer_id = ++last_timer_id;
+        timers.push(timer_entry{sleeper.deadline, sleeper.timer_id});
+        sleeping.emplace(sleeper.timer_id, &sleeper);
+    }
+
+    void cancel_timer(waiter& sleeper) {
+        if (sleeper.timer_id) {
+            sleeping.erase(sleeper.timer_id); // its heap entry is skipped when it comes up
+            sleeper.timer_id = 0;
+        }
+    }
+
+    void queue_write(waiter& writer) {
+        writes_requested++;
+        write_waiting.push_back(&writer);
+        for (auto& pending : pending_writes) {
+            if (pending.lines == writer.lines) {
+                pending.mask |= writer.mask;
+                pending.bits = (pending.bits & ~writer.mask) | (writer.bits & writer.mask);
+                return;
+            }
+        }
+        pending_writes.push_back(pending_write{writer.lines, writer.mask, writer.bits});
+    }
+
+    void on_wake() {
+        eventfd_t ignored;
+        eventfd_read(wake_fd, &ignored);
+        std::vector<std::coroutine_handle<>> starting;
+        starting.swap(ready);
+        for (auto handle : starting) {
+            handle.resume();
+        }
+        settle();
+    }
+
+    void on_edges(watched_request& watched) {
+        watched.reader.read([&](const backend::edge_event& event) {
+            line_queue& queue = watched.lines[event.line_offset()];
+
+            // everyone waiting for this kind of edge gets it, resumed right here so they're waiting again
+            // (or not) before the next event of the batch.
+            waking.clear();
+            auto kept = queue.waiting.begin();
+            for (waiter* candidate : queue.waiting) {
+                if (candidate->matches(event)) {
+                    waking.push_back(candidate);
+                } else {
+                    *kept++ = candidate;
+                }
+            }
+            queue.waiting.erase(kept, queue.waiting.end());
+
+            if (waking.empty()) {
+                if (queue.backlog.size() == EDGE_BACKLOG) {
+                    queue.backlog.pop_front();
+                    backlog_dropped++;
+                }
+                queue.backlog.push_back(event);
+                return;
+            }
+            delivered++;
+            std::vector<waiter*> resuming;
+            resuming.swap(waking);
+            for (waiter* woken : resuming) {
+                cancel_timer(*woken);
+                woken->event = event;
+            }
+            for (waiter* woken : resuming) {
+                woken->handle.resume();
+            }
+            resuming.swap(waking);
+        });
+        settle();
+    }
+
+    void on_timer() {
+        std::uint64_t expirations;
+        if (read(timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "reading the task timer failed");
+        }
+        armed_for = 0;
+        std::uint64_t now = backend::monotonic_ns();
+        while (!timers.empty() && timers.top().deadline <= now) {
+            timer_entry due = timers.top();
+            timers.pop();
+            auto found = sleeping.find(due.id);
+            if (found == sleeping.end()) {
+                continue; // cancelled
+            }
+            waiter& woken = *found->second;
+            sleeping.erase(found);
+            woken.timer_id = 0;
+
+            if (woken.queue) {
+                // an edge that didn't come in time: stop waiting for it, the task gets std::nullopt.
+                auto& waiting = woken.queue->waiting;
+                waiting.erase(std::remove(waiting.begin(), waiting.end(), &woken), waiting.end());
+            } else {
+                std::uint64_t resumed = backend::monotonic_ns();
+                lateness_ns.record(resumed > due.deadline ? resumed - due.deadline : 0);
+            }
+            woken.handle.resume();
+        }
+        settle();
+    }
+
+    // Writes what the tasks that just ran asked for, one set_values() per request, and lets them carry on. They may
+    // ask for more straight away, so round it goes until nobody is waiting for a write. Then re-arms the timer.
+    void settle() {
+        while (!write_waiting.empty()) {
+            std::vector<pending_write> writing;
+            std::vector<waiter*> writers;
+            writing.swap(pending_writes);
+            writers.swap(write_waiting);
+
+            for (const auto& pending : writing) {
+                try {
+                    pending.lines->set_values(pending.mask, pending.bits);
+                    writes++;
+                } catch (...) {
+                    // the tasks that asked for this write get the error instead of the loop.
+                    for (waiter* writer : writers) {
+                        if (writer->lines == pending.lines) {
+                            writer->error = std::current_exception();
+                        }
+                    }
+                }
+            }
+            for (waiter* writer : writers) {
+                writer->handle.resume();
+            }
+        }
+        arm();
+    }
+
+    void arm() {
+        while (!timers.empty() && sleeping.find(timers.top().id) == sleeping.end()) {
+            timers.pop();
+        }
+        std::uint64_t wanted = timers.empty() ? 0 : timers.top().deadline;
+        if (wanted == armed_for) {
+            return;
+        }
+        itimerspec spec{};
+        if (wanted) {
+            spec.it_value = timing::to_timespec(wanted);
+        }
+        timerfd_settime(timer, wanted ? TFD_TIMER_ABSTIME : 0, &spec, nullptr);
+        armed_for = wanted;
+    }
+
+    events::reactor* loop;
+    int timer{-1};
+    int wake_fd{-1};
+    std::uint64_t armed_for{0};
+
+    std::unordered_map<void*, std::coroutine_handle<>> roots; // spawned tasks
+    std::vector<std::coroutine_handle<>> ready;              // spawned, not started yet
+    std::exception_ptr failure;
+
+    std::priority_queue<timer_entry, std::vector<timer_entry>, std::greater<timer_entry>> timers;
+    std::unordered_map<std::uint64_t, waiter*> sleeping;     // timer id -> waiter, gone once cancelled
+    std::uint64_t last_timer_id{0};
+
+    std::unordered_map<const backend::line_request*, std::unique_ptr<watched_request>> requests;
+    std::vector<waiter*> waking;
+
+    std::vector<pending_write> pending_writes;
+    std::vector<waiter*> write_waiting;
+
+    std::uint64_t writes{0};
+    std::uint64_t writes_requested{0};
+    std::uint64_t delivered{0};
+    std::uint64_t backlog_dropped{0};
+    metrics::latency_histogram lateness_ns;
+};
+
+template <typename Promise>
+std::coroutine_handle<> detail::promise_base::final_awaiter::await_suspend(std::coroutine_handle<Promise> self) noexcept {
+    promise_base& finished = self.promise();
+    if (finished.continuation) {
+        return finished.continuation;
+    }
+    if (finished.owner) {
+        finished.owner->finished(self, finished.error);
+    }
+    return std::noop_coroutine();
+}
+
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/*
+A hierarchical timer wheel: thousands of timers, O(1) to start, cancel or expire each one.
+
+Time is counted in ticks (what a tick is, 1ms or 100us, is up to whoever uses it). There are 4 wheels of 64 slots.
+A timer due in less than 64 ticks goes straight into the slot for its tick on wheel 0. Timers further out go on
+wheel 1 (64 ticks per slot), wheel 2 (4096 ticks per slot) or wheel 3 (262144 ticks per slot), and whenever wheel 0
+comes round to slot 0 the next slot of wheel 1 is emptied back into the lower wheels, and so on up. So a timer is
+touched at most 4 times however far away it is, and nothing is ever sorted.
+
+Timers are identified by an index you pick (0..capacity-1), each one can be pending at most once. The slots are
+linked lists through a preallocated array, so starting and cancelling never allocate.
+
+Every wheel keeps a bitmap of its slots that have timers in them, so next_tick() can tell how long the wheel can be
+left alone (for a timerfd) and advance() skips straight over empty ticks.
+*/
+namespace timing {
+
+class timer_wheel {
+public:
+    static constexpr std::uint64_t NONE{std::numeric_limits<std::uint64_t>::max()};
+
+    explicit timer_wheel(std::size_t capacity = 0) : timers(capacity) {}
+
+    void resize(std::size_t capacity) { timers.resize(capacity); }
+    std::size_t capacity() const { return timers.size(); }
+
+    // The last tick advance() handled.
+    std::uint64_t now() const { return current; }
+
+    std::size_t pending() const { return count; }
+    bool is_pending(std::size_t id) const { return timers[id].level != UNUSED; }
+    std::uint64_t due(std::size_t id) const { return timers[id].expires; }
+
+    // Due ticks that already passed are moved up to the next tick. Starting a pending timer again moves it.
+    void start(std::size_t id, std::uint64_t expires) {
+        if (is_pending(id)) {
+            unlink(id);
+        } else {
+            count++;
+        }
+        timers[id].expires = expires > current ? expires : current + 1;
+        insert(id);
+    }
+
+    void cancel(std::size_t id) {
+        if (is_pending(id)) {
+            unlink(id);
+            count--;
+        }
+    }
+
+    // Hands every timer due up to and including tick `to` to expire(id), earliest tick first.
+    template <typename Expire>
+    void advance(std::uint64_t to, Expire expire) {
+        while (current < to) {
+            std::uint64_t next = next_tick();
+            if (next == NONE || next > to) {
+                current = to; // nothing due in between, and no cascade with anything in it
+                break;
+            }
+            current = next;
+            if ((current & MASK) == 0) {
+                cascade();
+            }
+            std::size_t& head = slots[0][current & MASK];
+            while (head != END) {
+                std::size_t id = head;
+                unlink(id);
+                count--;
+                expire(id);
+            }
+        }
+    }
+
+    // The next tick advance() has something to do at: a timer on wheel 0, or a cascade of a non-empty slot.
+    std::uint64_t next_tick() const {
+        if (count == 0) {
+            return NONE;
+        }
+        std::uint64_t best = NONE;
+        for (unsigned int level = 0; level < LEVELS; level++) {
+            // the first busy slot after the one we're in. On wheel 0 that's the tick itself (it only holds timers
+            // less than 64 ticks out), higher up it's the tick that slot gets emptied into the lower wheels.
+            std::uint64_t block = current >> (BITS * level);
+            std::uint64_t ahead = rotate(occupied[level], static_cast<unsigned int>(block & MASK) + 1);
+            if (ahead) {
+                std::uint64_t at = (block + 1 + static_cast<std::uint64_t>(__builtin_ctzll(ahead))) << (BITS * level);
+                best = at < best ? at : best;
+            }
+        }
+        return best;
+    }
+
+private:
+    static constexpr unsigned int BITS{6};
+    static constexpr std::size_t SLOTS{1u << BITS};
+    static constexpr std::uint64_t MASK{SLOTS - 1};
+    static constexpr unsigned int LEVELS{4};
+    static constexpr std::size_t END{std::numeric_limits<std::size_t>::max()};
+    static constexpr std::uint8_t UNUSED{0xff};
+
+    struct timer {
+        std::uint64_t expires{0};
+        std::size_t next{END};
+        std::size_t prev{END};
+        std::uint8_t level{UNUSED};
+        std::uint8_t slot{0};
+    };
+
+    // Bits of x from `by` upwards, wrapped round, so bit 0 of the result is slot `by`.
+    static std::uint64_t rotate(std::uint64_t x, unsigned int by) {
+        by &= MASK;
+        return by ? (x >> by) | (x << (SLOTS - by)) : x;
+    }
+
+    void insert(std::size_t id) {
+        timer& t = timers[id];
+        std::uint64_t delta = t.expires - current;
+        unsigned int level = 0;
+        while (level + 1 < LEVELS && delta >= (1ull << (BITS * (level + 1)))) {
+            level++;
+        }
+        // beyond the top wheel's reach it waits in the top wheel and gets put back each time round.
+        std::uint64_t slot = (t.expires >> (BITS * level)) & MASK;
+        t.level = static_cast<std::uint8_t>(level);
+        t.slot = static_cast<std::uint8_t>(slot);
+        t.prev = END;
+        t.next = slots[level][slot];
+        if (t.next != END) {
+            timers[t.next].prev = id;
+        }
+        slots[level][slot] = id;
+        occupied[level] |= 1ull << slot;
+    }
+
+    void unlink(std::size_t id) {
+        timer& t = timers[id];
+        if (t.prev != END) {
+            timers[t.prev].next = t.next;
+        } else {
+            slots[t.level][t.slot] = t.next;
+            if (t.next == END) {
+                occupied[t.level] &= ~(1ull << t.slot);
+            }
+        }
+        if (t.next != END) {
+            timers[t.next].prev = t.prev;
+        }
+        t.level = UNUSED;
+        t.next = t.prev = END;
+    }
+
+    // Empties the slot of each higher wheel that just came round, as far up as the wheels wrapped.
+    void cascade() {
+        for (unsigned int level = 1; level < LEVELS; level++) {
+            std::size_t index = (current >> (BITS * level)) & MASK;
+            std::size_t id = slots[level][index];
+            slots[level][index] = END;
+            occupied[level] &= ~(1ull << index);
+            while (id != END) {
+                std::size_t next = timers[id].next;
+                insert(id);
+                id = next;
+            }
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+
+    std::vector<timer> timers;
+    std::array<std::array<std::size_t, SLOTS>, LEVELS> slots{fill_slots()};
+    std::array<std::uint64_t, LEVELS> occupied{};
+    std::uint64_t current{0};
+    std::size_t count{0};
+
+    static std::array<std::array<std::size_t, SLOTS>, LEVELS> fill_slots() {
+        std::array<std::array<std::size_t, SLOTS>, LEVELS> empty;
+        for (auto& level : empty) {
+            level.fill(END);
+        }
+        return empty;
+    }
+};
+
+}
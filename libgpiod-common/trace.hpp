@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deadline_timer.hpp"
+#include "gpio_backend.hpp"
+#include "gpio_sim.hpp"
+
+/*
+Binary edge event traces.
+
+recorder appends every edge event as-is (a 32 byte backend::edge_event: offset, type, 64-bit timestamp, global and
+line seqno) to a memory-mapped file. Recording is a memcpy and a counter update, no formatting and no syscall, so it
+can sit right in the capture path. The pages belong to the kernel, so whatever was recorded is still in the file if
+the program crashes a moment later.
+
+Files have a fixed size and rotate: trace.0, trace.1, ... trace.<max_files - 1>, then trace.0 gets overwritten.
+So a unit can record forever and you always have the last max_files * records_per_file events. A new recorder
+deletes the files an earlier recording to the same path left behind.
+
+load() reads every file of a trace back in recording order, replay() plays events into a simulated chip at their
+original pace (or faster) so an incident can be reproduced and benchmarked on a desk.
+*/
+namespace trace {
+
+static_assert(std::is_trivially_copyable<backend::edge_event>::value, "edge events are written to disk as raw bytes");
+
+// 64 bytes at the start of every file.
+struct file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t capacity;  // records the file has room for
+    std::uint64_t sequence;  // 0 for the first file, then one more per rotation
+    std::uint64_t count;     // records written so far, updated after each record
+    std::uint64_t reserved[3];
+};
+static_assert(sizeof(file_header) == 64, "the header is part of the file format");
+
+constexpr char MAGIC[8] = {'G', 'P', 'I', 'O', 'T', 'R', 'C', '\0'};
+constexpr std::uint32_t VERSION{1};
+
+class recorder {
+public:
+    recorder(const std::string& base_path, std::size_t records_per_file = 1 << 20, unsigned int max_files = 4)
+        : base(base_path), capacity(std::max<std::size_t>(records_per_file, 1)), max_files(std::max(max_files, 1u)) {
+        remove_old_files();
+        open_next();
+    }
+
+    ~recorder() { close_current(); }
+
+    recorder(const recorder&) = delete;
+    recorder& operator=(const recorder&) = delete;
+
+    void record(const backend::edge_event& event) {
+        if (written == capacity) {
+            close_current();
+            open_next();
+        }
+        records[written++] = event;
+        // readers of a live file (or of a crash dump) only trust `count` records.
+        __atomic_store_n(&header->count, written, __ATOMIC_RELEASE);
+        total++;
+    }
+
+    void record(const backend::edge_event_buffer& buffer) {
+        for (const auto& event : buffer) {
+            record(event);
+        }
+    }
+
+    // Asks the kernel to start writing what we have to disk. It happens eventually anyway.
+    void flush() { msync(mapping, mapping_size, MS_ASYNC); }
+
+    std::uint64_t recorded() const { return total; }
+    std::uint64_t rotations() const { return sequence - 1; }
+
+private:
+    std::string file_name(std::uint64_t seq) const { return base + "." + std::to_string(seq % max_files); }
+
+    // An earlier (longer) recording to the same path leaves base.1, base.2, ... behind, and load() would splice them
+    // into this one. base.0 gets truncated by open_next() anyway.
+    void remove_old_files() {
+        for (unsigned int i = 1;; i++) {
+            std::string path = base + "." + std::to_string(i);
+            if (unlink(path.c_str()) < 0) {
+                if (errno == ENOENT) {
+                    return;
+                }
+                throw std::system_error(errno, std::generic_category(), "can't remove old trace file " + path);
+            }
+        }
+    }
+
+    void open_next() {
+        std::string path = file_name(sequence);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can't open trace file " + path);
+        }
+        mapping_size = sizeof(file_header) + capacity * sizeof(backend::edge_event);
+        if (ftruncate(fd, static_cast<off_t>(mapping_size)) < 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "can't size trace file " + path);
+        }
+        // MAP_POPULATE faults every page in now, at rotation, rather than one at a time while recording.
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        ::close(fd); // the mapping keeps the file
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::system_error(errno, std::generic_category(), "can't map trace file " + path);
+        }
+
+        header = static_cast<file_header*>(mapping);
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->record_size = sizeof(backend::edge_event);
+        header->capacity = capacity;
+        header->sequence = sequence++;
+        header->count = 0;
+        records = reinterpret_cast<backend::edge_event*>(static_cast<char*>(mapping) + sizeof(file_header));
+        written = 0;
+    }
+
+    void close_current() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+        }
+    }
+
+    std::string base;
+    std::size_t capacity;
+    unsigned int max_files;
+
+    void* mapping{nullptr};
+    std::size_t mapping_size{0};
+    file_header* header{nullptr};
+    backend::edge_event* records{nullptr};
+    std::size_t written{0};
+    std::uint64_t sequence{0};
+    std::uint64_t total{0};
+};
+
+// Reads one trace file. Returns its sequence number through `sequence`.
+inline std::vector<backend::edge_event> load_file(const std::string& path, std::uint64_t* sequence = nullptr) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "can't open trace file " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "can't stat trace file " + path);
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    void* mapping = size >= sizeof(file_header) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::system_error(EINVAL, std::generic_category(), path + " isn't a trace file");
+    }
+
+    const file_header* header = static_cast<const file_header*>(mapping);
+    std::uint64_t count = __atomic_load_n(&header->count, __ATOMIC_ACQUIRE);
+    bool valid = std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 && header->version == VERSION &&
+                 header->record_size == sizeof(backend::edge_event) && count <= header->capacity &&
+                 sizeof(file_header) + count * sizeof(backend::edge_event) <= size;
+    if (!valid) {
+        munmap(mapping, size);
+        throw std::system_error(EINVAL, std::generic_category(), path + " isn't a trace file (or is from another version)");
+    }
+
+    const auto* first = reinterpret_cast<const backend::edge_event*>(static_cast<const char*>(mapping) + sizeof(file_header));
+    std::vector<backend::edge_event> events(first, first + count);
+    if (sequence) {
+        *sequence = header->sequence;
+    }
+    munmap(mapping, size);
+    return events;
+}
+
+// Reads every file of a trace (base.0, base.1, ...) in the order they were recorded.
+inline std::vector<backend::edge_event> load(const std::string& base_path) {
+    std::vector<std::pair<std::uint64_t, std::vector<backend::edge_event>>> files;
+    for (unsigned int i = 0;; i++) {
+        std::string path = base_path + "." + std::to_string(i);
+        if (access(path.c_str(), R_OK) != 0) {
+            break;
+        }
+        std::uint64_t sequence = 0;
+        std::vector<backend::edge_event> events = load_file(path, &sequence);
+        files.emplace_back(sequence, std::move(events));
+    }
+    if (files.empty()) {
+        throw std::system_error(ENOENT, std::generic_category(), "no trace files at " + base_path + ".0");
+    }
+
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::vector<backend::edge_event> all;
+    for (auto& file : files) {
+        all.insert(all.end(), file.second.begin(), file.second.end());
+    }
+    return all;
+}
+
+/*
+Plays recorded events into a simulated chip. The lines have to be requested (as inputs with edge detection) by
+whoever is going to read them.
+
+speed 1 keeps the original spacing, 10 plays ten times faster, 0 as fast as possible. Replayed events get new
+timestamps (now, plus the original spacing scaled by speed) so they look like they just happened.
+`pace` does the waiting, its lateness() says how late each event was injected.
+*/
+inline void replay(backend::sim_chip& chip, const std::vector<backend::edge_event>& events, double speed, timing::deadline_timer& pace) {
+    if (events.empty()) {
+        return;
+    }
+
+    std::uint64_t first = events.front().timestamp_ns();
+    std::uint64_t start = backend::monotonic_ns();
+    pace.start_at(start);
+    for (const auto& event : events) {
+        std::uint64_t timestamp = backend::monotonic_ns();
+        if (speed > 0) {
+            std::uint64_t since_first = event.timestamp_ns() >= first ? event.timestamp_ns() - first : 0;
+            timestamp = start + static_cast<std::uint64_t>(static_cast<double>(since_first) / speed);
+            pace.sleep_until(timestamp);
+        }
+        chip.inject_edge(event.line_offset(), event.type(), timestamp);
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+#include <csignal> // for SIGINT (CTRL+C)
+#include <string>
+#include <vector>
+
+#include "args.hpp"
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "gpio_bus.hpp"
+#include "reactor.hpp"
+#include "tasks.hpp"
+
+/*
+A line can only be requested by one process at a time. Run the monitor and the sensor example on the same pi and the
+second one fails to get pin 21, and every example sets up its own requests every time it starts.
+
+This daemon requests the lines once and shares them (see libgpiod-common/gpio_bus.hpp):
+
+  gpio-daemon [chip] [inputs] [outputs] [socket]
+
+Edge events on the inputs are published into a ring in shared memory that any number of clients read at the same
+time. Outputs are set by sending the daemon a command over a Unix socket. The examples become clients by opening the
+"daemon" chip instead of a real one:
+
+  ./gpio-daemon /dev/gpiochip0 &
+  ../libgpiod-monitor/monitor-example daemon
+  ../libgpiod-sensor/sensor-example daemon
+
+Everything the daemon does happens on one thread, in an epoll event loop (libgpiod-common/reactor.hpp): edge events,
+clients connecting and their commands, and CTRL+C. It never waits for a client, a client that doesn't keep up
+loses the oldest events (and counts them). On exit, when a client leaves, or on SIGUSR1 it prints how many events
+every client got, how many it lost, and how long delivery took (measured by the clients themselves).
+*/
+
+// Nobody presses buttons on the simulated chip, so on "sim" the daemon does: every input goes low for 100ms once a
+// second (the buttons idle high). It's a coroutine on the daemon's event loop (see libgpiod-common/tasks.hpp).
+tasks::task<> press_buttons(tasks::scheduler& sched, backend::sim_controls& sim, std::vector<unsigned int> buttons) {
+    for (unsigned int button : buttons) {
+        sim.set_input(button, true);
+    }
+    while (true) {
+        co_await sched.sleep_for(std::chrono::seconds(1));
+        for (unsigned int button : buttons) {
+            sim.set_input(button, false);
+        }
+        co_await sched.sleep_for(std::chrono::milliseconds(100));
+        for (unsigned int button : buttons) {
+            sim.set_input(button, true);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
+        std::cout << "Serving " << main_header->info() << '\n';
+
+        // ---- THE LINES THE DAEMON SHARES ----
+        // By default the button of the monitor example (21, also the sensor's echo), and every output the led, monitor and
+        // sensor examples use: the buzzers and LEDs (5, 6, 16, 17), the three LEDs (18, 24, 25) and the sensor's trigger (20).
+        std::vector<unsigned int> inputs = args::parse_offsets(argc > 2 ? argv[2] : "21");
+        std::vector<unsigned int> outputs = args::parse_offsets(argc > 3 ? argv[3] : "5,6,16,17,18,20,24,25");
+
+        bus::server_options options;
+        options.socket_path = argc > 4 ? argv[4] : bus::DEFAULT_SOCKET;
+        options.log = &std::cout;
+
+        // Inputs watch both edges and the daemon keeps a big kernel event buffer, clients only get what the daemon reads.
+        std::unique_ptr<backend::line_request> input_pins;
+        if (!inputs.empty()) {
+            backend::request_builder inputs_request = main_header->prepare_request();
+            inputs_request.set_consumer("gpio-daemon");
+            inputs_request.set_event_buffer_size(1024);
+            for (unsigned int offset : inputs) {
+                inputs_request.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::INPUT).set_edge_detection(backend::edge::BOTH));
+            }
+            input_pins = inputs_request.do_request();
+        }
+
+        std::unique_ptr<backend::line_request> output_pins;
+        if (!outputs.empty()) {
+            backend::request_builder outputs_request = main_header->prepare_request();
+            outputs_request.set_consumer("gpio-daemon");
+            for (unsigned int offset : outputs) {
+                outputs_request.add_line_settings(offset, backend::line_settings().set_direction(backend::direction::OUTPUT));
+            }
+            output_pins = outputs_request.do_request();
+        }
+
+        std::cout << "Input pins: " << backend::to_string(inputs) << '\n';
+        std::cout << "Output pins: " << backend::to_string(outputs) << '\n';
+
+        events::reactor event_loop;
+        bus::server daemon(event_loop, *main_header, input_pins.get(), output_pins.get(), options);
+
+        // CTRL+C (or systemd stopping us) ends the loop, SIGUSR1 prints how every client is doing.
+        // Set up before any thread exists, see reactor.hpp.
+        event_loop.watch_signals({SIGINT, SIGTERM, SIGUSR1}, [&](int signum) {
+            if (signum == SIGUSR1) {
+                daemon.print(std::cout);
+                return;
+            }
+            event_loop.stop();
+        });
+
+        tasks::scheduler sched(event_loop);
+        if (auto* sim = dynamic_cast<backend::sim_chip*>(main_header.get())) {
+            sched.spawn(press_buttons(sched, *sim, inputs));
+        }
+
+        std::cout << "Listening on " << daemon.socket_path() << " (Press CTRL+C to stop.)" << '\n' << '\n';
+        event_loop.run();
+        sched.rethrow_failure();
+
+        std::cout << '\n' << "Stopping." << '\n';
+        daemon.print(std::cout);
+
+        if (output_pins) {
+            output_pins->release();
+        }
+        if (input_pins) {
+            input_pins->release();
+        }
+        main_header->close();
+
+    } catch (const std::system_error& e) {
+
+        std::cout << "Daemon failed!" << '\n';
+        std::cout << "Error: " << e.what() << '\n';
+
+        return 1;
+    }
+
+    return 0;
+}
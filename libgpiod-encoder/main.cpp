@@ -0,0 +1,143 @@
+#include <iostream>
+#include <atomic>
+#include <csignal> // for SIGINT (CTRL+C)
+#include <exception>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.hpp"
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "quadrature.hpp"
+#include "reactor.hpp"
+#include "tasks.hpp"
+
+/*
+Position and speed of motors with quadrature encoders on their shafts.
+
+  encoder-example [chip] [encoders] [counts per revolution]
+
+Encoders are given as A:B pairs, "22:23,26:27" by default. Every edge on either line is a count (see
+libgpiod-common/quadrature.hpp), the default of 2400 counts a revolution is a 600 line encoder.
+
+The decoding runs on its own thread, on an epoll event loop that wakes up when edges are queued, reads them in
+batches and works out every encoder's position and speed from the edge timestamps. This thread (main) only reads the
+snapshots the decoder publishes and prints them, it never takes a lock the decoder needs. That's how a motor control
+loop would use it too.
+
+On the sim chip the encoders turn by themselves: the first forwards at 2000 counts a second, the second backwards
+at 4000, and so on.
+*/
+
+// "22:23,26:27" to a list of A/B pairs.
+std::vector<quadrature::pins> parse_encoders(const std::string& list) {
+    std::vector<quadrature::pins> encoders;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        std::size_t colon = item.find(':');
+        if (colon == std::string::npos) {
+            throw std::system_error(EINVAL, std::generic_category(), "encoders are A:B pairs, got \"" + item + "\"");
+        }
+        encoders.push_back(quadrature::pins{args::parse_offset(item.substr(0, colon)), args::parse_offset(item.substr(colon + 1))});
+    }
+    return encoders;
+}
+
+// Every 50ms: encoders that stopped sending edges have stopped turning.
+tasks::task<> settle(tasks::scheduler& sched, quadrature::decoder& decoder) {
+    while (true) {
+        co_await sched.sleep_for(std::chrono::milliseconds(50));
+        decoder.settle(backend::monotonic_ns());
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
+        std::cout << main_header->info() << '\n';
+
+        std::vector<quadrature::pins> encoders = parse_encoders(argc > 2 ? argv[2] : "22:23,26:27");
+        double counts_per_rev = argc > 3 ? args::parse_positive(argv[3], "counts per revolution") : 2400.0;
+
+        std::unique_ptr<backend::line_request> encoder_pins = quadrature::request_encoders(*main_header, encoders, "encoder-example");
+        quadrature::decoder decoder(*encoder_pins);
+        for (const auto& encoder : encoders) {
+            decoder.add_encoder(encoder.a, encoder.b);
+        }
+
+        events::reactor event_loop;
+        event_loop.add(decoder.fd(), [&](std::uint32_t) { decoder.drain(); });
+
+        // CTRL+C stops the loop and tells the printing below to stop too.
+        // Set up before any thread exists, see reactor.hpp.
+        std::atomic<bool> running{true};
+        event_loop.watch_signals({SIGINT, SIGTERM}, [&](int) {
+            running = false;
+            event_loop.stop();
+        });
+
+        tasks::scheduler sched(event_loop);
+        sched.spawn(settle(sched, decoder));
+
+        auto* sim = dynamic_cast<backend::sim_chip*>(main_header.get());
+        if (sim) {
+            for (std::size_t i = 0; i < encoders.size(); i++) {
+                double speed = 2000.0 * static_cast<double>(i + 1) * (i % 2 ? -1.0 : 1.0);
+                sim->play_quadrature(encoders[i].a, encoders[i].b, speed, std::chrono::hours(24));
+            }
+        }
+
+        // Whatever ends the loop (CTRL+C, a failed read, the settle task failing) ends the printing too. An exception
+        // is kept for main to rethrow, one that left the thread would end the program on the spot.
+        std::exception_ptr decoding_failure;
+        std::thread decoding([&]() {
+            try {
+                event_loop.run();
+            } catch (...) {
+                decoding_failure = std::current_exception();
+            }
+            running = false;
+        });
+        std::cout << "Decoding " << encoders.size() << " encoders (Press CTRL+C to stop.)" << '\n' << '\n';
+
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            for (std::size_t i = 0; i < encoders.size(); i++) {
+                quadrature::snapshot now = decoder.read(i);
+                std::cout << "Encoder " << i << " (" << encoders[i].a << ":" << encoders[i].b << "): position " << now.position
+                          << " (" << std::fixed << std::setprecision(2) << static_cast<double>(now.position) / counts_per_rev << " rev), "
+                          << std::setprecision(1) << now.velocity / counts_per_rev * 60.0 << " rpm, " << now.edges << " edges, "
+                          << now.invalid << " invalid, " << now.missed << " missed" << '\n';
+                std::cout.unsetf(std::ios_base::floatfield);
+            }
+        }
+
+        decoding.join();
+        if (decoding_failure) {
+            std::rethrow_exception(decoding_failure);
+        }
+        sched.rethrow_failure();
+
+        std::cout << '\n' << "Stopping. " << decoder.events() << " edges in " << decoder.drain_calls() << " wake-ups." << '\n';
+        if (sim) {
+            sim->stop_patterns();
+        }
+        encoder_pins->release();
+        main_header->close();
+
+    } catch (const std::system_error& e) {
+
+        std::cout << "Decoding failed!" << '\n';
+        std::cout << "Error: " << e.what() << '\n';
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,81 +1,204 @@
 #pragma once
 
-#include <unistd.h>
-#include <gpiod.hpp> // library originally for C so you need to include .hpp header
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "gpio.hpp"
+#include "frame_table.hpp"
+#include "shift_register.hpp"
+#include "soft_pwm.hpp"
+#include "tasks.hpp"
+
+/*
+Each mode is worked out ahead of time as an animation: a list of framebuffers (one bit per LED, see
+libgpiod-common/shift_register.hpp) and how long to hold each one. The patterns don't care where the LEDs are, a
+display puts the frames on them:
+
+- pin_display: LEDs wired straight to pins. The frames become a frame table (see libgpiod-common/frame_table.hpp)
+  and every frame is written with a single set_values() call, so the LEDs all switch together. Up to 64 pins.
+- shift_register_display: LEDs behind a chain of 74HC595s on three pins (data, clock, latch). Every frame is
+  compiled into the writes that clock it out, hundreds of LEDs still switch together when the latch goes up.
+
+The modes are coroutines (see libgpiod-common/tasks.hpp): instead of sleeping between frames they co_await the next
+deadline, which hands the thread back to the event loop in the meantime. main() runs them with sched.run(), but
+you could just as well spawn() a few at once on different displays, they'd all share the one thread.
+*/
 
-/* 
-the only way to get a fraction of a second with this header is by using usleep() which only takes microseconds and 
-for some reason unistd.h doesnt provide any sleep functions in between seconds and microseconds so uhhhhhh yeah! :D
+// ---- PATTERNS ----
+namespace patterns {
+
+    using shiftreg::animation;
+    using shiftreg::framebuffer;
+    using shiftreg::panel_frame;
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+
+    // All LEDs on, then all off.
+    inline animation blink(std::size_t num_leds) {
+        framebuffer on(num_leds);
+        on.fill(true);
+        return animation{
+            panel_frame{on, milliseconds(500)},
+            panel_frame{framebuffer(num_leds), milliseconds(500)},
+        };
+    }
+
+    // Every other LED, then the other half. With 3 pins that's the outer two vs the inner one.
+    inline animation alternate(std::size_t num_leds) {
+        framebuffer even(num_leds);
+        framebuffer odd(num_leds);
+        for (std::size_t led = 0; led < num_leds; led++) {
+            (led % 2 ? odd : even).set(led);
+        }
+        return animation{
+            panel_frame{even, milliseconds(500)},
+            panel_frame{odd, milliseconds(500)},
+        };
+    }
+
+    // Light up one LED after the other, hold, then turn them off in the same order.
+    // A wave takes about 600ms whatever the size, 100ms a step with 3 LEDs.
+    inline animation wave(std::size_t num_leds) {
+        animation frames;
+        framebuffer lit(num_leds);
+        microseconds step(300000 / static_cast<long>(num_leds ? num_leds : 1));
+
+        for (std::size_t led = 0; led < num_leds; led++) {
+            lit.set(led, true);
+            frames.push_back(panel_frame{lit, led + 1 == num_leds ? 2 * step : step});
+        }
+        for (std::size_t led = 0; led < num_leds; led++) {
+            lit.set(led, false);
+            frames.push_back(panel_frame{lit, led + 1 == num_leds ? microseconds(0) : step});
+        }
+        return frames;
+    }
+
+    inline animation all_off(std::size_t num_leds) {
+        return animation{panel_frame{framebuffer(num_leds), milliseconds(0)}};
+    }
+
+    // For LEDs on pins: the first 64 LEDs of every frame as a frame table (bit i = LED i).
+    inline frames::frame_table to_frame_table(const animation& steps) {
+        frames::frame_table table{0, {}};
+        for (const auto& step : steps) {
+            table.num_channels = static_cast<unsigned int>(step.image.size());
+            table.frames.push_back(frames::frame{step.image.word(0), step.duration});
+        }
+        return table;
+    }
 
-fsleep allows sleeping for a fractional number of seconds.
-*/
-double fsleep(double seconds) {
-    return usleep(seconds * 1000000);
 }
 
-// ---- EXAMPLES ---- 
+// ---- DISPLAYS ----
+class display {
+public:
+    virtual ~display() = default;
+    virtual std::size_t size() const = 0; // number of LEDs
+    virtual tasks::task<> play(tasks::scheduler& sched, patterns::animation frames, unsigned int repeats = 1) = 0;
+    virtual void print_stats() const = 0;
+};
+
+class pin_display : public display {
+public:
+    // pins[i] is LED i.
+    pin_display(backend::line_request& lines, const std::vector<unsigned int>& pins) : player(lines, pins), num_leds(pins.size()) {}
+
+    std::size_t size() const override { return num_leds; }
+
+    tasks::task<> play(tasks::scheduler& sched, patterns::animation frames, unsigned int repeats = 1) override {
+        return player.play(sched, patterns::to_frame_table(frames), repeats);
+    }
+
+    void print_stats() const override {
+        const frames::frame_stats& stats = player.stats();
+        std::cout << "Frames played: " << stats.frames_played << ", writes: " << stats.writes
+                  << ", max writes per frame: " << stats.max_writes_per_frame
+                  << ", max skew: " << stats.max_skew_ns << "ns" << '\n';
+        std::cout << "Frame lateness: " << player.lateness().summary_us() << '\n';
+    }
+
+private:
+    frames::frame_player player;
+    std::size_t num_leds;
+};
+
+class shift_register_display : public display {
+public:
+    shift_register_display(backend::line_request& lines, const shiftreg::wiring& pins, std::size_t num_leds) : registers(lines, pins, num_leds) {}
+
+    std::size_t size() const override { return registers.size(); }
+
+    tasks::task<> play(tasks::scheduler& sched, patterns::animation frames, unsigned int repeats = 1) override {
+        return registers.play(sched, std::move(frames), repeats);
+    }
+
+    void print_stats() const override { registers.print(std::cout); }
+
+    const shiftreg::framebuffer& showing() const { return registers.showing(); }
+
+private:
+    shiftreg::shift_register_output registers;
+};
+
+// ---- EXAMPLES ----
 namespace modes {
 
     // All LEDs will blink 5 times.
-    void blink(unsigned int* pin_bcm, unsigned int* second_pin_bcm, unsigned int* third_pin_bcm, gpiod::line_request* gpio_pins) {
-
-        for (int i = 0; i < 5; i++) {
-                // gpio::line is a namespace for stuff you can do with each gpioline.
-                // more info here on this object here: https://libgpiod.readthedocs.io/en/latest/cpp_line_request.html#_CPPv4N5gpiod12line_request9set_valueEN4line6offsetEN4line5valueE
+    inline tasks::task<> blink(tasks::scheduler& sched, display& leds) {
+        co_await leds.play(sched, patterns::blink(leds.size()), 5);
 
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::ACTIVE); // turns on the pin
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::ACTIVE);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::ACTIVE);
-                fsleep(0.5);
+        leds.print_stats();
+        std::cout << "Program Finished." << std::endl;
+    }
 
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::INACTIVE); // turns off the pin
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::INACTIVE);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::INACTIVE);
-                fsleep(0.5);
-            }
+    // LEDs will alternate between lighting up the outer pins 18 & 25 and the inner pin 24.
+    inline tasks::task<> alternate(tasks::scheduler& sched, display& leds) {
+        co_await leds.play(sched, patterns::alternate(leds.size()), 5);
+        co_await leds.play(sched, patterns::all_off(leds.size()));
 
+        leds.print_stats();
         std::cout << "Program Finished." << std::endl;
     }
 
-    // LEDS will alternate between lighting up the inner 18th pin and pins 24-25.
-    void alternate(unsigned int* pin_bcm, unsigned int* second_pin_bcm, unsigned int* third_pin_bcm, gpiod::line_request* gpio_pins) {
-
-        for (int i = 0; i < 5; i++) {
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::ACTIVE);
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::INACTIVE);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::ACTIVE);
-                fsleep(0.5);
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::INACTIVE);
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::ACTIVE);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::INACTIVE);
-                fsleep(0.5);
-            }
-        
-        gpio_pins->set_value(*pin_bcm, gpiod::line::value::INACTIVE);
-        gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::INACTIVE);
-        gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::INACTIVE);
-        
+    inline tasks::task<> wave(tasks::scheduler& sched, display& leds) {
+        co_await leds.play(sched, patterns::wave(leds.size()), 5);
+
+        leds.print_stats();
         std::cout << "Program Finished." << std::endl;
     }
 
-    void wave(unsigned int* pin_bcm, unsigned int* second_pin_bcm, unsigned int* third_pin_bcm, gpiod::line_request* gpio_pins) {
-        for (int i = 0; i < 5; i++) {
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::ACTIVE);
-                fsleep(0.1);
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::ACTIVE);
-                fsleep(0.1);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::ACTIVE);
-
-                fsleep(0.2);
-
-                gpio_pins->set_value(*pin_bcm, gpiod::line::value::INACTIVE);
-                fsleep(0.1);
-                gpio_pins->set_value(*second_pin_bcm, gpiod::line::value::INACTIVE);
-                fsleep(0.1);
-                gpio_pins->set_value(*third_pin_bcm, gpiod::line::value::INACTIVE);
+    // LEDs fade in and out (each one a little behind the one before it) 3 times.
+    // Lines can only be on or off, so brightness comes from software PWM: switching each LED 200 times a second
+    // and changing how much of each cycle it spends on. See libgpiod-common/soft_pwm.hpp.
+    // This one needs the LEDs on pins, there's no switching hundreds of LEDs through a shift register that fast.
+    inline tasks::task<> fade(tasks::scheduler& sched, const std::vector<unsigned int>& pins, backend::line_request* gpio_pins) {
+        pwm::soft_pwm dimmer(*gpio_pins);
+        for (unsigned int pin : pins) {
+            dimmer.add_channel(pin, 200.0, 0.0);
+        }
+        dimmer.start();
+
+        // brightness is updated every 20ms, a full fade in and out takes 100 steps (2 seconds).
+        const int steps_per_fade{100};
+        timing::deadline_timer steps;
+
+        for (int step = 0; step < 3 * steps_per_fade; step++) {
+            for (std::size_t i = 0; i < pins.size(); i++) {
+                double phase = static_cast<double>(step) / steps_per_fade - 0.15 * static_cast<double>(i);
+                double brightness = phase < 0 ? 0.0 : 0.5 - 0.5 * std::cos(2 * M_PI * phase);
+                dimmer.set_duty(i, brightness * brightness); // our eyes aren't linear, squaring looks a lot smoother.
             }
-
-            std::cout << "Program Finished." << std::endl;
+            co_await sched.wait(steps, std::chrono::milliseconds(20));
+        }
+        dimmer.stop();
+
+        for (const auto& channel : dimmer.report()) {
+            std::cout << "PWM line " << channel.offset << ": " << channel.achieved_hz << "Hz (asked for " << channel.requested_hz << "Hz)" << '\n';
+        }
+        std::cout << "PWM writes: " << dimmer.batches() << ", lateness: " << dimmer.lateness().summary_us() << '\n';
+        std::cout << "Program Finished." << std::endl;
     }
 
-}
\ No newline at end of file
+}
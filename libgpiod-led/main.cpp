@@ -1,62 +1,110 @@
 #include <iostream>
 #include <unistd.h>
-#include <gpiod.hpp> // library originally for C so you need to include .hpp version of it
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "args.hpp"
 #include "blink_modes.hpp"
+#include "reactor.hpp"
+#include "sim_shift_register.hpp"
+#include "tasks.hpp"
 
-int main() {
+int main(int argc, char* argv[]) {
     try {
-        gpiod::chip main_header("/dev/gpiochip0"); // 40pin header on the rpi4
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
         std::cout << "Successfully instantitated chip object." << '\n';
 
         // info about the 40 pin header
-        std::cout << main_header.get_info() << '\n';
+        std::cout << main_header->info() << '\n';
 
         // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST WITH MULTIPLE GPIO LINES 
-        gpiod::request_builder line_request = main_header.prepare_request();
-        gpiod::line_settings line_settings = gpiod::line_settings(); // Initializes a line_settings object with default values.
+        backend::request_builder line_request = main_header->prepare_request();
+        backend::line_settings line_settings = backend::line_settings(); // Initializes a line_settings object with default values.
 
         unsigned int pin_bcm{18};
         unsigned int second_pin_bcm{24};
         unsigned int third_pin_bcm{25};
 
         line_request.set_consumer("main.cpp");
-        line_request.add_line_settings(pin_bcm, line_settings.set_direction(gpiod::line::direction::OUTPUT));
-        line_request.add_line_settings(second_pin_bcm, line_settings.set_direction(gpiod::line::direction::OUTPUT));
-        line_request.add_line_settings(third_pin_bcm, line_settings.set_direction(gpiod::line::direction::OUTPUT));
+        line_request.add_line_settings(pin_bcm, line_settings.set_direction(backend::direction::OUTPUT));
+        line_request.add_line_settings(second_pin_bcm, line_settings.set_direction(backend::direction::OUTPUT));
+        line_request.add_line_settings(third_pin_bcm, line_settings.set_direction(backend::direction::OUTPUT));
 
         // After running do_request() you can make various changes to the requested GPIO pins using the library's methods.
         // See blink_modes.hpp for more info.
-        gpiod::line_request gpio_pins = line_request.do_request();
+        std::unique_ptr<backend::line_request> gpio_pins = line_request.do_request();
+
+        // The modes work on any number of pins, they light them up in the order given here.
+        const std::vector<unsigned int> pins{pin_bcm, second_pin_bcm, third_pin_bcm};
+
+        // Pass a number of LEDs after the chip and the same three pins drive a chain of 74HC595 shift registers instead
+        // (see libgpiod-common/shift_register.hpp): 18 is the data line (SER), 24 the shift clock (SRCLK), 25 the
+        // latch (RCLK). "./led-example sim 256" is 32 registers.
+        // 8192 is 1024 registers, which already takes 16385 writes a frame.
+        std::size_t shifted_leds = argc > 2 ? args::parse_count(argv[2], "LED count", 1, 8192) : 0;
+        const shiftreg::wiring registers{{pin_bcm}, second_pin_bcm, third_pin_bcm};
+
+        std::unique_ptr<display> leds;
+        if (shifted_leds) {
+            leds = std::make_unique<shift_register_display>(*gpio_pins, registers, shifted_leds);
+            std::cout << "Driving " << shifted_leds << " LEDs through shift registers on pins " << pin_bcm << ", " << second_pin_bcm
+                      << " and " << third_pin_bcm << "." << '\n';
+        } else {
+            leds = std::make_unique<pin_display>(*gpio_pins, pins);
+        }
+
+        // No registers on the simulated chip, so pretend there are (libgpiod-common/sim_shift_register.hpp) and check
+        // they show the last frame once a mode is done.
+        std::unique_ptr<backend::sim_shift_register> pretend_registers;
+        auto* sim = dynamic_cast<backend::sim_chip*>(main_header.get());
+        if (shifted_leds && sim) {
+            pretend_registers = std::make_unique<backend::sim_shift_register>(*sim, registers, shifted_leds);
+        }
 
         std::cout << "Successfully requested pins. Ready for input." << '\n' << std::endl;
         std::cout << "------ BLINK-MODE OPTIONS ------" << '\n';
         std::cout << "1 - Blink all LEDs 5 times." << '\n'
                   << "2 - LEDs will alternate between the inner light and the outer lights." << '\n'
-                  << "3 - LEDs will light up and turn off in a wave pattern." << std::endl;
+                  << "3 - LEDs will light up and turn off in a wave pattern." << '\n'
+                  << "4 - LEDs will fade in and out (software PWM)." << std::endl;
+
+        // The modes are coroutines, they run on this event loop (see blink_modes.hpp).
+        events::reactor event_loop;
+        tasks::scheduler sched(event_loop);
 
         int userInput{0};
 
-        while(userInput > 3 || userInput < 1) {
+        while(userInput > 4 || userInput < 1) {
             std::cout << "Please press any of the keys listed above: " << '\n';
             std::cin >> userInput;
 
             if (userInput == 1) {
                 std::cout << "Running Example 1." << '\n' << "Blinking LEDs..." << '\n';
-                modes::blink(&pin_bcm, &second_pin_bcm, &third_pin_bcm, &gpio_pins);
+                sched.run(modes::blink(sched, *leds));
             } else if (userInput == 2) {
                 std::cout << "Running Example 2." << '\n' << "Alternating LEDs..." << '\n';
-                modes::alternate(&pin_bcm, &second_pin_bcm, &third_pin_bcm, &gpio_pins);
+                sched.run(modes::alternate(sched, *leds));
             } else if (userInput == 3) {
                 std::cout << "Running Example 3." << '\n' << "Waving LEDs..." << '\n';
-                modes::wave(&pin_bcm, &second_pin_bcm, &third_pin_bcm, &gpio_pins);
+                sched.run(modes::wave(sched, *leds));
+            } else if (userInput == 4 && shifted_leds) {
+                std::cout << "Fading needs the LEDs on pins, run it without a number of LEDs." << '\n';
+            } else if (userInput == 4) {
+                std::cout << "Running Example 4." << '\n' << "Fading LEDs..." << '\n';
+                sched.run(modes::fade(sched, pins, gpio_pins.get()));
             } else {
                 std::cout << "Something was wrong with your input, you likely entered a weird float value or a letter." << '\n';
             }
         }
 
+        if (pretend_registers && pretend_registers->latches()) {
+            bool matches = pretend_registers->outputs() == static_cast<shift_register_display&>(*leds).showing();
+            std::cout << "Pretend 74HC595s: " << pretend_registers->clock_pulses() << " clock pulses, " << pretend_registers->latches()
+                      << " latches, outputs match the last frame: " << (matches ? "yes" : "NO") << '\n';
+        }
+
         // Once you're done working with the pins make sure to close up shop.
-        gpio_pins.release();
-        main_header.close();
+        gpio_pins->release();
+        main_header->close();
 
     } catch (const std::system_error& e) {
         std::cout << "Hardware failed!" << '\n';
@@ -1,65 +1,184 @@
 #include <iostream>
 #include <atomic> // for threadsafe variables (variables shared between threads must be atomic)
-#include <csignal> // to safely handle CTRL+C signal interrupt
+#include <csignal> // for SIGINT (CTRL+C)
 #include <thread> // to open up additional threads
+#include <functional> // std::ref
+#include <string>
+#include <vector>
 
 #include <unistd.h>
-#include <gpiod.hpp>
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "debounce.hpp"
+#include "deadline_timer.hpp"
+#include "edge_reader.hpp"
+#include "histogram.hpp"
+#include "joiner.hpp"
+#include "logger.hpp"
+#include "reactor.hpp"
+#include "rules.hpp"
+#include "spsc_ring.hpp"
+#include "tasks.hpp"
+#include "trace.hpp"
 
 /*
 This code is an attempting to explain how to monitor a gpiopins for edge-events (voltage changes) and keep track of the time it took.
 Typically you don't want to block your entire program to simply increment a number to keep track of time, so you ideally delegate that task to a
 background thread while your main logic remains running. I'll show how to do that here.
 
+The seconds counter used to get a thread of its own too, only to sleep 999ms of every second. Now it's a coroutine
+(see libgpiod-common/tasks.hpp) on the main thread's event loop: it co_awaits the next second and the thread is free
+to handle button events in the meantime.
+
 fsleep calls inbetween print statements are just for readability they arent needed.
 */
 
-// Start off by making your interrupt variables and your threadsafe counter:
-std::atomic<bool> continue_running_1(true);
+// Start off by making your interrupt variable and your threadsafe counter:
 std::atomic<bool> continue_running_2(true);
+std::atomic<bool> continue_handling(true);
 std::atomic<int> seconds(0);
 
+// Edge events travel from thread 1 (capture) to thread 3 (responses) through this ring. 1024 events is a lot of button
+// presses, it only fills up if thread 3 gets stuck for a while.
+using event_ring = rings::spsc_ring<backend::edge_event, 1024>;
+
+// How long each output took to react: from the kernel's timestamp on the button edge to the moment set_values()
+// returned. One histogram per output line, printed on exit or whenever you send the program SIGUSR1
+// (`kill -USR1 <pid>`) while it's running.
+metrics::line_latencies reaction_latency;
+
 // sleep for X seconds
 double fsleep(double x){
     return usleep(x * 1000000);
 }
 
-// This will be the function the second thread runs while the main thread will run main() as usual.
-void begin_counting(){
-    std::cout << "Thread 2: Starting monitor timer..." << '\n';
-    fsleep(0.1);
+// The timer task, it runs on thread 1's event loop next to the button (every co_await hands the thread back to it).
+// It prints through thread 1's channel of the logger in main(), it's the thread that runs it.
+tasks::task<> begin_counting(tasks::scheduler& sched, logging::channel& out){
+    out.log("Timer: Starting monitor timer...");
+    co_await sched.sleep_for(std::chrono::milliseconds(100));
 
-    // We'll be using continue_running_2 variable as start/stop condition for thread 2 (we're going to link this to CTRL+C)
+    // Each tick is one second after the *previous deadline*, not one second after we got around to printing.
+    // That way the count doesn't slowly fall behind the wall clock on a long run.
+    timing::deadline_timer ticks;
+
+    // We'll be using continue_running_2 variable as start/stop condition for the timer (we're going to link this to CTRL+C)
     while(continue_running_2){
-        std::cout << "Thread 2: " << "Seconds Elapsed = " << seconds << '\n';
+        out.log("Timer: Seconds Elapsed = {}", seconds.load());
         seconds++;
 
-        fsleep(1);
+        co_await sched.wait(ticks, std::chrono::seconds(1));
     }
 }
 
-// This function will be registered to the CTRL+C interrupt (SIGINT) via <csignal>
-// That means instead of terminating the program, CTRL+C will run this function to stop the second thread & clean up before stopping.
-void stop_program(int signum){
-    std::cout << "Interrupt signal: " << signum << " recieved. Cleaning up..." << '\n';
+// Thread 3 runs this: everything slow (printing, switching the outputs) happens here, so none of it can hold up
+// thread 1 reading events out of the kernel.
+//
+// The outputs aren't switched by hand here. The rule table in main() says what every edge does ("a press turns the
+// buzzer on for 300ms") and the rule engine (libgpiod-common/rules.hpp) keeps the time for all of them at once. This
+// thread runs its own event loop: it wakes up when thread 1 pushes events into the ring, or when one of the engine's
+// timers runs out. Nothing in it ever sleeps, so a new press is handled even while the last one's buzzer is still on.
+void handle_events(event_ring& ring, rules::engine& responses, backend::line_request& output_pins, logging::channel& out){
+    events::reactor response_loop;
+    std::vector<std::pair<backend::edge_event, std::uint64_t>> batch; // events and the outputs they switched
+    batch.reserve(event_ring::capacity());
+
+    response_loop.add(ring.notify_fd(), [&](std::uint32_t){
+        ring.consume_notify();
+
+        backend::edge_event event;
+        batch.clear();
+        while (ring.pop(event)) {
+            batch.emplace_back(event, responses.on_edge(event));
+        }
+
+        // Respond to the whole batch first (one set_values() call), printing can wait a few microseconds.
+        // (And the printing is only a note to the logger, the actual formatting and writing is done by its own thread.)
+        responses.flush();
+
+        // Taking the time once the write returns costs a clock read, cheap enough to do for every event.
+        std::uint64_t done = backend::monotonic_ns();
+        for (const auto& handled : batch) {
+            std::uint64_t took = done > handled.first.timestamp_ns() ? done - handled.first.timestamp_ns() : 0;
+            for (unsigned int offset : output_pins.offsets()) {
+                if (handled.second & output_pins.line_bit(offset)) {
+                    reaction_latency.record(offset, took);
+                }
+            }
 
-    // stop both threads, after that any remaining code after the while-loop in main() will run.
-    continue_running_2 = false;
-    continue_running_1 = false;
+            if (handled.first.type() == backend::edge_event::event_type::FALLING_EDGE){
+                out.log("Thread 3: Button press detected! (Falling Edge)");
 
+                // At this point we'll stop the timer since our goal condition has been reached.
+                // However we can still continue listening for more events if we want to.
+                if (continue_running_2 == true) {
+                    out.log("First button press detected after: {} seconds. Stopping the timer.", seconds.load());
+                    continue_running_2 = false;
+                }
+            } else {
+                out.log("Thread 3: Button was released! (Rising Edge)");
+            }
+        }
+
+        // only quit once everything that was captured has been handled.
+        if (!continue_handling) {
+            response_loop.stop();
+        }
+    });
+
+    // A timer ran out: the engine switches off whatever is due, everything due on the same tick in one write.
+    response_loop.add(responses.fd(), [&](std::uint32_t){
+        responses.on_timer();
+    });
+
+    response_loop.run();
+    responses.stop_all(); // leave nothing switched on
 }
 
-int main(){
+int main(int argc, char* argv[]){
+
+    /*
+    Thread 1 runs an event loop (see libgpiod-common/reactor.hpp). It sleeps in epoll until something it watches has news:
+    the input line's file descriptor (an edge event was queued) or CTRL+C.
+
+    CTRL+C is read from a signalfd instead of a signal handler. That means it arrives as an ordinary event on this thread
+    instead of interrupting whatever it was doing. All the "handler" does is set flags: stop the timer and the loop and
+    remember the signal, everything else (printing, cleaning up) happens after event_loop.run() in main(). This has to
+    be set up before any other thread starts so none of them gets the signal instead. SIGUSR1 comes in the same way and
+    just prints the reaction latencies and dropped event counts so far.
+    */
+    events::reactor event_loop;
+    const events::edge_reader* button_reader = nullptr; // set once the button is requested
+    int interrupted_by{0};
+    event_loop.watch_signals({SIGINT, SIGUSR1}, [&event_loop, &button_reader, &interrupted_by](int signum){
+        if (signum == SIGUSR1) {
+            reaction_latency.print(std::cout, "Reaction latency");
+            if (button_reader) {
+                button_reader->print(std::cout, "Edge events");
+            }
+            return;
+        }
+        // stop the timer and the loop, after that any remaining code after event_loop.run() in main() will run.
+        interrupted_by = signum;
+        continue_running_2 = false;
+        event_loop.stop();
+    });
+
+    // What thread 1 does when the ring is full: "drop" throws the new event away (capture never waits, the default),
+    // "block" waits for thread 3 to make room (nothing is lost, but the kernel's queue can fill up instead).
+    std::string policy_name = argc > 2 ? argv[2] : "drop";
+    rings::backpressure policy = policy_name == "block" ? rings::backpressure::BLOCK : rings::backpressure::DROP_NEWEST;
 
-    // Register stop_program() as your CTRL+C function via <csignal>
-    std::signal(SIGINT, stop_program);
+    // Pass a path as the third argument to record every raw edge event (before debouncing) to a binary trace,
+    // e.g. `./monitor-example sim drop /tmp/button`. Play it back later with libgpiod-trace.
+    const char* trace_path = argc > 3 ? argv[3] : nullptr;
 
     // Begin program
     std::cout << "Thread 1: This is the main thread. In here we'll be monitoring gpioline " << "for edge-events indicating a change in voltage." << '\n';
 
     try {
     
-        gpiod::chip main_header("/dev/gpiochip0"); // 40pin header on the rpi4.
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
         std::cout << "Thread 1: Successfully instantitated chip object." << '\n' << '\n';
         fsleep(1);
 
@@ -72,99 +191,146 @@ int main(){
         const unsigned int red_led{6};
 
         // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST FOR MULTIPLE OUTPUT LINES.
-        gpiod::request_builder outputs_request = main_header.prepare_request();
-        gpiod::line_settings default_settings = gpiod::line_settings();
+        backend::request_builder outputs_request = main_header->prepare_request();
+        backend::line_settings default_settings = backend::line_settings();
         outputs_request.set_consumer("Thread 1");
-        outputs_request.add_line_settings(active_buzzer, default_settings.set_direction(gpiod::line::direction::OUTPUT));
-        outputs_request.add_line_settings(red_led, default_settings.set_direction(gpiod::line::direction::OUTPUT));
+        outputs_request.add_line_settings(active_buzzer, default_settings.set_direction(backend::direction::OUTPUT));
+        outputs_request.add_line_settings(red_led, default_settings.set_direction(backend::direction::OUTPUT));
 
         // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST FOR AN INPUT LINE.
-        gpiod::request_builder inputs_request = main_header.prepare_request();
-        gpiod::line_settings input_settings =  gpiod::line_settings();
+        backend::request_builder inputs_request = main_header->prepare_request();
+        backend::line_settings input_settings =  backend::line_settings();
         inputs_request.set_consumer("Thread 1");
-        inputs_request.add_line_settings(button, input_settings.set_direction(gpiod::line::direction::INPUT));
-        inputs_request.add_line_settings(button, input_settings.set_edge_detection(gpiod::line::edge::BOTH));
+        inputs_request.add_line_settings(button, input_settings.set_direction(backend::direction::INPUT));
+        inputs_request.add_line_settings(button, input_settings.set_edge_detection(backend::edge::BOTH));
 
         // This tethers the button to the high state, more explanation needed write notes on this.
         // KEEPS PIN AT 3.3V UNLESS INTERACTED WITH.
-        input_settings.set_bias(gpiod::line::bias::PULL_UP);
+        input_settings.set_bias(backend::bias::PULL_UP);
+
+        // A button's contacts bounce for a few milliseconds when pressed/released, which shows up as a burst of edges.
+        // Ask the kernel to filter those out, any edge within 10ms of the previous one is ignored.
+        input_settings.set_debounce_period(std::chrono::milliseconds(10));
         inputs_request.add_line_settings(button, input_settings);
         
         // After running do_request(), you can make various changes to the requested GPIO pins using the library's methods via this line_request object.
         // methods for this object can be found here --> https://libgpiod.readthedocs.io/en/latest/cpp_line_request.html
-        gpiod::line_request output_pins = outputs_request.do_request();
-        gpiod::line_request input_pins = inputs_request.do_request();
+        std::unique_ptr<backend::line_request> output_pins = outputs_request.do_request();
+        std::unique_ptr<backend::line_request> input_pins = inputs_request.do_request();
 
         std::cout << "Thread 1: Successfully requested pins." << '\n';
         fsleep(1);
-        std::cout << "Thread 1: Output pins - " << output_pins.offsets() << '\n';
-        std::cout << "Thread 1: Input pins - " << input_pins.offsets() << '\n' << '\n';
+        std::cout << "Thread 1: Output pins - " << backend::to_string(output_pins->offsets()) << '\n';
+        std::cout << "Thread 1: Input pins - " << backend::to_string(input_pins->offsets()) << '\n' << '\n';
         fsleep(1);
 
         std::cout << "Thread 1: Beginning main loop. (Press CTRL+C to stop.)" << '\n';
         fsleep(1);
 
-        // Begin your second thread timer here:
-        std::thread second_thread(begin_counting);
-
-        // We'll be using continue_running_1 as start/stop condition for thread 1 (this is linked to CTRL+C via <csignal>).
-        while(continue_running_1){
-
-            // Begin monitoring pins by creating your event buffer (essentially an array to catch and store edge-events)
-            gpiod::edge_event_buffer buffer(10); // We'll say it can capture events per loop (100milliseconds).
-
-            // if this method returns true that means an event was caught and the logic below will occur.
-            if(input_pins.wait_edge_events(std::chrono::milliseconds(100))){
+        // From here on the other threads print, and they do it through the logger (see libgpiod-common/logger.hpp):
+        // a log call only drops a small record into the thread's own buffer and a background thread does the slow
+        // part, so a slow console (like a serial line) can't hold up the threads handling the button. If it still
+        // can't keep up, messages get dropped (and counted) instead.
+        logging::logger log(std::cout);
+        logging::channel& main_log = log.open_channel("thread 1");
+
+        // Begin your timer here. It's a task for thread 1's event loop, it starts once the loop runs.
+        tasks::scheduler sched(event_loop);
+        sched.spawn(begin_counting(sched, main_log));
+
+        // Events are read through an edge_reader (see libgpiod-common/edge_reader.hpp). It checks the seqno of every
+        // event, so if a burst was too much for the kernel's queue we at least know how many events were lost and on
+        // which line, and it grows its buffer (essentially an array to catch and store edge-events) to fit the bursts.
+        events::edge_reader reader(*input_pins);
+        button_reader = &reader;
+
+        // ---- MY RESPONSES ----
+        // What each edge does, one rule per output. A press (falling edge, the button pulls the line low) beeps the
+        // buzzer for 300ms, pressing again while it beeps doesn't make it longer. The LED stays on for 2 seconds after
+        // the last press. Add your own lines here, the engine handles thousands of them.
+        const std::vector<rules::rule> responses_table{
+            {button, backend::edge::FALLING, active_buzzer, std::chrono::milliseconds(300), rules::retrigger::IGNORE},
+            {button, backend::edge::FALLING, red_led, std::chrono::milliseconds(2000), rules::retrigger::RESTART},
+        };
+        rules::engine responses(*output_pins);
+        for (const auto& rule : responses_table) {
+            responses.add_rule(rule);
+            reaction_latency.track(rule.output);
+        }
 
-                // if any events were caught you need to write to the buffer array.
-                input_pins.read_edge_events(buffer);
+        // And a third thread handles the events thread 1 captures.
+        event_ring ring(policy);
+        std::thread third_thread(handle_events, std::ref(ring), std::ref(responses), std::ref(*output_pins), std::ref(log.open_channel("thread 3")));
 
-                // now just loop through the buffer array and print out everything we caught.
-                // we can also add real-time logic for what to do in response to an event in this loop.
-                for (const auto& event : buffer){
-                    if (event.type() == gpiod::edge_event::event_type::FALLING_EDGE){
-                        std::cout << "Thread 1: Button press detected! (Falling Edge)" << '\n';
-                        
-                        // At this point we'll stop the second thread since our goal condition has been reached.
-                        // However we can still continue listening for more events if we want to.
-                        if (continue_running_2 == true) { 
-                            std::cout << "First button press detected after: " << seconds << " seconds. Exiting second thread." << '\n';
-                            continue_running_2 = false;
-                        }
+        // If anything from here on throws, thread 3 still gets stopped and joined (see libgpiod-common/joiner.hpp).
+        threads::joiner join_third_thread(third_thread, [&ring]() {
+            continue_handling = false;
+            ring.notify();
+        });
 
-                        // Extra logic to respond to the button press
-                        output_pins.set_value(active_buzzer, gpiod::line::value::ACTIVE);
-                        output_pins.set_value(red_led, gpiod::line::value::ACTIVE);
+        // Not every chip can debounce (the simulated one can't), those lines are debounced here on the event
+        // timestamps instead. Either way only clean presses/releases make it into the ring.
+        debounce::debouncer button_filter(*input_pins, std::chrono::milliseconds(10));
 
-                        // Give some time for feedback before reading the next event
-                        fsleep(0.3);
+        // Recording is a copy into a memory-mapped file, cheap enough to do right here in thread 1.
+        std::unique_ptr<trace::recorder> recorder;
+        if (trace_path) {
+            recorder = std::make_unique<trace::recorder>(trace_path);
+        }
+        auto to_ring = [&ring](const backend::edge_event& event){ ring.push(event); };
+
+        // This runs the moment the kernel queues an edge event on the button (the fd turns readable).
+        // It does nothing but move the events into the ring, so it's back in epoll within microseconds.
+        event_loop.add(reader.fd(), [&](std::uint32_t){
+            reader.read([&](const backend::edge_event& event){
+                if (recorder) {
+                    recorder->record(event);
+                }
+                button_filter.feed(event, to_ring);
+            });
+            ring.notify(); // one wake-up for the whole batch
+        });
 
-                    } else if (event.type() == gpiod::edge_event::event_type::RISING_EDGE){
+        // And this runs when a debounce period runs out, in case the bouncing ended on the other level.
+        event_loop.add(button_filter.fd(), [&](std::uint32_t){
+            button_filter.on_timer(to_ring);
+            ring.notify();
+        });
 
-                        std::cout << "Thread 1: Button was released! (Rising Edge)" << '\n';
-                        output_pins.set_value(active_buzzer, gpiod::line::value::INACTIVE);
-                        output_pins.set_value(red_led, gpiod::line::value::INACTIVE);
+        // Thread 1 now waits here, handling events as they come, until CTRL+C calls event_loop.stop().
+        event_loop.run();
 
-                    } else {
+        // ----- Cleanup -----
+        main_log.log("Interrupt signal: {} recieved. Cleaning up...", interrupted_by);
 
-                        std::cout << "An unexpected event type was detected. Please check your code/wiring!" << '\n';
+        // Let thread 3 finish whatever is still in the ring, then stop it.
+        join_third_thread.join();
+        sched.rethrow_failure(); // in case the timer task failed
 
-                    }
-                }
-            }
+        // Nobody else is printing anymore: write out what the logger still has, after that std::cout is ours again.
+        log.stop();
 
-            usleep(100000);
+        std::cout << "Event ring (" << policy_name << "): peak " << ring.peak_fill() << "/" << ring.capacity()
+                  << " events, " << ring.dropped_count() << " dropped" << '\n';
+        for (const auto& line : button_filter.counts()) {
+            std::cout << "Debounce line " << line.offset << (line.by_chip ? " (by the chip)" : " (software)") << ": "
+                      << line.passed << " clean, " << line.suppressed << " bounces suppressed, " << line.corrected << " corrected" << '\n';
+        }
+        std::cout << "Responses: " << responses.triggers() << " rules triggered, " << responses.expiries() << " timed out, "
+                  << responses.write_count() << " writes, switch-off lateness " << responses.lateness().summary_us() << '\n';
+        reaction_latency.print(std::cout, "Reaction latency");
+        reader.print(std::cout, "Edge events");
+        button_reader = nullptr;
+        std::cout << "Logger: " << log.written() << " lines written, " << log.dropped() << " dropped (buffer full), "
+                  << log.rate_limited() << " dropped (rate limit)" << '\n';
+        if (recorder) {
+            std::cout << "Recorded " << recorder->recorded() << " edge events to " << trace_path << ".*" << '\n';
         }
-
-        // ----- Cleanup -----
 
         // Release resources after killing main loop.
-        output_pins.release();
-        input_pins.release();
-        main_header.close();
-
-        // MUST JOIN THE SECOND THREAD DURING CLEANUP, FAILURE TO DO SO WILL CAUSE CRASHING.
-        second_thread.join();
+        output_pins->release();
+        input_pins->release();
+        main_header->close();
 
         std::cout << "Succesfully released all resources. Terminating..." << std::endl;
 
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <csignal> // for SIGINT (CTRL+C)
+#include <string>
+#include <vector>
+
+#include "args.hpp"
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "pulse_meter.hpp"
+#include "reactor.hpp"
+#include "tasks.hpp"
+
+/*
+Measures the signals on some input lines: frequency, period, duty cycle and pulse width, once a second.
+
+  pulse-meter [chip] [lines] [clock]
+
+Think of a fan's tachometer, a PWM output you want to check, or a flow meter. The monitor example reacts to a button
+pressed a few times a minute, the sensor example times one echo at a time. Here every edge of a signal of tens of
+kHz counts, on several lines at once, so nothing happens per edge except some adding up (see
+libgpiod-common/pulse_meter.hpp): the events are read in batches of up to 1024 from a 1024 event kernel buffer, on an
+epoll event loop that only wakes up when there's something to read, and all the times come from the kernel's
+timestamps.
+
+The clock is the one the kernel stamps the edges with: "monotonic" (the default), "realtime" or "hte" for a hardware
+timestamp engine, which the pi doesn't have (the request fails).
+
+On the sim chip the lines get square waves: the first one 20kHz at 25% duty, the second 10kHz at 50%, and so on.
+*/
+
+backend::event_clock parse_clock(const std::string& name) {
+    if (name == "monotonic") {
+        return backend::event_clock::MONOTONIC;
+    } else if (name == "realtime") {
+        return backend::event_clock::REALTIME;
+    } else if (name == "hte") {
+        return backend::event_clock::HTE;
+    }
+    throw std::system_error(EINVAL, std::generic_category(), "unknown event clock \"" + name + "\", use monotonic, realtime or hte");
+}
+
+// Once a second: what every line did in that second.
+tasks::task<> print_reports(tasks::scheduler& sched, pulses::pulse_meter& meter) {
+    std::uint64_t events_before = 0;
+    while (true) {
+        co_await sched.sleep_for(std::chrono::seconds(1));
+        std::cout << meter.events() - events_before << " edges in the last second, largest burst " << meter.largest_burst() << " events" << '\n';
+        events_before = meter.events();
+        pulses::pulse_meter::print(meter.take_reports(), std::cout);
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    try {
+
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
+        std::cout << main_header->info() << '\n';
+
+        std::vector<unsigned int> offsets = args::parse_offsets(argc > 2 ? argv[2] : "21");
+        backend::event_clock clock = parse_clock(argc > 3 ? argv[3] : "monotonic");
+
+        // Both edges of every line, in the biggest queue the kernel allows, so a burst has room while we're not looking.
+        backend::request_builder request = main_header->prepare_request();
+        request.set_consumer("pulse-meter");
+        request.set_event_buffer_size(1024);
+        for (unsigned int offset : offsets) {
+            request.add_line_settings(offset, backend::line_settings().set_edge_detection(backend::edge::BOTH).set_event_clock(clock));
+        }
+        std::unique_ptr<backend::line_request> input_pins = request.do_request();
+        std::cout << "Measuring " << backend::to_string(offsets) << " (Press CTRL+C to stop.)" << '\n' << '\n';
+
+        pulses::pulse_meter meter(*input_pins);
+
+        events::reactor event_loop;
+        event_loop.add(meter.fd(), [&](std::uint32_t) { meter.drain(); });
+        event_loop.watch_signals({SIGINT, SIGTERM}, [&](int) { event_loop.stop(); });
+
+        tasks::scheduler sched(event_loop);
+        sched.spawn(print_reports(sched, meter));
+
+        auto* sim = dynamic_cast<backend::sim_chip*>(main_header.get());
+        if (sim) {
+            for (std::size_t i = 0; i < offsets.size(); i++) {
+                sim->play_square_wave(offsets[i], 20000.0 / static_cast<double>(i + 1), 0.25 * static_cast<double>(i % 3 + 1), std::chrono::hours(24));
+            }
+        }
+
+        event_loop.run();
+        sched.rethrow_failure();
+
+        std::cout << '\n' << "Stopping. " << meter.events() << " edges in " << meter.drain_calls() << " wake-ups." << '\n';
+        if (sim) {
+            sim->stop_patterns();
+        }
+        input_pins->release();
+        main_header->close();
+
+    } catch (const std::system_error& e) {
+
+        std::cout << "Measuring failed!" << '\n';
+        std::cout << "Error: " << e.what() << '\n';
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,207 +1,316 @@
 #include <iostream>
-#include <algorithm>
-#include <csignal>
 #include <atomic>
+#include <csignal>
+#include <thread>
+#include <vector>
+#include <algorithm>
 
-#include <unistd.h>
-#include <gpiod.hpp> // library originally for C so you need to include .hpp version of it
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "filters.hpp"
+#include "histogram.hpp"
+#include "joiner.hpp"
+#include "logger.hpp"
+#include "ranging.hpp"
+#include "reactor.hpp"
+#include "sim_ultrasonic.hpp"
+#include "soft_pwm.hpp"
+#include "spsc_ring.hpp"
+#include "trace.hpp"
 
 // THIS EXAMPLE SHOWS HOW TO KEEP TRACK A GPIOLINES ELECTRICAL STATE (RISE/FALL EVENTS) AND USE THAT TO INSTRUCT HARDWARE.
 // -----------------------------------------------------------------------------------------------------------------------
 
-// Keeps loop running till we say otherwise, used in place of while(true)... -> while(loopRunning).
-std::atomic<bool> loopRunning(true);
+// Keeps the alert thread running till we say otherwise.
+std::atomic<bool> alerts_running(true);
+
+// Finished measurements go from the main thread (measuring) to the alert thread (reacting) through this ring.
+using measurement_ring = rings::spsc_ring<ranging::measurement, 256>;
+
+// How long the buzzer and LED took to react: from the kernel's timestamp on the echo's falling edge (the moment the
+// measurement was complete) to the PWM write that started the new duty cycle. One histogram per output line,
+// printed on exit or whenever you send the program SIGUSR1 (`kill -USR1 <pid>`).
+metrics::line_latencies reaction_latency;
+
+/*
+The alert thread. Everything that takes time happens here so it can never delay a measurement: filtering, printing,
+deciding how loud/bright the buzzer and LED should be, and the flicker when nothing is found.
+Even the printing is only handed to the logger here (see libgpiod-common/logger.hpp), its own thread does the writing.
+*/
+void handle_measurements(measurement_ring& results, pwm::soft_pwm& alerts, ranging::sensor_array& sensors, events::reactor& event_loop,
+                         logging::channel& out) {
+    const std::size_t buzzer_channel{0};
+    const std::size_t led_channel{1};
+
+    // At 40 measurements a second (per sensor) printing every single one is a bit much, so only every 10th gets printed.
+    const std::uint64_t print_every{10};
+    std::uint64_t received{0};
+
+    // One missed echo can happen, a quarter of a second of them (from the same sensor) means something is wrong.
+    const std::uint64_t give_up_after{10};
+    std::vector<std::uint64_t> missed_in_a_row(sensors.num_sensors(), 0);
+
+    // Single readings are noisy and now and then plain wrong (an echo off something else). Acting on every raw reading
+    // makes the buzzer chatter, so each sensor's readings go through a median of 5 (throws the wild ones out) and a
+    // Kalman filter (smooths the jitter) first, see libgpiod-common/filters.hpp. The alerts only look at the result.
+    std::vector<filters::distance_filter<5>> smoothed(sensors.num_sensors(), filters::distance_filter<5>(filters::smoothing::KALMAN));
+
+    // The alert is for whatever is closest to any of the sensors.
+    std::vector<double> latest(sensors.num_sensors(), -1.0);
+
+    ranging::measurement result;
+    while (true) {
+        while (results.pop(result)) {
+            received++;
+
+            if (result.timed_out) {
+                missed_in_a_row[result.sensor]++;
+                if (missed_in_a_row[result.sensor] < give_up_after) {
+                    continue;
+                }
+
+                if (result.echo_start_ns == 0) {
+                    out.log("Sensor {}: No trigger/echo received. Check your wiring/resistors.", result.sensor);
+                    missed_in_a_row[result.sensor] = 0;
+                    continue;
+                }
+
+                out.log("OBJECT IS FAR TOO CLOSE OR NONE WERE FOUND. PLEASE CHECK YOUR CIRCUIT/ENVIRONMENT AND TRY AGAIN.");
 
-// When we press CTRL+C the OS sends an interupt signal (SIGINT) with a number we can use to ID it.
-// The entire point of this is so that we have a specific while loop we can turn on and off via CTRL+C without killing the entire program.
-void signal_handler(int signum) {
-    std::cout << "Interupt Signal: " << signum << " recieved. Cleaning up..." << '\n';
+                // Flicker four times (5Hz at 50% for 800ms) then kill the program.
+                alerts.set_channel(buzzer_channel, 5.0, 0.5);
+                alerts.set_channel(led_channel, 5.0, 0.5);
+                timing::deadline_timer().wait(std::chrono::milliseconds(800));
 
-    // kill the loop.
-    loopRunning = false;
+                event_loop.stop();
+                return;
+            }
+            missed_in_a_row[result.sensor] = 0;
+            latest[result.sensor] = smoothed[result.sensor].update(result.distance_cm);
+
+            if (received % print_every == 0) {
+                out.log("Sensor {} distance: {}cm (raw {}cm, {} measurements/s from all sensors)", result.sensor, latest[result.sensor],
+                        result.distance_cm, sensors.rate_hz());
+            }
+
+            double distance_from_object{1e9};
+            for (double distance : latest) {
+                if (distance >= 0) {
+                    distance_from_object = std::min(distance_from_object, distance);
+                }
+            }
+
+            // Activation logic.
+            // If close enough the light and buzzer come on quietly, then louder, then fully on.
+            // The PWM thread does the switching so none of this blocks anything.
+            double intensity{0.0};
+
+            if (distance_from_object > 15 && distance_from_object < 20){
+                intensity = 0.2;
+            } else if (distance_from_object > 5 && distance_from_object < 15){
+                intensity = 0.5;
+            } else if (distance_from_object >= 0 && distance_from_object < 5){
+                intensity = 1.0;
+            } else {
+                // Simply print distance, object is not close enough for a reaction.
+            }
+
+            alerts.set_duty(buzzer_channel, intensity, result.echo_end_ns);
+            alerts.set_duty(led_channel, intensity, result.echo_end_ns);
+        }
+
+        if (!alerts_running) {
+            break;
+        }
+        results.wait();
+    }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    // When we press CTRL+C the OS sends an interupt signal (SIGINT). It's read from a signalfd by the event loop below,
+    // this has to happen before any other thread is started so none of them gets the signal instead.
+    // Being an ordinary event, the "handler" isn't limited to what's safe in a real signal handler, but all it does for
+    // CTRL+C is remember the signal and stop the loop, the printing and cleaning up happen after event_loop.run().
+    // SIGUSR1 arrives the same way and prints the reaction latencies and dropped echo edges so far.
+    events::reactor event_loop;
+    const events::edge_reader* echo_reader = nullptr; // set once the sensors are set up
+    int interrupted_by{0};
+    event_loop.watch_signals({SIGINT, SIGUSR1}, [&event_loop, &echo_reader, &interrupted_by](int signum) {
+        if (signum == SIGUSR1) {
+            reaction_latency.print(std::cout, "Reaction latency");
+            if (echo_reader) {
+                echo_reader->print(std::cout, "Echo events");
+            }
+            return;
+        }
+        interrupted_by = signum;
+        event_loop.stop();
+    });
 
     try {
 
-        gpiod::chip main_header("/dev/gpiochip0"); // 40pin header on the rpi4.
+        // 40pin header on the rpi4 by default, pass "sim" or "gpio-sim" to run without a pi.
+        std::unique_ptr<backend::chip> main_header = backend::open_chip(argc > 1 ? argv[1] : "/dev/gpiochip0");
         std::cout << "Successfully instantitated chip object." << '\n';
 
         // ---- MY ACTIVE GPIO PINS ----
-        // inputs (listening for a signal)
-        const unsigned int sensor_echo{21};
+        // Every sensor has a trigger (output) and an echo (input). Got more than one? Add a line per sensor.
+        // Sensors in the same group take turns so they don't hear each other's bursts, put sensors that point
+        // different ways in groups of their own and they all measure at the same time.
+        struct sensor_pins {
+            unsigned int trigger;
+            unsigned int echo;
+            unsigned int group;
+        };
+        const std::vector<sensor_pins> sensor_list{
+            {20, 21, 0},
+        };
 
         // outputs (pushing voltage to them)
-        const unsigned int sensor_trigger{20};
         const unsigned int active_buzzer{16};
         const unsigned int red_led{17};
 
-        // other
-        constexpr double SPEED_OF_SOUND = 0.0343; // cm per microsecond.
+        // On the simulated chip nothing would ever answer the trigger, so put a pretend sensor on the pins with an
+        // object 12cm away (the next one 40cm, and so on). Pretend sensors are as noisy as real ones.
+        std::unique_ptr<backend::sim_ultrasonic> pretend_sensors;
+        if (auto* sim = dynamic_cast<backend::sim_chip*>(main_header.get())) {
+            pretend_sensors = std::make_unique<backend::sim_ultrasonic>(*sim);
+            for (std::size_t i = 0; i < sensor_list.size(); i++) {
+                pretend_sensors->add_sensor(sensor_list[i].trigger, sensor_list[i].echo, 12.0 + 28.0 * static_cast<double>(i));
+                pretend_sensors->set_noise(i, 1.0, 0.05);
+            }
+        }
 
         // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST FOR MULTIPLE OUTPUT LINES.
-        gpiod::request_builder outputs_request = main_header.prepare_request();
-        gpiod::line_settings line_settings = gpiod::line_settings(); // Initializes a line_settings object with default values.
+        // All the triggers go in one request so sensors that fire together share one write.
+        backend::request_builder outputs_request = main_header->prepare_request();
+        backend::line_settings line_settings = backend::line_settings(); // Initializes a line_settings object with default values.
         outputs_request.set_consumer("main.cpp_outputs");
-        outputs_request.add_line_settings(sensor_trigger, line_settings.set_direction(gpiod::line::direction::OUTPUT));
-        outputs_request.add_line_settings(active_buzzer, line_settings.set_direction(gpiod::line::direction::OUTPUT));
-        outputs_request.add_line_settings(red_led, line_settings.set_direction(gpiod::line::direction::OUTPUT));
+        for (const auto& pins : sensor_list) {
+            outputs_request.add_line_settings(pins.trigger, line_settings.set_direction(backend::direction::OUTPUT));
+        }
+
+        // The buzzer and LED get a request of their own because the PWM thread writes to them while the main thread
+        // keeps using the trigger (one line request shouldn't be written from two threads at once).
+        backend::request_builder alerts_request = main_header->prepare_request();
+        alerts_request.set_consumer("main.cpp_alerts");
+        alerts_request.add_line_settings(active_buzzer, line_settings.set_direction(backend::direction::OUTPUT));
+        alerts_request.add_line_settings(red_led, line_settings.set_direction(backend::direction::OUTPUT));
 
-        // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST FOR AN INPUT LINE.
-        gpiod::request_builder inputs_request = main_header.prepare_request();
+        // THE CODE BELOW DESCRIBES HOW TO BUILD A REQUEST FOR INPUT LINES.
+        // Every echo goes in this one request, each event says which line it came from (line_offset()).
+        backend::request_builder inputs_request = main_header->prepare_request();
         inputs_request.set_consumer("main.cpp_inputs");
-        inputs_request.add_line_settings(sensor_echo, line_settings.set_direction(gpiod::line::direction::INPUT));
-        inputs_request.add_line_settings(sensor_echo, line_settings.set_edge_detection(gpiod::line::edge::BOTH));
+        line_settings.set_direction(backend::direction::INPUT).set_edge_detection(backend::edge::BOTH);
+        for (const auto& pins : sensor_list) {
+            inputs_request.add_line_settings(pins.echo, line_settings);
+        }
 
         // After running do_request(), you can make various changes to the requested GPIO pins using the library's methods via this object.
-        gpiod::line_request output_pins = outputs_request.do_request();
-        gpiod::line_request input_pins = inputs_request.do_request();
+        std::unique_ptr<backend::line_request> output_pins = outputs_request.do_request();
+        std::unique_ptr<backend::line_request> alert_pins = alerts_request.do_request();
+        std::unique_ptr<backend::line_request> input_pins = inputs_request.do_request();
 
         std::cout << "Successfully requested pins." << '\n' << std::endl;
-        std::cout << "Output pins: " << output_pins.offsets() << '\n';
-        std::cout << "Input pins: " << input_pins.offsets() << '\n' << '\n';
-
-        // register that kill function.
-        std::signal(SIGINT, signal_handler);
-
-        while (loopRunning) {
-
-            /*
-            The main loop is going to work like this:
-
-            My input component is an HC-SR04 proximity sensor. To start a distance measurement, I supply the trig pin with power for 10 microseconds.
-            The component sends out a ultrasonic burst and sets the echo pin (my input) to high. I am going to measure how long this state lasts.
-            When the burst is reflected back to the component (bouncing off an object in close proximity) the component will set the echo pin
-            back to its original state (low).
-
-            I'm going to measure how long the pin is set to high by watching for two time stamps, one when the pin is set to high and another when set to low.
-            Then I will subtract the first timestamp from the second to find out the total duration the pin was in the high state.
-
-            To find the distance of the object I will use this formula:
-            DISTANCE(cm) = DURATION(microseconds) * SPEED OF SOUND / 2.
-            This distance will then be printed into the console and used in the logic for whether or not the active buzzer and LED should turn on.
-            */
-
-            // THE CODE BELOW DESCRIBES HOW TO READ ELECTRICAL STATE CHANGES (RISE/FALL EVENTS) FROM WATCHED GPIO PINS.
-            // This buffer essentially works as an array to store info about any rising/falling edge events that occur.
-            gpiod::edge_event_buffer buffer(4); // buffer event capacity.
-
-            // send voltage for 10 microseconds.
-            output_pins.set_value(sensor_trigger, gpiod::line::value::ACTIVE);
-            usleep(10);
-            output_pins.set_value(sensor_trigger, gpiod::line::value::INACTIVE);
-
-            // If the echo pin changes voltage (the method returns true and this runs).
-            if (input_pins.wait_edge_events(std::chrono::milliseconds(100))) {
-
-                // Wait just a few milliseconds for the sound to actually come back.
-                usleep(30000);
-                input_pins.read_edge_events(buffer); // actually reading the buffer now that we expect rise/fall events to be inside.
-
-                /*
-                Using a lambda to check if we ever recieved a falling-edge (if we didn't that means no object was found).
-
-                Code below says:
-                Check between two pointers: buffer.begin(), and buffer.end(), then read all objects of type gpiod::event_edge at their place in memory.
-                If any of them are a falling edge event return false, else return true (no falling edge was found).
-                It does this for all objects between those pointers and we can use the truthiness of the bool value to make judgements afterwards.
-                */
-                bool no_falling_edge = std::none_of( buffer.begin(), buffer.end(), [](const gpiod::edge_event& event) {
-                        if (event.type() == gpiod::edge_event::event_type::FALLING_EDGE) {
-                            return true;
-                        } else {
-                            return false;
-                        }
-                    }
-                );
-
-                if (no_falling_edge) {
-                    std::cout << "OBJECT IS FAR TOO CLOSE OR NONE WERE FOUND. PLEASE CHECK YOUR CIRCUIT/ENVIRONMENT AND TRY AGAIN." << '\n';
-
-                    // Flicker three times then kill the program.
-                    for (unsigned int i = 0; i < 4; i++){
-                        output_pins.set_value(red_led, gpiod::line::value::ACTIVE);
-                        output_pins.set_value(active_buzzer, gpiod::line::value::ACTIVE);
-                        usleep(200000);
-                        output_pins.set_value(red_led, gpiod::line::value::INACTIVE);
-                        output_pins.set_value(active_buzzer, gpiod::line::value::INACTIVE);
-                    }
-
-                    break;
-
-                } else {
-
-                    unsigned int start_time{0};
-                    unsigned int end_time{0};
-
-                    for (const auto& event : buffer) {
-
-                        if (event.type() == gpiod::edge_event::event_type::RISING_EDGE){
-                            start_time = event.timestamp_ns();
-                        } else if (event.type() == gpiod::edge_event::event_type::FALLING_EDGE){
-                            end_time = event.timestamp_ns();
-                        } else {
-                            std::cout << "Unexpected event type. Please check your logic for capturing events." << '\n';
-                        }
-
-                        if (start_time > 0 && end_time > 0) {
-
-                            // start and endtimes were returned in nanoseconds, need to convert to microseconds here.
-                            unsigned int burst_duration{ (end_time - start_time)/1000 };
-
-                            // DISTANCE(cm) = DURATION(in microseconds) * SPEED OF SOUND / 2.
-                            double distance_from_object{ (burst_duration * SPEED_OF_SOUND) / 2 };
-                            std::cout<< "Distance: " << distance_from_object << "cm" << '\n';
-
-                            // Activation logic.
-                            // If close enough activate the light on its own slow flicker, then with a medium flicker, then a fast flicker.
-                            if (distance_from_object > 15 && distance_from_object < 20){
-
-                                output_pins.set_value(red_led, gpiod::line::value::ACTIVE);         // turns on the pin.
-                                output_pins.set_value(active_buzzer, gpiod::line::value::ACTIVE);
-                                usleep(500000);
-                                output_pins.set_value(red_led, gpiod::line::value::INACTIVE);       // turns off the pin.
-                                output_pins.set_value(active_buzzer, gpiod::line::value::INACTIVE);
-
-                            } else if (distance_from_object > 5 && distance_from_object < 15){
-
-                                output_pins.set_value(red_led, gpiod::line::value::ACTIVE);
-                                output_pins.set_value(active_buzzer, gpiod::line::value::ACTIVE);
-                                usleep(200000);
-                                output_pins.set_value(red_led, gpiod::line::value::INACTIVE);
-                                output_pins.set_value(active_buzzer, gpiod::line::value::INACTIVE);
-
-                            } else if (distance_from_object >= 0 && distance_from_object < 5){
-
-                                output_pins.set_value(red_led, gpiod::line::value::ACTIVE);
-                                output_pins.set_value(active_buzzer, gpiod::line::value::ACTIVE);
-                                usleep(100000);
-                                output_pins.set_value(red_led, gpiod::line::value::INACTIVE);
-                                output_pins.set_value(active_buzzer, gpiod::line::value::INACTIVE);
-
-                            } else {
-
-                                // Simply print distance, object is not close enough for a reaction.
-
-                            }
-                        }
+        std::cout << "Output pins: " << backend::to_string(output_pins->offsets()) << " " << backend::to_string(alert_pins->offsets()) << '\n';
+        std::cout << "Input pins: " << backend::to_string(input_pins->offsets()) << '\n' << '\n';
+
+        // Instead of blinking faster the closer something gets, the buzzer and LED are driven with software PWM
+        // and get louder/brighter (a bigger duty cycle) the closer something gets. See libgpiod-common/soft_pwm.hpp.
+        pwm::soft_pwm alerts(*alert_pins);
+        alerts.add_channel(active_buzzer, 100.0, 0.0);
+        alerts.add_channel(red_led, 100.0, 0.0);
+        alerts.record_reactions(&reaction_latency);
+        alerts.start();
+
+        /*
+        The measuring is going to work like this:
+
+        My input component is an HC-SR04 proximity sensor. To start a distance measurement, I supply the trig pin with power for 10 microseconds.
+        The component sends out a ultrasonic burst and sets the echo pin (my input) to high. I am going to measure how long this state lasts.
+        When the burst is reflected back to the component (bouncing off an object in close proximity) the component will set the echo pin
+        back to its original state (low).
+
+        I'm going to measure how long the pin is set to high by watching for two time stamps, one when the pin is set to high and another when set to low.
+        Then I will subtract the first timestamp from the second to find out the total duration the pin was in the high state.
+
+        To find the distance of the object I will use this formula:
+        DISTANCE(cm) = DURATION(microseconds) * SPEED OF SOUND / 2.
+
+        Nothing here ever sleeps waiting for the echo. The event loop wakes up for each echo edge and for a timer, and the
+        next measurement is triggered as soon as the sensor is ready for it, 40 times a second. See libgpiod-common/ranging.hpp.
+        */
+        ranging::sensor_array sensors(*output_pins, *input_pins);
+        for (const auto& pins : sensor_list) {
+            sensors.add_sensor(pins.trigger, pins.echo, pins.group);
+        }
 
-                    }
+        // Echo edges are checked for seqno gaps as they're read, so if the kernel ever has to drop some (we didn't
+        // read them in time) it shows up per echo line in the counts printed on exit.
+        echo_reader = &sensors.echo_reader();
 
-                }
+        // Pass a path as the second argument to record every echo edge to a binary trace (e.g. `./sensor-example sim /tmp/echoes`),
+        // play it back later with libgpiod-trace.
+        std::unique_ptr<trace::recorder> recorder;
+        if (argc > 2) {
+            recorder = std::make_unique<trace::recorder>(argv[2]);
+            sensors.record_to(recorder.get());
+        }
 
-            } else {
-                std::cout << "No trigger/echo received. Check your wiring/resistors." << std::endl;
-            }
+        measurement_ring results;
+        auto to_alerts = [&results](const ranging::measurement& result) { results.push_notify(result); };
+        event_loop.add(sensors.echo_fd(), [&](std::uint32_t) { sensors.on_echo(to_alerts); });
+        event_loop.add(sensors.timer_fd(), [&](std::uint32_t) { sensors.on_timer(to_alerts); });
+
+        // The alert thread prints a lot more than anything else, through a logger so a slow console can't hold it up.
+        logging::logger log(std::cout);
+        std::thread alert_thread(handle_measurements, std::ref(results), std::ref(alerts), std::ref(sensors), std::ref(event_loop),
+                                 std::ref(log.open_channel("alerts")));
+
+        // A failed write or a ranging error from here on still stops and joins the alert thread on its way to the
+        // catch below (see libgpiod-common/joiner.hpp).
+        threads::joiner join_alert_thread(alert_thread, [&results]() {
+            alerts_running = false;
+            results.notify();
+        });
+
+        // Measure until CTRL+C (or until the alert thread gives up on finding anything).
+        sensors.start();
+        event_loop.run();
+
+        join_alert_thread.join();
+        alerts.stop();
+
+        // Write out whatever the logger still has first, so it's all in order.
+        log.stop();
+        if (interrupted_by) {
+            std::cout << "Interupt Signal: " << interrupted_by << " recieved. Cleaning up..." << '\n';
+        }
 
-            usleep(100000);
+        for (const auto& sensor : sensors.report()) {
+            std::cout << "Sensor on " << sensor.trigger << "/" << sensor.echo << " (group " << sensor.group << "): "
+                      << sensor.completed << " of " << sensor.triggers << " triggers, " << sensor.timed_out << " timed out, "
+                      << sensor.collisions << " dropped as collisions, last rate " << sensor.rate_hz << "/s" << '\n';
         }
+        std::cout << "Trigger pulse lateness: " << sensors.trigger_lateness().summary_us() << '\n';
+        if (recorder) {
+            std::cout << "Recorded " << recorder->recorded() << " echo edges to " << argv[2] << ".*" << '\n';
+        }
+        for (const auto& channel : alerts.report()) {
+            std::cout << "PWM line " << channel.offset << ": " << channel.achieved_hz << "Hz, duty error " << channel.duty_error << '\n';
+        }
+        reaction_latency.print(std::cout, "Reaction latency");
+        sensors.echo_reader().print(std::cout, "Echo events");
+        echo_reader = nullptr;
+        std::cout << "Logger: " << log.written() << " lines written, " << log.dropped() << " dropped (buffer full), "
+                  << log.rate_limited() << " dropped (rate limit)" << '\n';
 
         // Once you're done working with the pins make sure to close up shop.
-        output_pins.release();
-        input_pins.release();
-        main_header.close();
+        output_pins->release();
+        alert_pins->release();
+        input_pins->release();
+        pretend_sensors.reset();
+        main_header->close();
 
     } catch (const std::system_error& e) {
 
@@ -212,4 +321,4 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
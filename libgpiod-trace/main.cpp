@@ -0,0 +1,183 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.hpp"
+#include "gpio.hpp" // GPIO backend shared by the examples, see libgpiod-common/
+#include "histogram.hpp"
+#include "trace.hpp"
+
+/*
+The monitor and sensor examples can record every edge event they see to a binary trace (see libgpiod-common/trace.hpp).
+This tool reads those traces back:
+
+  trace-tool dump <trace>            prints every event, then a summary per line
+  trace-tool replay <trace> [speed]  plays the events into a simulated chip and reads them back like an example would
+
+Replaying means something that went wrong on the pi (a burst of bounces, echoes arriving in a weird order) can be
+played again, as often as you like, on any machine. speed 1 keeps the original timing, 10 is ten times faster and
+"max" is as fast as possible, handy to see how many events a second the reading side keeps up with.
+*/
+
+struct line_summary {
+    unsigned int offset{0};
+    std::uint64_t rising{0};
+    std::uint64_t falling{0};
+    std::uint64_t seqno_gaps{0};    // events the kernel dropped before they could be recorded
+    std::uint64_t last_seqno{0};
+};
+
+std::vector<line_summary> summarize(const std::vector<backend::edge_event>& events) {
+    std::vector<line_summary> lines;
+    for (const auto& event : events) {
+        auto line = std::find_if(lines.begin(), lines.end(), [&event](const line_summary& l) { return l.offset == event.line_offset(); });
+        if (line == lines.end()) {
+            lines.push_back(line_summary{});
+            line = lines.end() - 1;
+            line->offset = event.line_offset();
+        } else if (event.line_seqno() > line->last_seqno + 1) {
+            line->seqno_gaps += event.line_seqno() - line->last_seqno - 1;
+        }
+        line->last_seqno = event.line_seqno();
+        if (event.type() == backend::edge_event::event_type::RISING_EDGE) {
+            line->rising++;
+        } else {
+            line->falling++;
+        }
+    }
+    std::sort(lines.begin(), lines.end(), [](const line_summary& a, const line_summary& b) { return a.offset < b.offset; });
+    return lines;
+}
+
+void dump(const std::vector<backend::edge_event>& events) {
+    // Formatting happens here, offline, instead of in the program that recorded the trace.
+    std::uint64_t first = events.empty() ? 0 : events.front().timestamp_ns();
+    for (const auto& event : events) {
+        std::cout << "+" << (event.timestamp_ns() - first) / 1000 << "us line " << event.line_offset()
+                  << (event.type() == backend::edge_event::event_type::RISING_EDGE ? " rising" : " falling")
+                  << " seqno " << event.global_seqno() << "/" << event.line_seqno() << '\n';
+    }
+
+    std::uint64_t duration = events.empty() ? 0 : events.back().timestamp_ns() - first;
+    std::cout << events.size() << " events over " << duration / 1000000 << "ms" << '\n';
+    for (const auto& line : summarize(events)) {
+        std::cout << "Line " << line.offset << ": " << line.rising << " rising, " << line.falling << " falling, "
+                  << line.seqno_gaps << " missing (seqno gaps)" << '\n';
+    }
+}
+
+int replay(const std::vector<backend::edge_event>& events, double speed) {
+    // a recorder that never saw an edge still writes a trace.
+    if (events.empty()) {
+        std::cout << "The trace has no events, nothing to replay." << '\n';
+        return 0;
+    }
+
+    std::vector<unsigned int> offsets;
+    for (const auto& event : events) {
+        if (std::find(offsets.begin(), offsets.end(), event.line_offset()) == offsets.end()) {
+            offsets.push_back(event.line_offset());
+        }
+    }
+    if (offsets.size() > 64) {
+        std::cout << "The trace has " << offsets.size() << " lines, one request can only hold 64." << '\n';
+        return 1;
+    }
+
+    // A simulated chip big enough for every line in the trace, with all of them in one input request.
+    backend::sim_chip chip(*std::max_element(offsets.begin(), offsets.end()) + 1, "replay");
+    backend::request_builder inputs_request = chip.prepare_request();
+    backend::line_settings input_settings = backend::line_settings();
+    input_settings.set_direction(backend::direction::INPUT).set_edge_detection(backend::edge::BOTH);
+    inputs_request.set_consumer("trace-tool");
+    for (unsigned int offset : offsets) {
+        inputs_request.add_line_settings(offset, input_settings);
+    }
+    inputs_request.set_event_buffer_size(4096);
+    std::unique_ptr<backend::line_request> input_pins = inputs_request.do_request();
+
+    // The replaying happens on a second thread, this one reads the events back out of the request.
+    std::atomic<bool> replaying(true);
+    timing::deadline_timer pace(std::chrono::microseconds(50));
+    std::uint64_t started = backend::monotonic_ns();
+    std::thread player([&]() {
+        trace::replay(chip, events, speed, pace);
+        replaying = false;
+    });
+
+    backend::edge_event_buffer buffer(256);
+    metrics::latency_histogram delivery; // replayed edge to us reading it
+    std::size_t received{0};
+    std::size_t out_of_order{0};
+    while (received < events.size()) {
+        if (!input_pins->wait_edge_events(std::chrono::milliseconds(100))) {
+            if (!replaying) {
+                break; // everything was played and nothing more is coming
+            }
+            continue;
+        }
+        input_pins->read_edge_events(buffer);
+        std::uint64_t now = backend::monotonic_ns();
+        for (const auto& event : buffer) {
+            // every event should come back as the same line and edge, in the same order.
+            if (received < events.size() &&
+                (event.line_offset() != events[received].line_offset() || event.type() != events[received].type())) {
+                out_of_order++;
+            }
+            delivery.record(now > event.timestamp_ns() ? now - event.timestamp_ns() : 0);
+            received++;
+        }
+    }
+    player.join();
+    std::uint64_t took = backend::monotonic_ns() - started;
+
+    auto* sim_request = dynamic_cast<backend::sim_line_request*>(input_pins.get());
+    std::uint64_t overflows = sim_request ? sim_request->overflow_count() : 0;
+
+    std::cout << "Replayed " << events.size() << " events on " << offsets.size() << " lines in " << took / 1000000 << "ms ("
+              << static_cast<double>(events.size()) * 1e9 / static_cast<double>(took ? took : 1) << " events/s)" << '\n';
+    std::cout << "Read back " << received << ", " << out_of_order << " different from the trace, " << overflows << " lost to a full queue" << '\n';
+    if (speed > 0) {
+        std::cout << "Replay lateness: " << pace.lateness().summary_us() << '\n';
+    }
+    std::cout << "Delivery latency: " << delivery.summary_us() << '\n';
+
+    input_pins->release();
+    chip.close();
+    return received == events.size() && out_of_order == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    std::string command = argc > 1 ? argv[1] : "";
+    if (argc < 3 || (command != "dump" && command != "replay")) {
+        std::cout << "Usage: " << argv[0] << " dump <trace>" << '\n';
+        std::cout << "       " << argv[0] << " replay <trace> [speed]   (1 = original timing, max = as fast as possible)" << '\n';
+        return 1;
+    }
+
+    try {
+
+        // trace::replay() takes 0 for as fast as possible.
+        std::string speed_arg = argc > 3 ? argv[3] : "1";
+        double speed = speed_arg == "max" ? 0.0 : args::parse_positive(speed_arg, "speed");
+
+        // <trace> is what you passed to the example, the files are <trace>.0, <trace>.1, ...
+        std::vector<backend::edge_event> events = trace::load(argv[2]);
+
+        if (command == "dump") {
+            dump(events);
+            return 0;
+        }
+        return replay(events, speed);
+
+    } catch (const std::system_error& e) {
+
+        std::cout << "Trace failed!" << '\n';
+        std::cout << "Error: " << e.what() << '\n';
+
+        return 1;
+    }
+}